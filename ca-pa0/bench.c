@@ -0,0 +1,221 @@
+/**********************************************************************
+ * bench.c
+ *
+ * Measure tokenize() against reference_tokenize() on generated corpora,
+ * with the separator sets of every front end. Each corpus is a run of
+ * '\0'-terminated lines that is copied afresh before every pass, since
+ * tokenizing writes into the lines. The best of the passes is reported.
+ *
+ *   bench [-m megabytes per corpus] [-r passes]
+ **********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tokenizer.h"
+#include "reference.h"
+
+#define MAX_TOKENS      (1 << 12)
+
+enum corpora {
+    CORPUS_SHORT = 0,        /* Commands like the testcases */
+    CORPUS_LONG,             /* Lines of a few KB with many operands */
+    CORPUS_COMMENTS,         /* Short code with long comments */
+    CORPUS_WHITESPACE,       /* Tokens lost in runs of blanks */
+    NR_CORPORA,
+};
+
+static const char * const corpus_names[NR_CORPORA] = {
+    "short", "long", "comments", "whitespace",
+};
+
+struct corpus {
+    char *lines;             /* '\0'-terminated, back to back */
+    size_t size;
+    size_t *starts;          /* Of each line in @lines */
+    size_t nr_lines;
+};
+
+static uint64_t seed = 0x9e3779b97f4a7c15ull;
+
+static uint64_t __random(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+static const char * const commands[] = {
+    "add", "addi", "sub", "lw", "sw", "beq", "bne", "sll", "srl", "lui",
+    "show", "dump", "load", "run",
+};
+static const char * const registers[] = {
+    "zero", "at", "v0", "t0", "t1", "t2", "s0", "s1", "sp", "ra",
+};
+static const char blanks[] = "    \t\t\r\v\f";
+
+#define pick(array) (array[__random() % (sizeof(array) / sizeof(array[0]))])
+
+static char *__put_operand(char *p)
+{
+    if (__random() % 3) return p + sprintf(p, "%s", pick(registers));
+    return p + sprintf(p, "0x%x", (unsigned int)(__random() % 0x10000));
+}
+
+/* Put one line of @corpus at @p, without its '\0'. Returns the end of it */
+static char *__generate_line(int corpus, char *p)
+{
+    int nr_operands;
+
+    switch (corpus) {
+    case CORPUS_SHORT:
+        p += sprintf(p, "%s", pick(commands));
+        for (nr_operands = __random() % 4; nr_operands; nr_operands--) {
+            *p++ = ' ';
+            p = __put_operand(p);
+        }
+        break;
+
+    case CORPUS_LONG:
+        p += sprintf(p, "%s", pick(commands));
+        for (nr_operands = 200 + __random() % 400; nr_operands; nr_operands--) {
+            *p++ = ' ';
+            p = __put_operand(p);
+        }
+        break;
+
+    case CORPUS_COMMENTS:
+        if (__random() % 4) {
+            p += sprintf(p, "%s ", pick(commands));
+            p = __put_operand(p);
+            *p++ = ' ';
+        }
+        p += sprintf(p, __random() % 2 ? "# " : "// ");
+        for (int length = 40 + __random() % 120; length; length--) {
+            *p++ = 'a' + __random() % 26 - (__random() % 8 ? 0 : 32);
+        }
+        break;
+
+    case CORPUS_WHITESPACE:
+        for (int nr_tokens = __random() % 5 ? 1 + __random() % 6 : 0; ; nr_tokens--) {
+            for (int length = 1 + __random() % 40; length; length--) {
+                *p++ = blanks[__random() % (sizeof(blanks) - 1)];
+            }
+            if (!nr_tokens) break;
+            p = __put_operand(p);
+        }
+        break;
+    }
+    return p;
+}
+
+static int __generate(int corpus, size_t size, struct corpus *out)
+{
+    size_t max_lines = size / 8 + 1;
+
+    out->lines = malloc(size + (64 << 10));    /* Room for the last line */
+    out->starts = malloc(max_lines * sizeof(*out->starts));
+    out->nr_lines = 0;
+    if (!out->lines || !out->starts) return -1;
+
+    for (char *p = out->lines; (size_t)(p - out->lines) < size && out->nr_lines < max_lines; ) {
+        out->starts[out->nr_lines++] = p - out->lines;
+        p = __generate_line(corpus, p);
+        *p++ = '\0';
+        out->size = p - out->lines;
+    }
+    return 0;
+}
+
+static double __now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef int (*tokenize_fn)(const struct tokenizer *, char *, char *[], int);
+
+/* The fastest of @nr_passes over @corpus, in seconds. The tokens of the last pass go to @nr_tokens */
+static double __measure(tokenize_fn fn, const struct tokenizer *tokenizer,
+        const struct corpus *corpus, char *work, int nr_passes, uint64_t *nr_tokens)
+{
+    static char *tokens[MAX_TOKENS];
+    double best = 0;
+
+    for (int pass = 0; pass < nr_passes; pass++) {
+        double start, elapsed;
+
+        memcpy(work, corpus->lines, corpus->size);
+        *nr_tokens = 0;
+
+        start = __now();
+        for (size_t i = 0; i < corpus->nr_lines; i++) {
+            *nr_tokens += fn(tokenizer, work + corpus->starts[i], tokens, MAX_TOKENS);
+        }
+        elapsed = __now() - start;
+
+        if (pass == 0 || elapsed < best) best = elapsed;
+    }
+    return best;
+}
+
+int main(int argc, char * const argv[])
+{
+    size_t size = 32 << 20;
+    int nr_passes = 5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:r:")) != -1) {
+        switch (opt) {
+        case 'm':
+            size = strtoul(optarg, NULL, 0) << 20;
+            break;
+        case 'r':
+            nr_passes = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-m megabytes per corpus] [-r passes]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (nr_passes < 1) nr_passes = 1;
+
+    printf("%-10s %-4s %12s %12s %12s %12s %8s\n", "corpus", "", "ref MB/s", "ref Mtok/s",
+            "MB/s", "Mtok/s", "speedup");
+
+    for (int i = 0; i < NR_CORPORA; i++) {
+        struct corpus corpus;
+        char *work;
+
+        if (__generate(i, size, &corpus) || !(work = malloc(corpus.size))) {
+            fprintf(stderr, "Cannot generate the %s corpus\n", corpus_names[i]);
+            return EXIT_FAILURE;
+        }
+
+        for (int j = 0; j < NR_FRONT_ENDS; j++) {
+            const struct tokenizer *tokenizer = &front_ends[j].tokenizer;
+            uint64_t nr_expected, nr_tokens;
+            double reference, optimized;
+
+            reference = __measure(reference_tokenize, tokenizer, &corpus, work, nr_passes, &nr_expected);
+            optimized = __measure(tokenize, tokenizer, &corpus, work, nr_passes, &nr_tokens);
+
+            printf("%-10s %-4s %12.1f %12.1f %12.1f %12.1f %7.2fx%s\n",
+                    corpus_names[i], front_ends[j].name,
+                    corpus.size / reference / 1e6, nr_expected / reference / 1e6,
+                    corpus.size / optimized / 1e6, nr_tokens / optimized / 1e6,
+                    reference / optimized, nr_tokens == nr_expected ? "" : "  (token counts differ)");
+        }
+
+        free(work);
+        free(corpus.lines);
+        free(corpus.starts);
+    }
+    return EXIT_SUCCESS;
+}
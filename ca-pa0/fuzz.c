@@ -0,0 +1,238 @@
+/**********************************************************************
+ * fuzz.c
+ *
+ * Feed random lines to tokenize() and reference_tokenize() with the
+ * separator sets of every front end, and stop at the first line on which
+ * they disagree about nr_tokens or tokens[]. The tokens tokenize_each()
+ * hands out are checked against the reference as well, and when the
+ * callback stops the scan early, the rest of the line must be as it was,
+ * not lowercased. Lines are placed
+ * at random alignments, and some end right before an inaccessible page so
+ * that the vector loads are checked to stay within the page the line ends
+ * in. A few lines are far longer than any command, with thousands of
+ * tokens.
+ *
+ *   fuzz [-n iterations] [-s seed]
+ **********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "tokenizer.h"
+#include "reference.h"
+
+#define MAX_LINE        (1 << 16)
+#define MAX_TOKENS      (MAX_LINE / 2 + 1)
+
+/* Weighted towards the bytes the tokenizers treat specially */
+static const char alphabet[] =
+    "abcxyzABCXYZ019_$-+:"
+    "      \t\t\r\v\f\n,,..##//"
+    "@[`{\x80\xc1\xda\xfa\xff";
+
+static uint64_t seed = 0x9e3779b97f4a7c15ull;
+
+static uint64_t __random(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+static void __print_line(const char *line, size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = line[i];
+
+        if (c >= ' ' && c <= '~' && c != '\\') {
+            putchar(c);
+        } else {
+            printf("\\x%02x", c);
+        }
+    }
+    putchar('\n');
+}
+
+static void __print_tokens(const char *name, char * const tokens[], int nr_tokens)
+{
+    printf("%s: nr_tokens = %d\n", name, nr_tokens);
+    for (int i = 0; i < nr_tokens; i++) {
+        printf("  tokens[%d] = \"%s\"\n", i, tokens[i]);
+    }
+}
+
+struct stream {
+    char * const *expected;
+    const char *expected_line;
+    const char *line;
+    int nr_expected;
+    int nr_tokens;
+    int stop;             /* Stop the scan after this many tokens, or 0 */
+    int mismatch;
+};
+
+static int __check_token(char *token, void *data)
+{
+    struct stream *stream = data;
+    int i = stream->nr_tokens++;
+
+    if (i >= stream->nr_expected ||
+            token - stream->line != stream->expected[i] - stream->expected_line ||
+            strcmp(token, stream->expected[i])) {
+        stream->mismatch = 1;
+        return 1;
+    }
+    return stream->nr_tokens == stream->stop;
+}
+
+static char expected_line[MAX_LINE + 1];
+static char *expected[MAX_TOKENS], *tokens[MAX_TOKENS];
+
+/* Put @line of @length bytes at @at and into @expected_line */
+static void __place(const char *line, size_t length, char *at)
+{
+    memcpy(expected_line, line, length);
+    expected_line[length] = '\0';
+    memcpy(at, line, length);
+    at[length] = '\0';
+}
+
+/* Returns 0 if tokenize() agrees with the reference on @line placed at @at */
+static int __check_array(const struct front_end *front_end, const char *line, size_t length,
+        char *at, int max_tokens)
+{
+    int nr_expected, nr_tokens;
+
+    __place(line, length, at);
+    nr_expected = reference_tokenize(&front_end->tokenizer, expected_line, expected, max_tokens);
+    nr_tokens = tokenize(&front_end->tokenizer, at, tokens, max_tokens);
+
+    if (nr_tokens == nr_expected) {
+        int i;
+
+        for (i = 0; i < nr_tokens; i++) {
+            if (tokens[i] - at != expected[i] - expected_line) break;
+            if (strcmp(tokens[i], expected[i])) break;
+        }
+        if (i == nr_tokens) return 0;
+    }
+
+    printf("Mismatch for %s with max_tokens = %d at offset %zu:\n",
+            front_end->name, max_tokens, (size_t)((uintptr_t)at & 63));
+    __print_line(line, length);
+    __print_tokens("reference", expected, nr_expected);
+    __print_tokens("tokenize", tokens, nr_tokens);
+    return -1;
+}
+
+/*
+ * Returns 0 if tokenize_each() agrees with the reference on @line placed
+ * at @at, when stopped after @stop tokens unless @stop is 0
+ */
+static int __check_stream(const struct front_end *front_end, const char *line, size_t length,
+        char *at, int stop)
+{
+    struct stream stream = {
+        .expected = expected,
+        .expected_line = expected_line,
+        .line = at,
+    };
+    int nr_tokens;
+    size_t rest;
+
+    __place(line, length, at);
+    stream.nr_expected = reference_tokenize(&front_end->tokenizer, expected_line, expected, MAX_TOKENS);
+    if (stop > stream.nr_expected) stop = 0;
+    stream.stop = stop;
+
+    nr_tokens = tokenize_each(&front_end->tokenizer, at, __check_token, &stream);
+    if (stream.mismatch || nr_tokens != (stop ? stop : stream.nr_expected)) {
+        printf("Mismatch for %s in tokenize_each() at offset %zu:\n",
+                front_end->name, (size_t)((uintptr_t)at & 63));
+        __print_line(line, length);
+        __print_tokens("reference", expected, stream.nr_expected);
+        printf("tokenize_each: token %d of %d differs\n", stream.nr_tokens - 1, nr_tokens);
+        return -1;
+    }
+    if (!stop) return 0;
+
+    /* Past the '\0' after the last token handed out */
+    rest = expected[stop - 1] - expected_line + strlen(expected[stop - 1]) + 1;
+    if (rest >= length || !memcmp(at + rest, line + rest, length - rest)) return 0;
+
+    printf("Line changed for %s after tokenize_each() stopped at token %d, at offset %zu:\n",
+            front_end->name, stop - 1, (size_t)((uintptr_t)at & 63));
+    __print_line(line, length);
+    printf("tokenize_each: \"%.*s\"\n", (int)(length - rest), at + rest);
+    return -1;
+}
+
+int main(int argc, char * const argv[])
+{
+    const long page_size = sysconf(_SC_PAGESIZE);
+    uint64_t nr_iterations = 1000000;
+    size_t region;
+    char *pages;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+        case 'n':
+            nr_iterations = strtoull(optarg, NULL, 0);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 0) | 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n iterations] [-s seed]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* Room for the longest line, followed by a page that faults */
+    region = (MAX_LINE + 1 + page_size - 1) / page_size * page_size;
+    pages = mmap(NULL, region + page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pages == MAP_FAILED || mprotect(pages + region, page_size, PROT_NONE)) {
+        perror("Cannot map the pages");
+        return EXIT_FAILURE;
+    }
+
+    for (uint64_t i = 0; i < nr_iterations; i++) {
+        const struct front_end *front_end = &front_ends[i % NR_FRONT_ENDS];
+        static char line[MAX_LINE];
+        size_t length;
+        int max_tokens = __random() % 4 ? MAX_TOKENS : __random() % 8;
+        int stop = __random() % 4 ? 0 : __random() % 8 + 1;
+        char *at;
+
+        if (__random() % 1024 == 0) {
+            length = __random() % MAX_LINE;
+        } else {
+            length = __random() % 8 ? __random() % 80 : __random() % 600;
+        }
+
+        for (size_t j = 0; j < length; j++) {
+            line[j] = alphabet[__random() % (sizeof(alphabet) - 1)];
+        }
+
+        if (__random() % 2) {
+            at = pages + region - length - 1;
+        } else {
+            at = pages + __random() % (region - length);
+        }
+
+        if (__check_array(front_end, line, length, at, max_tokens) ||
+                __check_stream(front_end, line, length, at, stop)) {
+            printf("after %" PRIu64 " lines\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("%" PRIu64 " lines agree\n", nr_iterations);
+    return EXIT_SUCCESS;
+}
@@ -17,6 +17,10 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <ctype.h>
+
+#include "line_source.h"
+#include "tokenizer.h"
+
 /* To avoid security error on Visual Studio */
 #define _CRT_SECURE_NO_WARNINGS
 #pragma warning(disable : 4996)
@@ -63,62 +67,9 @@
  */
 static int parse_command(char *command, int *nr_tokens, char *tokens[])
 {
-	/* TODO
-	 * Followings are example code. You should delete them and implement 
-	 * your own code here
-	 */
-	
-	char* sStr=0;
-	static char *tstr;
-	int i=0,j=0;
-	int num_token=0;
-
-	if(command != NULL) sStr = command;
-
-	if(command[0]=='\0') return 0;
+	static const struct tokenizer tokenizer = TOKENIZER(TOKENIZER_WHITESPACE, 0);
 
-	while(!isspace(sStr[i]))
-	{
-		sStr++;
-		i++;
-	}
-
-	tokens[0]=&command[i];
-	while(command[i] != '\0')
-	{
-		if(!isspace(sStr[i]) || sStr[i] == '\0')
-		{
-			sStr[i] = '\0';
-			break;
-		}
-		i++;
-	}
-
-	tstr = &sStr[i+1];
-	num_token++;
-
-	j=i;
-	while(command[j] != '\0')
-	{	
-		if(command[j]=='\0') return 0;
-		sStr = tstr;
-		tokens[num_token] = &sStr[j];
-
-		while(sStr[j] != '\0')
-		{
-			if(!isspace(sStr[j]) || sStr[j] == '\0')
-			{
-				sStr[j] = '\0';
-				break;
-			}
-			j++;
-		}
-
-		tstr = &sStr[j+1];
-		num_token++;
-	}		
-
-	*nr_tokens = num_token;
+	*nr_tokens = tokenize(&tokenizer, command, tokens, MAX_NR_TOKENS);
 
 	return 0;
 }
@@ -129,18 +80,15 @@ static int parse_command(char *command, int *nr_tokens, char *tokens[])
  */
 int main(int argc, const char *argv[])
 {
-	char line[MAX_COMMAND] = { '\0' };
-	FILE *input = stdin;
+	struct line_source input;
+	char *line;
 
-	if (argc == 2) {
-		input = fopen(argv[1], "r");
-		if (!input) {
-			fprintf(stderr, "No input file %s\n", argv[1]);
-			return -EINVAL;
-		}
+	if (line_source_open(&input, argc == 2 ? argv[1] : NULL)) {
+		fprintf(stderr, "No input file %s\n", argv[1]);
+		return -EINVAL;
 	}
 
-	while (fgets(line, sizeof(line), input)) {
+	while ((line = line_source_next(&input, NULL))) {
 		char *tokens[MAX_NR_TOKENS] = { NULL };
 		int nr_tokens= 0;
 
@@ -153,7 +101,7 @@ int main(int argc, const char *argv[])
 		printf("\n");
 	}
 
-	if (input != stdin) fclose(input);
+	line_source_close(&input);
 
 	return 0;
 }
@@ -0,0 +1,62 @@
+/**********************************************************************
+ * reference.h
+ *
+ * What bench.c and fuzz.c hold tokenize() against: the token_started
+ * loop the front ends used to have, and the separator sets they use.
+ **********************************************************************/
+#ifndef __REFERENCE_H__
+#define __REFERENCE_H__
+
+#include <string.h>
+#include <ctype.h>
+
+#include "tokenizer.h"
+
+#define NR_FRONT_ENDS   4
+
+static const struct front_end {
+    const char *name;
+    struct tokenizer tokenizer;
+} front_ends[NR_FRONT_ENDS] = {
+    { "pa0", TOKENIZER(TOKENIZER_WHITESPACE, 0) },
+    { "pa1", TOKENIZER(" \t\r\n,.", TOKENIZER_HASH_COMMENTS | TOKENIZER_FOLD_CASE) },
+    { "pa2", TOKENIZER(TOKENIZER_WHITESPACE,
+                       TOKENIZER_HASH_COMMENTS | TOKENIZER_SLASH_COMMENTS | TOKENIZER_FOLD_CASE) },
+    { "pa3", TOKENIZER(TOKENIZER_WHITESPACE, TOKENIZER_HASH_COMMENTS | TOKENIZER_SLASH_COMMENTS) },
+};
+
+/*
+ * One byte at a time, with every separator overwritten by '\0'. Only the
+ * tokens are expected to match tokenize(), not the rest of the line.
+ */
+static inline int reference_tokenize(const struct tokenizer *tokenizer, char *line,
+        char *tokens[], int max_tokens)
+{
+    int nr_tokens = 0;
+    int token_started = 0;
+
+    for (char *curr = line; *curr != '\0'; curr++) {
+        if (((tokenizer->flags & TOKENIZER_HASH_COMMENTS) && curr[0] == '#') ||
+                ((tokenizer->flags & TOKENIZER_SLASH_COMMENTS) && curr[0] == '/' && curr[1] == '/')) {
+            *curr = '\0';
+            break;
+        }
+
+        if (memchr(tokenizer->separators, *curr, tokenizer->nr_separators)) {
+            *curr = '\0';
+            token_started = 0;
+            continue;
+        }
+
+        if (tokenizer->flags & TOKENIZER_FOLD_CASE) *curr = tolower((unsigned char)*curr);
+
+        if (!token_started) {
+            if (nr_tokens == max_tokens) break;
+            tokens[nr_tokens++] = curr;
+            token_started = 1;
+        }
+    }
+    return nr_tokens;
+}
+
+#endif
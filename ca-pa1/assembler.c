@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "file_parser.h"
+#include "symbol.h"
+
+/*
+ * Assemble a source with file_parser.c
+ *
+ *   assembler [-s | -j threads] [-r] input file output file
+ *
+ * By default the source is read twice, for pass 1 and pass 2. With -s it
+ * is assembled in a single pass, and with -j in parallel with up to the
+ * given number of threads, 0 for all CPUs. -r writes raw words.
+ */
+int main(int argc, char *argv[]) {
+
+	int single = 0, nr_threads = -1;
+	struct symbol_table *symbols;
+	FILE *fptr, *Out;
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "j:rs")) != -1) {
+		switch (opt) {
+		case 'j':
+			nr_threads = atoi(optarg);
+			break;
+		case 'r':
+			set_raw_output(1);
+			break;
+		case 's':
+			single = 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc - 2 || (single && nr_threads >= 0))
+		goto usage;
+
+	if ((fptr = fopen(argv[optind], "r")) == NULL) {
+		fprintf(stderr, "Cannot open %s\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+	if ((Out = fopen(argv[optind + 1], "wb")) == NULL) {
+		fprintf(stderr, "Cannot open %s\n", argv[optind + 1]);
+		fclose(fptr);
+		return EXIT_FAILURE;
+	}
+
+	symbols = symbol_table_create();
+
+	if (single) {
+		ret = parse_file_single(fptr, symbols, Out);
+	} else if (nr_threads >= 0) {
+		ret = parse_file_parallel(fptr, nr_threads, symbols, Out);
+	} else {
+		parse_file(fptr, 1, symbols, Out);
+		rewind(fptr);
+		ret = parse_file(fptr, 2, symbols, Out);
+
+		// Leave nothing behind on an undefined label, as the other modes do
+		if (ret != 0 && (fflush(Out) != 0 || ftruncate(fileno(Out), 0) != 0))
+			fprintf(stderr, "Cannot truncate %s\n", argv[optind + 1]);
+	}
+
+	symbol_table_destroy(symbols);
+	fclose(fptr);
+	if (fclose(Out) != 0) {
+		fprintf(stderr, "Cannot write %s\n", argv[optind + 1]);
+		return EXIT_FAILURE;
+	}
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+
+usage:
+	fprintf(stderr, "Usage: %s [-s | -j threads] [-r] input file output file\n", argv[0]);
+	return EXIT_FAILURE;
+}
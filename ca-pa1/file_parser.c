@@ -4,1094 +4,1351 @@
 #include <ctype.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <pthread.h>
 #include "file_parser.h"
-#include "tokenizer.h"
+#include "isa.h"
+#include "arena.h"
+#include "symbol.h"
 
 /*
- * The structs below map a character to an integer.
- * They are used in order to map a specific instruciton/register to its binary format in ASCII
+ * Memory for symbols and tokens
+ *
+ * Symbol names are interned in the name pools of symbol.h, and tokens are
+ * carved out of an arena on the stack of parse_line() and go away with the
+ * line. Neither calls malloc() per symbol or per token.
  */
+#define TOKEN_ARENA_SIZE	(64 * (MAX_LINE_LENGTH + 1))
 
-// Struct that stores registers and their respective binary reference
-struct {
-	const char *name;
-	char *address;
-} registerMap[] = {
-		{ "zero", "00000" },
-		{ "at", "00001" },
-		{ "v0", "00010" },
-		{ "v1", "00011" },
-		{ "a0", "00100" },
-		{ "a1", "00101" },
-		{ "a2", "00110" },
-		{ "a3", "00111" },
-		{ "t0", "01000" },
-		{ "t1", "01001" },
-		{ "t2", "01010" },
-		{ "t3", "01011" },
-		{ "t4", "01100" },
-		{ "t5", "01101" },
-		{ "t6", "01110" },
-		{ "t7", "01111" },
-		{ "s0", "10000" },
-		{ "s1", "10001" },
-		{ "s2", "10010" },
-		{ "s3", "10011" },
-		{ "s4", "10100" },
-		{ "s5", "10101" },
-		{ "s6", "10110" },
-		{ "s7", "10111" },
-		{ "t8", "11000" },
-		{ "t9", "11001" },
-		{ NULL, 0 } };
-
-// Struct for R-Type instructions mapping for the 'function' field in the instruction
-struct {
-	const char *name;
-	char *function;
-} rMap[] = {
-		{ "add", "100000" },
-		{ "sub", "100001" },
-		{ "and", "100100" },
-		{ "or",  "100101" },
-		{ "sll", "000000" },
-		{ "slt", "101010" },
-		{ "srl", "000010" },
-		{ "jr",  "001000" },
-		{ NULL, 0 } };
-
-// Struct for I-Type instructions
-struct {
-	const char *name;
-	char *address;
-} iMap[] = {
-		{ "lw",   "100011" },
-		{ "sw",   "101011" },
-		{ "andi", "001100" },
-		{ "ori",  "001101" },
-		{ "lui",  "001111" },
-		{ "beq",  "000100" },
-		{ "slti", "001010" },
-		{ "addi", "001000" },
-		{ NULL, 0 } };
-
-// Struct for J-Type instructions
-struct {
-	const char *name;
-	char *address;
-} jMap[] = {
-		{ "j", "000010" },
-		{ "jal", "000011" },
-		{ NULL, 0 } };
-
-void parse_file(FILE *fptr, int pass, char *instructions[], size_t inst_len, hash_table_t *hash_table, FILE *Out) {
+#define ARRAY_SIZE(a)		(sizeof(a) / sizeof((a)[0]))
 
-	char line[MAX_LINE_LENGTH + 1];
-	char *tok_ptr, *ret, *token = NULL;
-	int32_t line_num = 1;
-	int32_t instruction_count = 0x00000000;
-	int data_reached = 0;
-	//FILE *fptr;
-
-	/*fptr = fopen(src_file, "r");
-	if (fptr == NULL) {
-		fprintf(Out, "unable to open file %s. aborting ...\n", src_file);
-		exit(-1);
-	}*/
+/*
+ * Output
+ *
+ * Words are written as lines of 32 '0'/'1' characters, or after
+ * set_raw_output() as 4 big-endian bytes. A byte of a line is expanded
+ * into its 8 characters at once: a multiply copies it into every byte of
+ * a uint64_t, a mask keeps a different bit in each, and an add carries
+ * that bit up to bit 7 of its byte. Words are formatted into a buffer on
+ * the stack and written with one fwrite() per OUTPUT_WORDS words.
+ */
+#define OUTPUT_WORDS		128
 
-	while (1) {
-		if ((ret = fgets(line, MAX_LINE_LENGTH, fptr)) == NULL)
-			break;
-		line[MAX_LINE_LENGTH] = 0;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define BYTE_CHAR_BITS		0x8040201008040201ull	// Bit 7 in the first byte
+#else
+#define BYTE_CHAR_BITS		0x0102040810204080ull
+#endif
 
-		tok_ptr = line;
-		if (strlen(line) == MAX_LINE_LENGTH) {
-			fprintf(Out,
-					"line %d: line is too long. ignoring line ...\n", line_num);
-			line_num++;
-			continue;
-		}
+static int raw_output;
 
-		/* parse the tokens within a line */
-		while (1) {
+void set_raw_output(int raw) {
 
-			token = parse_token(tok_ptr, " \n\t$,", &tok_ptr, NULL);
+	raw_output = raw;
+}
 
-			/* blank line or comment begins here. go to the next line */
-			if (token == NULL || *token == '#') {
-				line_num++;
-				free(token);
-				break;
-			}
+// Bytes a word takes in the output
+static size_t word_size(void) {
 
-			printf("token: %s\n", token);
-
-			/*
-			 * If token is "la", increment by 8, otherwise if it exists in instructions[],
-			 * increment by 4.
-			 */
-			int x = search(token);
-			//int x = (binarySearch(instructions, 0, inst_len, token));
-			if (x >= 0) {
-				if (strcmp(token, "la") == 0)
-					instruction_count = instruction_count + 8;
-				else
-					instruction_count = instruction_count + 4;
-			}
+	return raw_output ? 4 : 33;
+}
 
-			// If token is ".data", reset instruction to .data starting address
-			else if (strcmp(token, ".data") == 0) {
-				instruction_count = 0x00002000;
-				data_reached = 1;
-			}
+// The characters of @byte, most significant bit first, as they lie in memory
+static uint64_t byte_chars(unsigned char byte) {
 
-			printf("PC Count: %d\n", instruction_count);
+	uint64_t bits = (byte * 0x0101010101010101ull) & BYTE_CHAR_BITS;
 
-			// If first pass, then add labels to hash table
-			if (pass == 1) {
+	bits = ((bits + 0x7f7f7f7f7f7f7f7full) >> 7) & 0x0101010101010101ull;
+	return bits + 0x3030303030303030ull;	// '0' or '1'
+}
 
-				printf("First pass\n");
+static char *format_word(char *p, uint32_t word) {
 
-				// if token has ':', then it is a label so add it to hash table
-				if (strstr(token, ":") && data_reached == 0) {
+	if (raw_output) {
+		p[0] = word >> 24;
+		p[1] = word >> 16;
+		p[2] = word >> 8;
+		p[3] = word;
+		return p + 4;
+	}
 
-					printf("Label\n");
+	for (int i = 0; i < 4; i++) {
+		uint64_t chars = byte_chars(word >> (24 - i * 8));
+		memcpy(p + i * 8, &chars, 8);
+	}
+	p[32] = '\n';
+	return p + 33;
+}
 
-					// Strip out ':'
-					//printf("Label: %s at %d with address %d: \n", token, line_num, instruction_count);
-					size_t token_len = strlen(token);
-					token[token_len - 1] = '\0';
+static void write_words(const uint32_t *words, size_t nr_words, FILE *Out) {
 
-					// Insert variable to hash table
-					uint32_t *inst_count;
-					inst_count = (uint32_t *)malloc(sizeof(uint32_t));
-					*inst_count = instruction_count;
-					int32_t insert = hash_insert(hash_table, token, strlen(token)+1, inst_count);
-
-					if (insert != 1) {
-						fprintf(Out, "Error inserting into hash table\n");
-						exit(1);
-					}
-				}
+	char buffer[OUTPUT_WORDS * 33];
 
-				// If .data has been reached, increment instruction count accordingly
-				// and store to hash table
-				else {
+	while (nr_words > 0) {
+		size_t n = nr_words < OUTPUT_WORDS ? nr_words : OUTPUT_WORDS;
+		char *p = buffer;
 
-					char *var_tok = NULL;
-					char *var_tok_ptr = tok_ptr;
+		for (size_t i = 0; i < n; i++)
+			p = format_word(p, words[i]);
+		fwrite(buffer, 1, p - buffer, Out);
 
-					// If variable is .word
-					if (strstr(tok_ptr, ".word")) {
+		words += n;
+		nr_words -= n;
+	}
+}
 
-						printf(".word\n");
+// Write @word @count times, formatting it only once
+static void write_repeated(uint32_t word, size_t count, FILE *Out) {
 
-						// Variable is array
-						if (strstr(var_tok_ptr, ":")) {
+	char buffer[OUTPUT_WORDS * 33];
+	size_t size = word_size();
 
-							printf("array\n");
+	if (count == 0)
+		return;
 
-							// Store the number in var_tok and the occurance in var_tok_ptr
-							var_tok = parse_token(var_tok_ptr, ":", &var_tok_ptr, NULL);
+	format_word(buffer, word);
+	for (size_t i = 1; i < OUTPUT_WORDS && i < count; i++)
+		memcpy(buffer + i * size, buffer, size);
 
-							// Convert char* to int
-							int freq = atoi(var_tok_ptr);
+	while (count > 0) {
+		size_t n = count < OUTPUT_WORDS ? count : OUTPUT_WORDS;
 
-							int num;
-							sscanf(var_tok, "%*s %d", &num);
+		fwrite(buffer, 1, n * size, Out);
+		count -= n;
+	}
+}
 
-							// Increment instruction count by freq
-							instruction_count = instruction_count + (freq * 4);
+/*
+ * Write @size bytes of data as words, four bytes to a word with the first
+ * in the least significant byte, the way .asciiz strings are laid out. The
+ * last word is padded with 0s
+ */
+static void write_bytes(const unsigned char *bytes, size_t size, FILE *Out) {
 
-							// Strip out ':' from token
-							size_t token_len = strlen(token);
-							token[token_len - 1] = '\0';
+	uint32_t words[OUTPUT_WORDS];
+	size_t nr_words = 0;
 
-							//printf("Key: '%s', len: %zd\n", token, strlen(token));
+	for (size_t i = 0; i < size; i += 4) {
+		uint32_t word = 0;
 
-							// Insert variable to hash table
-							uint32_t *inst_count;
-							inst_count = (uint32_t *)malloc(sizeof(uint32_t));
-							*inst_count = instruction_count;
-							int32_t insert = hash_insert(hash_table, token, strlen(token)+1, inst_count);
+		for (size_t j = 0; j < 4 && i + j < size; j++)
+			word |= (uint32_t)bytes[i + j] << (j * 8);
 
-							if (insert == 0) {
-								fprintf(Out, "Error in hash table insertion\n");
-								exit(1);
-							}
+		words[nr_words++] = word;
+		if (nr_words == OUTPUT_WORDS) {
+			write_words(words, nr_words, Out);
+			nr_words = 0;
+		}
+	}
+	write_words(words, nr_words, Out);
+}
 
-							printf("End array\n");
-						}
+// Bytes @size bytes of data take up, in whole words
+static int32_t data_size(size_t size) {
 
-						// Variable is a single variable
-						else {
+	return (size + 3) & ~(size_t)3;
+}
 
-							instruction_count = instruction_count + 4;
+/*
+ * Parse the values of a .byte or .half directive in @values into @bytes,
+ * @width bytes each, least significant byte first. Returns the number of
+ * bytes
+ */
+static size_t parse_data_values(const char *values, int width, unsigned char *bytes, size_t max_bytes) {
 
-							// Strip out ':' from token
-							size_t token_len = strlen(token);
-							token[token_len - 1] = '\0';
+	size_t size = 0;
+	char *end;
 
-							// Insert variable to hash table
-							uint32_t *inst_count;
-							inst_count = (uint32_t *)malloc(sizeof(uint32_t));
-							*inst_count = instruction_count;
-							int32_t insert = hash_insert(hash_table, token, strlen(token)+1, inst_count);
+	while (size + width <= max_bytes) {
+		long value;
 
-							if (insert == 0) {
-								fprintf(Out, "Error in hash table insertion\n");
-								exit(1);
-							}
+		values += strspn(values, " \t,");
+		value = strtol(values, &end, 0);
+		if (end == values)
+			break;
 
-							printf("end singe var\n");
-						}
-					}
+		for (int i = 0; i < width; i++)
+			bytes[size++] = (unsigned long)value >> (i * 8);
+		values = end;
+	}
+	return size;
+}
 
-					// Variable is a string
-					else if (strstr(tok_ptr, ".asciiz")) {
+/*
+ * Return the next token in @str, which ends at any of @delims, and point
+ * @next past its delimiter. Returns NULL at the end of @str. The rest of
+ * the assembler treats tokens as C strings and tokenizes overlapping parts
+ * of a line with different delimiters, so a token is a copy in @tokens
+ * rather than a NUL written into the line. A line with more tokens than
+ * @tokens can hold ends early.
+ */
+static char *next_token(struct arena *tokens, char *str, const char *delims, char **next) {
 
-						// Store the ascii in var_tok
-						var_tok_ptr+= 8;
-						var_tok = parse_token(var_tok_ptr, "\"", &var_tok_ptr, NULL);
+	char *token;
+	size_t len;
 
-						// Increment instruction count by string length
-						size_t str_byte_len = strlen(var_tok);
-						instruction_count = instruction_count + str_byte_len;
+	str += strspn(str, delims);
+	len = strcspn(str, delims);
 
-						// Strip out ':' from token
-						size_t token_len = strlen(token);
-						token[token_len - 1] = '\0';
+	if (len == 0 || (token = arena_alloc(tokens, len + 1)) == NULL) {
+		*next = str + strlen(str);
+		return NULL;
+	}
 
-						// Insert variable to hash table
-						uint32_t *inst_count;
-						inst_count = (uint32_t *)malloc(sizeof(uint32_t));
-						*inst_count = instruction_count;
-						int32_t insert = hash_insert(hash_table, token, strlen(token)+1, inst_count);
-
-						if (insert == 0) {
-							fprintf(Out, "Error in hash table insertion\n");
-							exit(1);
-						}
-					}
-				}
-			}
+	memcpy(token, str, len);
+	token[len] = '\0';
 
-			// If second pass, then interpret
-			else if (pass == 2) {
+	*next = str[len] ? str + len + 1 : str + len;
+	return token;
+}
 
-				printf("############    Pass 2   ##############\n");
+// A label collected by a chunk of a parallel assembly
+struct chunk_label {
+	char *name;
+	uint32_t value;
+	int relative;		// value is relative to the start of the chunk
+};
+
+// A range of lines of the source, assembled by one thread
+struct chunk {
+	char *begin, *end;
+	struct symbol_table *symbols;
+	FILE *Out;
+
+	// Where the chunk starts
+	int32_t first_line;
+	int32_t base;			// instruction count in pass 2
+	int32_t label_base;		// instruction count in pass 1
+	int data_reached;
+
+	// Where the chunk ends, relative to its start unless it has a .data
+	int32_t nr_lines;
+	int32_t count;
+	int count_relative;
+	int32_t label_count;
+	int label_count_relative;
+	int has_data;
+
+	struct chunk_label *labels;
+	size_t nr_labels;
+	size_t max_labels;
+	struct name_pool label_names;
+
+	// Output of pass 2, and the undefined labels it reported
+	char *output;
+	size_t output_size;
+	char *errors;
+	size_t errors_size;
+	int32_t nr_undefined;
+};
+
+// A reference to a label that was not defined yet when it was encoded
+struct fixup {
+	enum {
+		FIXUP_BRANCH,	// beq/bne: immediate is the label plus the instruction count
+		FIXUP_JUMP,		// j/jal: address is the label
+		FIXUP_LA,		// la: lui and ori of the upper and lower half of the label
+	} type;
+	char *label;
+	long offset;		// Of the (first) word in the output
+	int32_t instruction_count;
+};
+
+struct fixup_list {
+	struct fixup *fixups;
+	size_t nr_fixups;
+	size_t max_fixups;
+	struct name_pool labels;
+};
+
+// parse_line() does the work of both passes at once, see parse_file_single()
+#define SINGLE_PASS	3
+
+// State carried from line to line
+struct parse_state {
+	int32_t line_num;
+	int32_t instruction_count;
+	int data_reached;
+	int relative;			// instruction_count is relative to the start of a chunk
+	struct chunk *chunk;	// If set, labels are collected into the chunk
+	struct fixup_list *fixups;	// If set, undefined labels are patched later
+	FILE *errors;			// If set, undefined labels are reported here, not on stderr
+	int32_t nr_undefined;
+};
+
+static void chunk_add_label(struct chunk *chunk, char *name, uint32_t value, int relative) {
+
+	if (chunk->nr_labels == chunk->max_labels) {
+		chunk->max_labels = chunk->max_labels ? chunk->max_labels * 2 : 64;
+		chunk->labels = realloc(chunk->labels, chunk->max_labels * sizeof(struct chunk_label));
+		if (chunk->labels == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
 
-				// start interpreting here
-				// if j loop --> then instruction is: 000010 then immediate is insturction count in 26 bits??
+	chunk->labels[chunk->nr_labels].name = name_pool_strdup(&chunk->label_names, name);
+	chunk->labels[chunk->nr_labels].value = value;
+	chunk->labels[chunk->nr_labels].relative = relative;
+	chunk->nr_labels++;
+}
 
-				// If in .text section
-				if (data_reached == 0) {
+// Return the address of @label. In a single pass, a label that is not defined
+// yet reads as 0 and the word about to be written to @Out is patched later.
+// Otherwise it is undefined, which is reported and counted, and reads as 0
+static uint32_t label_address(struct parse_state *state, int type, char *label, struct symbol_table *symbols, FILE *Out) {
 
-					// Check instruction type
-					int instruction_supported = search(token);
-					char inst_type;
+	int32_t address = 0;
+	struct fixup_list *list = state->fixups;
 
-					// If instruction is supported
-					if (instruction_supported != -1) {
+	if (symbol_find(symbols, label, &address))
+		return address;
 
-						// token contains the instruction
-						// tok_ptr points to the rest of the line
+	if (list == NULL) {
+		fprintf(state->errors != NULL ? state->errors : stderr, "undefined label %s\n", label);
+		state->nr_undefined++;
+		return 0;
+	}
 
-						// Determine instruction type
-						inst_type = instruction_type(token);
+	if (list->nr_fixups == list->max_fixups) {
+		list->max_fixups = list->max_fixups ? list->max_fixups * 2 : 64;
+		list->fixups = realloc(list->fixups, list->max_fixups * sizeof(struct fixup));
+		if (list->fixups == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
 
-						if (inst_type == 'r') {
+	struct fixup *fixup = &list->fixups[list->nr_fixups++];
+	fixup->type = type;
+	fixup->label = name_pool_strdup(&list->labels, label);
+	fixup->offset = ftell(Out);
+	fixup->instruction_count = state->instruction_count;
+	return 0;
+}
 
-							// R-Type with $rd, $rs, $rt format
-							if (strcmp(token, "add") == 0 || strcmp(token, "sub") == 0
-									|| strcmp(token, "and") == 0
-									|| strcmp(token, "or") == 0 || strcmp(token, "slt") == 0) {
+// Define a label at the current instruction count
+static void define_label(struct parse_state *state, char *name, struct symbol_table *symbols) {
 
-								// Parse the instructio - get rd, rs, rt registers
-								char *inst_ptr = tok_ptr;
-								char *reg = NULL;
+	if (state->chunk != NULL)
+		chunk_add_label(state->chunk, name, state->instruction_count, state->relative);
+	else
+		symbol_define(symbols, name, state->instruction_count);
+}
 
-								// Create an array of char* that stores rd, rs, rt respectively
-								char **reg_store;
-								reg_store = malloc(3 * sizeof(char*));
-								if (reg_store == NULL) {
-									fprintf(Out, "Out of memory\n");
-									exit(1);
-								}
+static void parse_line(char *line, int pass, struct parse_state *state, struct symbol_table *symbols, FILE *Out) {
 
-								for (int i = 0; i < 3; i++) {
-									reg_store[i] = malloc(2 * sizeof(char));
-									if (reg_store[i] == NULL) {
-										fprintf(Out, "Out of memory\n");
-										exit(1);
-									}
-								}
+	char *tok_ptr = line, *token = NULL;
+	unsigned char token_buffer[TOKEN_ARENA_SIZE];
+	struct arena tokens;
 
-								// Keeps a reference to which register has been parsed for storage
-								int count = 0;
-								while (1) {
+	arena_init(&tokens, token_buffer, sizeof(token_buffer));
 
-									reg = parse_token(inst_ptr, " $,\n\t", &inst_ptr, NULL);
+	if (strlen(line) == MAX_LINE_LENGTH) {
+		fprintf(Out,
+				"line %d: line is too long. ignoring line ...\n", state->line_num);
+		state->line_num++;
+		return;
+	}
 
-									if (reg == NULL || *reg == '#') {
-										break;
-									}
+	/* parse the tokens within a line */
+	while (1) {
 
-									strcpy(reg_store[count], reg);
-									count++;
-									free(reg);
-								}
+		token = next_token(&tokens, tok_ptr, " \n\t$,", &tok_ptr);
 
-								// Send reg_store for output
-								// rd is in position 0, rs is in position 1 and rt is in position 2
-								rtype_instruction(token, reg_store[1], reg_store[2], reg_store[0], 0, Out);
+		/* blank line or comment begins here. go to the next line */
+		if (token == NULL || *token == '#') {
+			state->line_num++;
+			break;
+		}
 
-								// Dealloc reg_store
-								for (int i = 0; i < 3; i++) {
-									free(reg_store[i]);
-								}
-								free(reg_store);
-							}
+		/*
+		 * If token is "la", increment by 8, otherwise if it exists in instructions[],
+		 * increment by 4.
+		 */
+		int x = search(token);
+		//int x = (binarySearch(instructions, 0, inst_len, token));
+		if (x >= 0) {
+			if (strcmp(token, "la") == 0)
+				state->instruction_count = state->instruction_count + 8;
+			else
+				state->instruction_count = state->instruction_count + 4;
+		}
 
-							// R-Type with $rd, $rs, shamt format
-							else if (strcmp(token, "sll") == 0 || strcmp(token, "srl") == 0) {
+		// If token is ".data", reset instruction to .data starting address
+		else if (strcmp(token, ".data") == 0) {
+			state->instruction_count = 0x00002000;
+			state->data_reached = 1;
+			state->relative = 0;
+		}
 
-								// Parse the instructio - get rd, rs, rt registers
-								char *inst_ptr = tok_ptr;
-								char *reg = NULL;
+		// If first pass, then add labels to hash table
+		if (pass == 1 || pass == SINGLE_PASS) {
 
-								// Create an array of char* that stores rd, rs and shamt
-								char **reg_store;
-								reg_store = malloc(3 * sizeof(char*));
-								if (reg_store == NULL) {
-									fprintf(Out, "Out of memory\n");
-									exit(1);
-								}
+			// if token has ':', then it is a label so add it to hash table
+			if (strstr(token, ":") && state->data_reached == 0) {
 
-								for (int i = 0; i < 3; i++) {
-									reg_store[i] = malloc(2 * sizeof(char));
-									if (reg_store[i] == NULL) {
-										fprintf(Out, "Out of memory\n");
-										exit(1);
-									}
-								}
+				// Strip out ':'
+				//printf("Label: %s at %d with address %d: \n", token, state->line_num, state->instruction_count);
+				size_t token_len = strlen(token);
+				token[token_len - 1] = '\0';
 
-								// Keeps a reference to which register has been parsed for storage
-								int count = 0;
-								while (1) {
+				// Insert variable to hash table
+				define_label(state, token, symbols);
+			}
 
-									reg = parse_token(inst_ptr, " $,\n\t", &inst_ptr, NULL);
+			// If .data has been reached, increment instruction count accordingly
+			// and store to hash table
+			else {
 
-									if (reg == NULL || *reg == '#') {
-										break;
-									}
+				char *var_tok = NULL;
+				char *var_tok_ptr = tok_ptr;
 
-									strcpy(reg_store[count], reg);
-									count++;
-									free(reg);
-								}
+				// If variable is .word
+				if (strstr(tok_ptr, ".word")) {
 
-								// Send reg_store for output
-								// rd is in position 0, rs is in position 1 and shamt is in position 2
-								rtype_instruction(token, "00000", reg_store[1], reg_store[0], atoi(reg_store[2]), Out);
+					// Variable is array
+					if (strstr(var_tok_ptr, ":")) {
 
-								// Dealloc reg_store
-								for (int i = 0; i < 3; i++) {
-									free(reg_store[i]);
-								}
-								free(reg_store);
-							}
+						// Store the number in var_tok and the occurance in var_tok_ptr
+						var_tok = next_token(&tokens, var_tok_ptr, ":", &var_tok_ptr);
 
-							else if (strcmp(token, "jr") == 0) {
+						// Convert char* to int
+						int freq = atoi(var_tok_ptr);
 
-								// Parse the instruction - rs is in tok_ptr
-								char *inst_ptr = tok_ptr;
-								char *reg = NULL;
-								reg = parse_token(inst_ptr, " $,\n\t", &inst_ptr, NULL);
+						int num;
+						sscanf(var_tok, "%*s %d", &num);
 
-								rtype_instruction(token, reg, "00000", "00000", 0, Out);
-							}
-						}
+						// Increment instruction count by freq
+						state->instruction_count = state->instruction_count + (freq * 4);
 
-						// I-Type
-						else if (inst_type == 'i') {
+						// Strip out ':' from token
+						size_t token_len = strlen(token);
+						token[token_len - 1] = '\0';
 
-							// la is pseudo instruction for lui and ori
-							// Convert to lui and ori and pass those instructions
-							if (strcmp(token, "la") == 0) {
+						//printf("Key: '%s', len: %zd\n", token, strlen(token));
 
-								// Parse the instruction - get register & immediate
-								char *inst_ptr = tok_ptr;
-								char *reg = NULL;
+						// Insert variable to hash table
+						define_label(state, token, symbols);
+					}
 
-								// Create an array of char* that stores rd, rs and shamt
-								char **reg_store;
-								reg_store = malloc(2 * sizeof(char*));
-								if (reg_store == NULL) {
-									fprintf(Out, "Out of memory\n");
-									exit(1);
-								}
+					// Variable is a single variable
+					else {
 
-								for (int i = 0; i < 2; i++) {
-									reg_store[i] = malloc(2 * sizeof(char));
-									if (reg_store[i] == NULL) {
-										fprintf(Out, "Out of memory\n");
-										exit(1);
-									}
-								}
+						state->instruction_count = state->instruction_count + 4;
 
-								// Keeps a reference to which register has been parsed for storage
-								int count = 0;
-								while (1) {
+						// Strip out ':' from token
+						size_t token_len = strlen(token);
+						token[token_len - 1] = '\0';
 
-									reg = parse_token(inst_ptr, " $,\n\t", &inst_ptr, NULL);
+						// Insert variable to hash table
+						define_label(state, token, symbols);
+					}
+				}
 
-									if (reg == NULL || *reg == '#') {
-										break;
-									}
+				// Variable is a string
+				else if (strstr(tok_ptr, ".asciiz")) {
 
-									strcpy(reg_store[count], reg);
-									count++;
-									free(reg);
-								}
+					// Store the ascii in var_tok
+					var_tok_ptr+= 8;
+					var_tok = next_token(&tokens, var_tok_ptr, "\"", &var_tok_ptr);
 
-								// Interpret la instruction.
-								// The register is at reg_store[0] and the variable is at reg_store[1]
+					// Increment instruction count by the words the string and its NUL take
+					size_t str_byte_len = var_tok ? strlen(var_tok) : 0;
+					state->instruction_count = state->instruction_count + data_size(str_byte_len + 1);
 
-								// Find address of label in hash table
-								int *address = hash_find(hash_table, reg_store[1], strlen(reg_store[1])+1);
+					// Strip out ':' from token
+					size_t token_len = strlen(token);
+					token[token_len - 1] = '\0';
 
-								// Convert address to binary in char*
-								char addressBinary[33];
-								getBin(*address, addressBinary, 32);
+					// Insert variable to hash table
+					define_label(state, token, symbols);
+				}
 
-								// Get upper and lower bits of address
-								char upperBits[16];
-								char lowerBits[16];
+				// Variable is a list of bytes or halfwords, or space
+				else if (strstr(tok_ptr, ".byte") || strstr(tok_ptr, ".half") || strstr(tok_ptr, ".space")) {
 
-								for (int i = 0; i < 32; i++) {
-									if (i < 16)
-										lowerBits[i] = addressBinary[i];
-									else
-										upperBits[i-16] = addressBinary[i];
-								}
+					unsigned char bytes[2 * MAX_LINE_LENGTH];
+					char *directive;
 
-								// Call the lui instruction with: lui $reg, upperBits
-								// Convert upperBits binary to int
-								int immediate = getDec(upperBits);
-								itype_instruction("lui", "00000", reg_store[0], immediate, Out);
+					if ((directive = strstr(tok_ptr, ".byte")) != NULL)
+						state->instruction_count += data_size(parse_data_values(directive + 5, 1, bytes, sizeof(bytes)));
+					else if ((directive = strstr(tok_ptr, ".half")) != NULL)
+						state->instruction_count += data_size(parse_data_values(directive + 5, 2, bytes, sizeof(bytes)));
+					else
+						state->instruction_count += data_size(strtoul(strstr(tok_ptr, ".space") + 6, NULL, 0));
 
-								// Call the ori instruction with: ori $reg, $reg, lowerBits
-								// Convert lowerBits binary to int
-								immediate = getDec(lowerBits);
-								itype_instruction("ori", reg_store[0], reg_store[0], immediate, Out);
+					// Strip out ':' from token
+					size_t token_len = strlen(token);
+					token[token_len - 1] = '\0';
 
-								// Dealloc reg_store
-								for (int i = 0; i < 2; i++) {
-									free(reg_store[i]);
-								}
-								free(reg_store);
-							}
+					// Insert variable to hash table
+					define_label(state, token, symbols);
+				}
+			}
+		}
 
-							// I-Type $rt, i($rs)
-							else if (strcmp(token, "lw") == 0 || strcmp(token, "sw") == 0) {
-
-								// Parse the instructio - rt, immediate and rs
-								char *inst_ptr = tok_ptr;
-								char *reg = NULL;
-								//
-								// Create an array of char* that stores rd, rs, rt respectively
-								char **reg_store;
-								reg_store = malloc(3 * sizeof(char*));
-								if (reg_store == NULL) {
-									fprintf(Out, "Out of memory\n");
-									exit(1);
-								}
+		// If second pass, then interpret
+		if (pass == 2 || pass == SINGLE_PASS) {
 
-								for (int i = 0; i < 3; i++) {
-									reg_store[i] = malloc(2 * sizeof(char));
-									if (reg_store[i] == NULL) {
-										fprintf(Out, "Out of memory\n");
-										exit(1);
-									}
-								}
+			// start interpreting here
+			// if j loop --> then instruction is: 000010 then immediate is insturction count in 26 bits??
 
-								// Keeps a reference to which register has been parsed for storage
-								int count = 0;
-								while (1) {
+			// If in .text section
+			if (state->data_reached == 0) {
 
-									reg = parse_token(inst_ptr, " $,\n\t()", &inst_ptr, NULL);
+				// Check instruction type
+				int instruction_supported = search(token);
+				char inst_type;
 
-									if (reg == NULL || *reg == '#') {
-										break;
-									}
+				// If instruction is supported
+				if (instruction_supported != -1) {
 
-									strcpy(reg_store[count], reg);
-									count++;
-									free(reg);
-								}
+					// token contains the instruction
+					// tok_ptr points to the rest of the line
 
-								// rt in position 0, immediate in position 1 and rs in position2
-								int immediate = atoi(reg_store[1]);
-								itype_instruction(token, reg_store[2], reg_store[0], immediate, Out);
+					// Determine instruction type
+					inst_type = instruction_type(token);
 
-								// Dealloc reg_store
-								for (int i = 0; i < 3; i++) {
-									free(reg_store[i]);
-								}
-								free(reg_store);
-							}
+					if (inst_type == 'r') {
+
+						// R-Type with $rd, $rs, $rt format
+						if (strcmp(token, "add") == 0 || strcmp(token, "sub") == 0
+								|| strcmp(token, "and") == 0
+								|| strcmp(token, "or") == 0 || strcmp(token, "slt") == 0) {
 
-							// I-Type rt, rs, im
-							else if (strcmp(token, "andi") == 0 || strcmp( token, "ori") == 0
-									|| strcmp(token, "slti") == 0 || strcmp(token, "addi") == 0) {
+							// Parse the instructio - get rd, rs, rt registers
+							char *inst_ptr = tok_ptr;
+							char *reg = NULL;
 
-								// Parse the instruction - rt, rs, immediate
-								char *inst_ptr = tok_ptr;
-								char *reg = NULL;
+							// Create an array of char* that stores rd, rs, rt respectively
+							char *reg_store[3] = { "00000", "00000", "00000" };
 
-								// Create an array of char* that stores rt, rs
-								char **reg_store;
-								reg_store = malloc(3 * sizeof(char*));
-								if (reg_store == NULL) {
-									fprintf(Out, "Out of memory\n");
-									exit(1);
-								}
+							// Keeps a reference to which register has been parsed for storage
+							int count = 0;
+							while (1) {
+
+								reg = next_token(&tokens, inst_ptr, " $,\n\t", &inst_ptr);
 
-								for (int i = 0; i < 3; i++) {
-									reg_store[i] = malloc(2 * sizeof(char));
-									if (reg_store[i] == NULL) {
-										fprintf(Out, "Out of memory\n");
-										exit(1);
-									}
+								if (reg == NULL || *reg == '#') {
+									break;
 								}
 
-								// Keeps a reference to which register has been parsed for storage
-								int count = 0;
-								while (1) {
+								if (count < ARRAY_SIZE(reg_store))
+									reg_store[count] = reg;
+								count++;
+							}
 
-									reg = parse_token(inst_ptr, " $,\n\t", &inst_ptr, NULL);
+							// Send reg_store for output
+							// rd is in position 0, rs is in position 1 and rt is in position 2
+							rtype_instruction(token, reg_store[1], reg_store[2], reg_store[0], 0, Out);
+						}
 
-									if (reg == NULL || *reg == '#') {
-										break;
-									}
+						// R-Type with $rd, $rs, shamt format
+						else if (strcmp(token, "sll") == 0 || strcmp(token, "srl") == 0) {
 
-									strcpy(reg_store[count], reg);
-									count++;
-									free(reg);
-								}
+							// Parse the instructio - get rd, rs, rt registers
+							char *inst_ptr = tok_ptr;
+							char *reg = NULL;
+
+							// Create an array of char* that stores rd, rs and shamt
+							char *reg_store[3] = { "00000", "00000", "00000" };
+
+							// Keeps a reference to which register has been parsed for storage
+							int count = 0;
+							while (1) {
 
-								// rt in position 0, rs in position 1 and immediate in position 2
-								int immediate = atoi(reg_store[2]);
-								itype_instruction(token, reg_store[1], reg_store[0], immediate, Out);
+								reg = next_token(&tokens, inst_ptr, " $,\n\t", &inst_ptr);
 
-								// Dealloc reg_store
-								for (int i = 0; i < 3; i++) {
-									free(reg_store[i]);
+								if (reg == NULL || *reg == '#') {
+									break;
 								}
-								free(reg_store);
+
+								if (count < ARRAY_SIZE(reg_store))
+									reg_store[count] = reg;
+								count++;
 							}
 
-							// I-Type $rt, immediate
-							else if (strcmp(token, "lui") == 0) {
+							// Send reg_store for output
+							// rd is in position 0, rs is in position 1 and shamt is in position 2
+							rtype_instruction(token, "00000", reg_store[1], reg_store[0], atoi(reg_store[2]), Out);
+						}
 
-								// Parse the insturction,  rt - immediate
-								char *inst_ptr = tok_ptr;
-								char *reg = NULL;
+						else if (strcmp(token, "jr") == 0) {
 
-								// Create an array of char* that stores rs, rt
-								char **reg_store;
-								reg_store = malloc(2 * sizeof(char*));
-								if (reg_store == NULL) {
-									fprintf(Out, "Out of memory\n");
-									exit(1);
-								}
+							// Parse the instruction - rs is in tok_ptr
+							char *inst_ptr = tok_ptr;
+							char *reg = NULL;
+							reg = next_token(&tokens, inst_ptr, " $,\n\t", &inst_ptr);
 
-								for (int i = 0; i < 2; i++) {
-									reg_store[i] = malloc(2 * sizeof(char));
-									if (reg_store[i] == NULL) {
-										fprintf(Out, "Out of memory\n");
-										exit(1);
-									}
-								}
+							rtype_instruction(token, reg, "00000", "00000", 0, Out);
+						}
+					}
 
-								// Keeps a reference to which register has been parsed for storage
-								int count = 0;
-								while (1) {
+					// I-Type
+					else if (inst_type == 'i') {
 
-									reg = parse_token(inst_ptr, " $,\n\t", &inst_ptr, NULL);
+						// la is pseudo instruction for lui and ori
+						// Convert to lui and ori and pass those instructions
+						if (strcmp(token, "la") == 0) {
 
-									if (reg == NULL || *reg == '#') {
-										break;
-									}
+							// Parse the instruction - get register & immediate
+							char *inst_ptr = tok_ptr;
+							char *reg = NULL;
 
-									strcpy(reg_store[count], reg);
-									count++;
-									free(reg);
-								}
+							// Create an array of char* that stores rd, rs and shamt
+							char *reg_store[2] = { "00000", "00000" };
 
+							// Keeps a reference to which register has been parsed for storage
+							int count = 0;
+							while (1) {
 
-								// rt in position 0, immediate in position 1
-								int immediate = atoi(reg_store[1]);
-								itype_instruction(token, "00000", reg_store[0], immediate, Out);
+								reg = next_token(&tokens, inst_ptr, " $,\n\t", &inst_ptr);
 
-								// Dealloc reg_store
-								for (int i = 0; i < 3; i++) {
-									free(reg_store[i]);
+								if (reg == NULL || *reg == '#') {
+									break;
 								}
-								free(reg_store);
+
+								if (count < ARRAY_SIZE(reg_store))
+									reg_store[count] = reg;
+								count++;
 							}
 
-							// I-Type $rs, $rt, label
-							else if (strcmp(token, "beq") == 0) {
+							// Interpret la instruction.
+							// The register is at reg_store[0] and the variable is at reg_store[1]
 
-								// Parse the instruction - rs, rt
-								char *inst_ptr = tok_ptr;
-								char *reg = NULL;
+							// Find address of label in hash table
+							uint32_t address = label_address(state, FIXUP_LA, reg_store[1], symbols, Out);
 
-								// Create an array of char* that stores rs, rt
-								char **reg_store;
-								reg_store = malloc(2 * sizeof(char*));
-								if (reg_store == NULL) {
-									fprintf(Out, "Out of memory\n");
-									exit(1);
-								}
+							// Call the lui instruction with: lui $reg, upper 16 bits
+							itype_instruction("lui", "00000", reg_store[0], address >> 16, Out);
 
-								for (int i = 0; i < 2; i++) {
-									reg_store[i] = malloc(2 * sizeof(char));
-									if (reg_store[i] == NULL) {
-										fprintf(Out, "Out of memory\n");
-										exit(1);
-									}
+							// Call the ori instruction with: ori $reg, $reg, lower 16 bits
+							itype_instruction("ori", reg_store[0], reg_store[0], address & 0xffff, Out);
+						}
+
+						// I-Type $rt, i($rs)
+						else if (strcmp(token, "lw") == 0 || strcmp(token, "sw") == 0) {
+
+							// Parse the instructio - rt, immediate and rs
+							char *inst_ptr = tok_ptr;
+							char *reg = NULL;
+							//
+							// Create an array of char* that stores rd, rs, rt respectively
+							char *reg_store[3] = { "00000", "00000", "00000" };
+
+							// Keeps a reference to which register has been parsed for storage
+							int count = 0;
+							while (1) {
+
+								reg = next_token(&tokens, inst_ptr, " $,\n\t()", &inst_ptr);
+
+								if (reg == NULL || *reg == '#') {
+									break;
 								}
 
-								// Keeps a reference to which register has been parsed for storage
-								int count = 0;
-								while (1) {
+								if (count < ARRAY_SIZE(reg_store))
+									reg_store[count] = reg;
+								count++;
+							}
+
+							// rt in position 0, immediate in position 1 and rs in position2
+							int immediate = atoi(reg_store[1]);
+							itype_instruction(token, reg_store[2], reg_store[0], immediate, Out);
+						}
+
+						// I-Type rt, rs, im
+						else if (strcmp(token, "andi") == 0 || strcmp( token, "ori") == 0
+								|| strcmp(token, "slti") == 0 || strcmp(token, "addi") == 0) {
 
-									reg = parse_token(inst_ptr, " $,\n\t", &inst_ptr, NULL);
+							// Parse the instruction - rt, rs, immediate
+							char *inst_ptr = tok_ptr;
+							char *reg = NULL;
 
-									if (reg == NULL || *reg == '#') {
-										break;
-									}
+							// Create an array of char* that stores rt, rs
+							char *reg_store[3] = { "00000", "00000", "00000" };
 
-									strcpy(reg_store[count], reg);
-									count++;
-									free(reg);
+							// Keeps a reference to which register has been parsed for storage
+							int count = 0;
+							while (1) {
 
-									if (count == 2)
-										break;
+								reg = next_token(&tokens, inst_ptr, " $,\n\t", &inst_ptr);
+
+								if (reg == NULL || *reg == '#') {
+									break;
 								}
 
-								reg = parse_token(inst_ptr, " $,\n\t", &inst_ptr, NULL);
+								if (count < ARRAY_SIZE(reg_store))
+									reg_store[count] = reg;
+								count++;
+							}
+
+							// rt in position 0, rs in position 1 and immediate in position 2
+							int immediate = atoi(reg_store[2]);
+							itype_instruction(token, reg_store[1], reg_store[0], immediate, Out);
+						}
+
+						// I-Type $rt, immediate
+						else if (strcmp(token, "lui") == 0) {
 
-								// Find hash address for a register and put in an immediate
-								int *address = hash_find(hash_table, reg, strlen(reg)+1);
-								
-								int immediate = *address + instruction_count;
+							// Parse the insturction,  rt - immediate
+							char *inst_ptr = tok_ptr;
+							char *reg = NULL;
 
-								// Send instruction to itype function
-								itype_instruction(token, reg_store[0], reg_store[1], immediate, Out);
+							// Create an array of char* that stores rs, rt
+							char *reg_store[2] = { "00000", "00000" };
 
-								// Dealloc reg_store
-								for (int i = 0; i < 2; i++) {
-									free(reg_store[i]);
+							// Keeps a reference to which register has been parsed for storage
+							int count = 0;
+							while (1) {
+
+								reg = next_token(&tokens, inst_ptr, " $,\n\t", &inst_ptr);
+
+								if (reg == NULL || *reg == '#') {
+									break;
 								}
-								free(reg_store);
+
+								if (count < ARRAY_SIZE(reg_store))
+									reg_store[count] = reg;
+								count++;
 							}
+
+
+							// rt in position 0, immediate in position 1
+							int immediate = atoi(reg_store[1]);
+							itype_instruction(token, "00000", reg_store[0], immediate, Out);
 						}
 
-						// J-Type
-						else if (inst_type == 'j') {
+						// I-Type $rs, $rt, label
+						else if (strcmp(token, "beq") == 0 || strcmp(token, "bne") == 0) {
 
-							// Parse the instruction - get label
+							// Parse the instruction - rs, rt
 							char *inst_ptr = tok_ptr;
+							char *reg = NULL;
 
-							// If comment, extract the label alone
-							char *comment = strchr(inst_ptr, '#');
-							if (comment != NULL) {							
+							// Create an array of char* that stores rs, rt
+							char *reg_store[2] = { "00000", "00000" };
 
-								int str_len_count = 0;
-								for (int i = 0; i < strlen(inst_ptr); i++) {
-									if (inst_ptr[i] != ' ')
-										str_len_count++;
-									else
-										break;
+							// Keeps a reference to which register has been parsed for storage
+							int count = 0;
+							while (1) {
+
+								reg = next_token(&tokens, inst_ptr, " $,\n\t", &inst_ptr);
+
+								if (reg == NULL || *reg == '#') {
+									break;
 								}
 
-								char new_label[str_len_count+1];
-								for (int i = 0; i < str_len_count; i++)
-									new_label[i] = inst_ptr[i];
-								new_label[str_len_count] = '\0';
+								if (count < ARRAY_SIZE(reg_store))
+									reg_store[count] = reg;
+								count++;
 
-								strcpy(inst_ptr, new_label);
+								if (count == 2)
+									break;
 							}
 
-							else { printf("NO COMMENT\n");
-								inst_ptr[strlen(inst_ptr)-1] = '\0'; 
-							}
+							reg = next_token(&tokens, inst_ptr, " $,\n\t", &inst_ptr);
 
-							// Find hash address for a label and put in an immediate
-							int *address = hash_find(hash_table, inst_ptr, strlen(inst_ptr)+1);
-							
-							// Send to jtype function
-							jtype_instruction(token, *address, Out);
+							// Find hash address for a register and put in an immediate
+							int immediate = label_address(state, FIXUP_BRANCH, reg, symbols, Out) + state->instruction_count;
+
+							// Send instruction to itype function
+							itype_instruction(token, reg_store[0], reg_store[1], immediate, Out);
 						}
 					}
 
-					if (strcmp(token, "nop") == 0) {
-						fprintf(Out, "00000000000000000000000000000000\n");
+					// J-Type
+					else if (inst_type == 'j') {
+
+						// Parse the instruction - get label, which ends at a comment too
+						char *inst_ptr = tok_ptr;
+						char *label = next_token(&tokens, inst_ptr, " $,\n\t#", &inst_ptr);
+
+						// Find hash address for a label and put in an immediate
+						uint32_t address = label_address(state, FIXUP_JUMP, label ? label : "", symbols, Out);
+
+						// Send to jtype function
+						jtype_instruction(token, address, Out);
 					}
 				}
 
-				// If .data part reached
-				else {
+				if (strcmp(token, "nop") == 0) {
+					word_rep(0, Out);
+				}
+			}
 
-					char *var_tok = NULL;
-					char *var_tok_ptr = tok_ptr;
+			// If .data part reached
+			else {
 
-					// If variable is .word
-					if (strstr(tok_ptr, ".word")) {
+				char *var_tok = NULL;
+				char *var_tok_ptr = tok_ptr;
 
-						int var_value;
+				// If variable is .word
+				if (strstr(tok_ptr, ".word")) {
 
-						// Variable is array
-						if (strstr(var_tok_ptr, ":")) {
+					int var_value = 0;
 
-							// Store the number in var_tok and the occurance in var_tok_ptr
-							var_tok = parse_token(var_tok_ptr, ":", &var_tok_ptr, NULL);
+					// Variable is array
+					if (strstr(var_tok_ptr, ":")) {
 
-							// Extract array size, or variable frequency
-							int freq = atoi(var_tok_ptr);
+						// Store the number in var_tok and the occurance in var_tok_ptr
+						var_tok = next_token(&tokens, var_tok_ptr, ":", &var_tok_ptr);
 
-							// Extract variable value
-							sscanf(var_tok, "%*s %d", &var_value);
+						// Extract array size, or variable frequency
+						int freq = atoi(var_tok_ptr);
 
-							// Value var_value is repeated freq times. Send to binary rep function
-							for (int i = 0; i < freq; i++) {
-								word_rep(var_value, Out);
-							}
-						}
+						// Extract variable value
+						sscanf(var_tok, "%*s %d", &var_value);
 
-						// Variable is a single variable
-						else {
+						// Value var_value is repeated freq times
+						if (freq > 0)
+							write_repeated(var_value, freq, Out);
+					}
 
-							// Extract variable value
-							sscanf(var_tok_ptr, "%*s, %d", &var_value);
+					// Variable is a single variable
+					else {
 
-							// Variable is in var_value. Send to binary rep function
-							word_rep(var_value, Out);
-						}
-					}
+						// Extract variable value
+						sscanf(var_tok_ptr, "%*s %d", &var_value);
 
-					// Variable is a string
-					else if (strstr(tok_ptr, ".asciiz")) {
+						// Variable is in var_value. Send to binary rep function
+						word_rep(var_value, Out);
+					}
+				}
 
-						printf("tok_ptr '%s'\n", tok_ptr);
+				// Variable is a string
+				else if (strstr(tok_ptr, ".asciiz")) {
 
-						if (strncmp(".asciiz ", var_tok_ptr, 8) == 0) {
+					if (strncmp(".asciiz ", var_tok_ptr, 8) == 0) {
 
-							// Move var_tok_ptr to beginning of string
-							var_tok_ptr = var_tok_ptr + 9;
+						// Move var_tok_ptr to beginning of string
+						var_tok_ptr = var_tok_ptr + 9;
 
-							// Strip out quotation at the end
-							// Place string in var_tok
-							var_tok = parse_token(var_tok_ptr, "\"", &var_tok_ptr, NULL);
+						// Strip out quotation at the end
+						// Place string in var_tok
+						var_tok = next_token(&tokens, var_tok_ptr, "\"", &var_tok_ptr);
 
-							ascii_rep(var_tok, Out);
-						}
+						ascii_rep(var_tok ? var_tok : "", Out);
 					}
 				}
-			}
 
-			free(token);
+				// Variable is a list of bytes or halfwords
+				else if (strstr(tok_ptr, ".byte") || strstr(tok_ptr, ".half")) {
+
+					unsigned char bytes[2 * MAX_LINE_LENGTH];
+					char *directive = strstr(tok_ptr, ".byte");
+					size_t size;
+
+					if (directive != NULL)
+						size = parse_data_values(directive + 5, 1, bytes, sizeof(bytes));
+					else
+						size = parse_data_values(strstr(tok_ptr, ".half") + 5, 2, bytes, sizeof(bytes));
+
+					write_bytes(bytes, size, Out);
+				}
+
+				// Space of 0s
+				else if (strstr(tok_ptr, ".space")) {
+
+					write_repeated(0, data_size(strtoul(strstr(tok_ptr, ".space") + 6, NULL, 0)) / 4, Out);
+				}
+			}
 		}
+
 	}
 }
 
-// Binary Search the Array
-int binarySearch(char *instructions[], int low, int high, char *string) {
+int parse_file(FILE *fptr, int pass, struct symbol_table *symbols, FILE *Out) {
 
-	int mid = low + (high - low) / 2;
-	int comp = strcmp(instructions[mid], string);\
+	char line[MAX_LINE_LENGTH + 1];
+	struct parse_state state = { .line_num = 1 };
 
-	if (comp == 0)
-		return mid;
+	while (fgets(line, MAX_LINE_LENGTH, fptr) != NULL) {
+		line[MAX_LINE_LENGTH] = 0;
+		parse_line(line, pass, &state, symbols, Out);
+	}
+	return state.nr_undefined > 0 ? -1 : 0;
+}
 
-	// Not found
-	if (high <= low)
-		return -1;
+// Overwrite the bits of @mask in the word written out at @text
+static void patch_word(char *text, uint32_t mask, uint32_t value) {
 
-	// If instructions[mid] is less than string
-	else if (comp > 0)
-		return binarySearch(instructions, low, mid - 1, string);
+	uint32_t word = 0;
 
-	// If instructions[mid] is larger than string
-	else if (comp < 0)
-		return binarySearch(instructions, mid + 1, high, string);
+	if (raw_output) {
+		for (int k = 0; k < 4; k++)
+			word = (word << 8) | (unsigned char)text[k];
+	} else {
+		for (int k = 0; k < 32; k++)
+			word = (word << 1) | (text[k] == '1');
+	}
 
-	// Return position
-	else
-		return mid;
+	word = (word & ~mask) | (value & mask);
 
-	// Error
-	return -2;
+	if (raw_output) {
+		format_word(text, word);
+	} else {
+		char line[33];
+
+		format_word(line, word);
+		memcpy(text, line, 32);
+	}
 }
 
-// Determine Instruction Type
-char instruction_type(char *instruction) {
+// Patch the fix-ups of @list into @output. Returns the number of them whose label is undefined
+static int resolve_fixups(struct fixup_list *list, struct symbol_table *symbols, char *output) {
 
-	if (strcmp(instruction, "add") == 0 || strcmp(instruction, "sub") == 0
-			|| strcmp(instruction, "and") == 0 || strcmp(instruction, "or")
-			== 0 || strcmp(instruction, "sll") == 0 || strcmp(instruction,
-			"slt") == 0 || strcmp(instruction, "srl") == 0 || strcmp(
-			instruction, "jr") == 0) {
+	int nr_undefined = 0;
 
-		return 'r';
+	for (size_t i = 0; i < list->nr_fixups; i++) {
+		struct fixup *fixup = &list->fixups[i];
+		char *text = output + fixup->offset;
+		int32_t address;
+
+		if (!symbol_find(symbols, fixup->label, &address)) {
+			fprintf(stderr, "undefined label %s\n", fixup->label);
+			nr_undefined++;
+			continue;
+		}
+
+		switch (fixup->type) {
+		case FIXUP_BRANCH:
+			patch_word(text, 0xffff, address + fixup->instruction_count);
+			break;
+		case FIXUP_JUMP:
+			patch_word(text, 0x3ffffff, address);
+			break;
+		case FIXUP_LA:
+			patch_word(text, 0xffff, (uint32_t)address >> 16);
+			patch_word(text + word_size(), 0xffff, address & 0xffff);
+			break;
+		}
 	}
+	return nr_undefined;
+}
 
-	else if (strcmp(instruction, "lw") == 0 || strcmp(instruction, "sw") == 0
-			|| strcmp(instruction, "andi") == 0 || strcmp(instruction, "ori")
-			== 0 || strcmp(instruction, "lui") == 0 || strcmp(instruction,
-			"beq") == 0 || strcmp(instruction, "slti") == 0 || strcmp(
-			instruction, "addi") == 0 || strcmp(instruction, "la") == 0) {
+/*
+ * Assemble @fptr in a single pass. Labels are defined as they come, and
+ * beq/bne/j/jal/la that refer to a label not defined yet are written with
+ * 0 in its place and recorded in a fix-up list. Once the whole source is
+ * read, the fix-ups are patched into the output, which is then written to
+ * @Out. The output is the same as that of parse_file() in pass 1 and 2.
+ *
+ * Returns 0, or -1 if a label is undefined, each reported on stderr, or
+ * memory runs out. Nothing is written to @Out then.
+ */
+int parse_file_single(FILE *fptr, struct symbol_table *symbols, FILE *Out) {
 
-		return 'i';
+	char line[MAX_LINE_LENGTH + 1];
+	struct fixup_list fixups = { 0 };
+	struct parse_state state = { .line_num = 1, .fixups = &fixups };
+	char *output;
+	size_t output_size;
+	FILE *buffer = open_memstream(&output, &output_size);
+	int ret = 0;
+
+	if (buffer == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return -1;
 	}
 
-	else if (strcmp(instruction, "j") == 0 || strcmp(instruction, "jal") == 0) {
-		return 'j';
+	while (fgets(line, MAX_LINE_LENGTH, fptr) != NULL) {
+		line[MAX_LINE_LENGTH] = 0;
+		parse_line(line, SINGLE_PASS, &state, symbols, buffer);
 	}
+	fclose(buffer);
 
-	// Failsafe return statement
-	return 0;
+	if (resolve_fixups(&fixups, symbols, output) > 0)
+		ret = -1;
+	else
+		fwrite(output, 1, output_size, Out);
+
+	free(fixups.fixups);
+	name_pool_free(&fixups.labels);
+	free(output);
+	return ret;
 }
 
-// Return the binary representation of the register
-char *register_address(char *registerName) {
+/*
+ * Parallel assembly
+ *
+ * The source is read into memory and split into chunks at line boundaries.
+ * Every phase below runs on all chunks at once:
+ *
+ *  1. count_chunk() runs the instruction counting of both passes over a
+ *     chunk as if it started at 0, and notes whether it has a .data.
+ *     The last chunk is skipped as nothing depends on where it ends.
+ *  2. label_chunk() runs pass 1 with the .data state the chunk really starts
+ *     with, collecting labels relative to the chunk.
+ *  3. encode_chunk() runs pass 2 from the real instruction count into a
+ *     buffer of its own.
+ *
+ * In between, the start of every chunk is the prefix sum of the ends of
+ * the chunks before it, and labels are merged into the hash table in
+ * source order. The buffers are written out in order, so the output is the
+ * same as that of parse_file().
+ */
+#define MIN_CHUNK_SIZE	(64 << 10)
 
-	size_t i;
-	for (i = 0; registerMap[i].name != NULL; i++) {
-		if (strcmp(registerName, registerMap[i].name) == 0) {
-			return registerMap[i].address;
-		}
+// Copy the next line of the chunk into @line the way fgets() would
+static int next_line(char *line, int size, char **cursor, char *end) {
+
+	char *p = *cursor;
+	int n = 0;
+
+	if (p >= end)
+		return 0;
+
+	while (p < end && n < size - 1) {
+		line[n++] = *p;
+		if (*p++ == '\n')
+			break;
 	}
+	line[n] = '\0';
 
-	return NULL;
+	*cursor = p;
+	return 1;
 }
 
-// Write out the R-Type instruction
-void rtype_instruction(char *instruction, char *rs, char *rt, char *rd, int shamt, FILE *Out) {
+static void parse_chunk(struct chunk *chunk, int pass, struct parse_state *state, FILE *Out) {
 
-	// Set the instruction bits
-	char *opcode = "000000";
+	char line[MAX_LINE_LENGTH + 1];
+	char *cursor = chunk->begin;
 
-	char *rdBin = "00000";
-	if (strcmp(rd, "00000") != 0)
-		rdBin = register_address(rd);
+	while (next_line(line, MAX_LINE_LENGTH, &cursor, chunk->end)) {
+		line[MAX_LINE_LENGTH] = 0;
+		parse_line(line, pass, state, chunk->symbols, Out);
+	}
+}
 
-	char *rsBin = "00000";
-	if (strcmp(rs, "00000") != 0)
-		rsBin = register_address(rs);
+static void *count_chunk(void *arg) {
 
-	char *rtBin = "00000";
-	if (strcmp(rt, "00000") != 0)
-		rtBin = register_address(rt);
+	struct chunk *chunk = arg;
+	struct parse_state state = { .line_num = 1, .relative = 1 };
 
-	char *func = NULL;
-	char shamtBin[6];
+	// Neither pass 1 nor pass 2 work is done for any other pass
+	parse_chunk(chunk, 0, &state, chunk->Out);
 
-	// Convert shamt to binary and put in shamtBin as a char*
-	getBin(shamt, shamtBin, 5);
+	chunk->nr_lines = state.line_num - 1;
+	chunk->count = state.instruction_count;
+	chunk->count_relative = state.relative;
+	chunk->has_data = state.data_reached;
+	return NULL;
+}
 
-	size_t i;
-	for (i = 0; rMap[i].name != NULL; i++) {
-		if (strcmp(instruction, rMap[i].name) == 0) {
-			func = rMap[i].function;
-		}
-	}
+static void *label_chunk(void *arg) {
 
-	// Print out the instruction to the file
-	fprintf(Out, "%s%s%s%s%s%s\n", opcode, rsBin, rtBin, rdBin, shamtBin, func);
-}
+	struct chunk *chunk = arg;
+	struct parse_state state = {
+		.line_num = chunk->first_line,
+		.data_reached = chunk->data_reached,
+		.relative = 1,
+		.chunk = chunk,
+	};
 
-// Write out the I-Type instruction
-void itype_instruction(char *instruction, char *rs, char *rt, int immediateNum, FILE *Out) {
+	parse_chunk(chunk, 1, &state, chunk->Out);
 
-	// Set the instruction bits
-	char *rsBin = "00000";
-	if (strcmp(rs, "00000") != 0)
-		rsBin = register_address(rs);
+	chunk->label_count = state.instruction_count;
+	chunk->label_count_relative = state.relative;
+	return NULL;
+}
 
-	char *rtBin = "00000";
-		if (strcmp(rt, "00000") != 0)
-			rtBin = register_address(rt);
+static void *encode_chunk(void *arg) {
 
-	char *opcode = NULL;
-	char immediate[17];
+	struct chunk *chunk = arg;
+	struct parse_state state = {
+		.line_num = chunk->first_line,
+		.instruction_count = chunk->base,
+		.data_reached = chunk->data_reached,
+	};
+	FILE *Out = open_memstream(&chunk->output, &chunk->output_size);
 
-	size_t i;
-	for (i = 0; iMap[i].name != NULL; i++) {
-		if (strcmp(instruction, iMap[i].name) == 0) {
-			opcode = iMap[i].address;
-		}
+	state.errors = open_memstream(&chunk->errors, &chunk->errors_size);
+	if (Out == NULL || state.errors == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
 	}
 
-	// Convert immediate to binary
-	getBin(immediateNum, immediate, 16);
+	parse_chunk(chunk, 2, &state, Out);
 
-	// Print out the instruction to the file
-	fprintf(Out, "%s%s%s%s\n", opcode, rsBin, rtBin, immediate);
+	fclose(Out);
+	fclose(state.errors);
+	chunk->nr_undefined = state.nr_undefined;
+	return NULL;
 }
 
-// Write out the J-Type instruction
-void jtype_instruction(char *instruction, int immediate, FILE *Out) {
+// Run @fn on every chunk, the first one on the calling thread
+static void run_chunks(struct chunk *chunks, int nr_chunks, void *(*fn)(void *)) {
+
+	if (nr_chunks <= 0)
+		return;
 
-	// Set the instruction bits
-	char *opcode = NULL;
+	pthread_t threads[nr_chunks];
 
-	// Get opcode bits
-	size_t i;
-	for (i = 0; jMap[i].name != NULL; i++) {
-		if (strcmp(instruction, jMap[i].name) == 0) {
-			opcode = jMap[i].address;
+	for (int i = 1; i < nr_chunks; i++) {
+		if (pthread_create(&threads[i], NULL, fn, &chunks[i]) != 0) {
+			fprintf(stderr, "Cannot create a thread\n");
+			exit(1);
 		}
 	}
 
-	// Convert immediate to binary
-	char immediateStr[27];
-	getBin(immediate, immediateStr, 26);
+	fn(&chunks[0]);
 
-	// Print out instruction to file
-	fprintf(Out, "%s%s\n", opcode, immediateStr);
+	for (int i = 1; i < nr_chunks; i++)
+		pthread_join(threads[i], NULL);
 }
 
-// Write out the variable in binary
-void word_rep(int binary_rep, FILE *Out) {
+static char *read_source(FILE *fptr, size_t *size) {
+
+	size_t capacity = 1 << 16;
+	size_t used = 0, nr_read;
+	char *source = malloc(capacity);
 
-	for (int k = 31; k >= 0; k--) {
-		fprintf(Out, "%c", (binary_rep & (1 << k)) ? '1' : '0');
+	while (source != NULL && (nr_read = fread(source + used, 1, capacity - used, fptr)) > 0) {
+		used += nr_read;
+		if (used == capacity) {
+			capacity *= 2;
+			source = realloc(source, capacity);
+		}
+	}
+
+	if (source == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
 	}
 
-	fprintf(Out, "\n");
+	*size = used;
+	return source;
 }
 
-// Write out the ascii string
-void ascii_rep(char string[], FILE *Out) {
+// Assemble @fptr in both passes with up to @nr_threads threads (0 for all
+// CPUs). Returns 0, or -1 if a label is undefined, as parse_file_single()
+int parse_file_parallel(FILE *fptr, int nr_threads, struct symbol_table *symbols, FILE *Out) {
+
+	size_t size;
+	char *source = read_source(fptr, &size);
+	char *end = source + size;
+	int32_t nr_undefined = 0;
 
-	// Separate the string, and put each four characters in an element of an array of strings
-	size_t str_length = strlen(string);
-	str_length++;
-	int num_strs = str_length / 4;
-	if ((str_length % 4) > 0)
-		num_strs++;
-
-	char *ptr;
-	ptr = &string[0];
-
-	// Create an array of strings which separates each 4-char string
-	char **sep_str;
-	sep_str = malloc(num_strs * sizeof(char*));
-	if (sep_str == NULL) {
-		fprintf(Out, "Out of memory\n");
+	if (size == 0) {
+		free(source);
+		return 0;
+	}
+
+	if (nr_threads <= 0)
+		nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nr_threads > size / MIN_CHUNK_SIZE)
+		nr_threads = size / MIN_CHUNK_SIZE;
+	if (nr_threads < 1)
+		nr_threads = 1;
+
+	struct chunk *chunks = calloc(nr_threads, sizeof(struct chunk));
+	if (chunks == NULL) {
+		fprintf(stderr, "Out of memory\n");
 		exit(1);
 	}
 
-	for (int i = 0; i < num_strs; i++) {
-		sep_str[i] = malloc(4 * sizeof(char));
-		if (sep_str[i] == NULL) {
-			fprintf(Out, "Out of memory\n");
-			exit(1);
-		}
+	// Split the source at the first line boundary after every 1/nr_threads
+	int nr_chunks = 0;
+	char *begin = source;
+
+	while (begin < end) {
+		char *split = begin + (end - begin) / (nr_threads - nr_chunks);
+		char *eol = memchr(split, '\n', end - split);
+
+		if (nr_chunks == nr_threads - 1 || eol == NULL)
+			split = end;
+		else
+			split = eol + 1;
+
+		chunks[nr_chunks].begin = begin;
+		chunks[nr_chunks].end = split;
+		chunks[nr_chunks].symbols = symbols;
+		chunks[nr_chunks].Out = Out;
+		nr_chunks++;
+		begin = split;
 	}
 
-	int count = 0;
-	for (int i = 0; i < str_length; i++) {
-		sep_str[i / 4][i % 4] = *ptr;
-		ptr++;
-		count++;
+	run_chunks(chunks, nr_chunks - 1, count_chunk);
+
+	chunks[0].first_line = 1;
+	for (int i = 1; i < nr_chunks; i++) {
+		struct chunk *prev = &chunks[i - 1];
+
+		chunks[i].first_line = prev->first_line + prev->nr_lines;
+		chunks[i].base = prev->count_relative ? prev->base + prev->count : prev->count;
+		chunks[i].data_reached = prev->data_reached || prev->has_data;
 	}
 
-	// Reverse each element in the array
-	char temp;
+	run_chunks(chunks, nr_chunks, label_chunk);
 
-	for (int i = 0; i < num_strs; i++) {
+	for (int i = 0; i < nr_chunks; i++) {
+		struct chunk *chunk = &chunks[i];
 
-		for (int j = 0, k = 3; j < k; j++, k--) {
+		if (i > 0) {
+			struct chunk *prev = &chunks[i - 1];
 
-			temp = sep_str[i][j];
-			sep_str[i][j] = sep_str[i][k];
-			sep_str[i][k] = temp;
+			chunk->label_base = prev->label_count_relative ?
+					prev->label_base + prev->label_count : prev->label_count;
 		}
-	}
 
-	// Convert into binary
-	for (int i = 0; i < num_strs; i++) {
+		for (size_t j = 0; j < chunk->nr_labels; j++) {
+			struct chunk_label *label = &chunk->labels[j];
 
-		for (int j = 0; j < 4; j++) {
-			char c = sep_str[i][j];
-			for (int k = 7; k >= 0; k--) {
-				fprintf(Out, "%c", (c & (1 << k)) ? '1' : '0');
-			}
+			symbol_define(symbols, label->name,
+					label->relative ? chunk->label_base + label->value : label->value);
 		}
+		free(chunk->labels);
+		name_pool_free(&chunk->label_names);
+	}
+
+	run_chunks(chunks, nr_chunks, encode_chunk);
 
-		fprintf(Out, "\n");
+	// Report the undefined labels in source order, and write nothing if any
+	for (int i = 0; i < nr_chunks; i++) {
+		fwrite(chunks[i].errors, 1, chunks[i].errors_size, stderr);
+		nr_undefined += chunks[i].nr_undefined;
+		free(chunks[i].errors);
 	}
 
-	// Deallocate sep_str
-	for (int i = 0; i < num_strs; i++) {
-		free(sep_str[i]);
+	for (int i = 0; i < nr_chunks; i++) {
+		if (nr_undefined == 0)
+			fwrite(chunks[i].output, 1, chunks[i].output_size, Out);
+		free(chunks[i].output);
 	}
-	free(sep_str);
-	sep_str = NULL;
-}
 
-void getBin(int num, char *str, int padding) {
+	free(chunks);
+	free(source);
+	return nr_undefined > 0 ? -1 : 0;
+}
 
-	*(str + padding) = '\0';
+// Instructions that parse_line() assembles, sorted for binarySearch()
+static char *instructions[] = {
+	"add", "addi", "and", "andi", "beq", "bne", "j", "jal", "jr", "la", "lui",
+	"lw", "nop", "or", "ori", "sll", "slt", "slti", "srl", "sub", "sw",
+};
 
-	long pos;
-	if (padding == 5)
-		pos = 0x10;
-	else if (padding == 16)
-		pos = 0x8000;
-	else if (padding == 26)
-		pos = 0x2000000;
-	else if (padding == 32)
-		pos = 0x80000000;
+int search(char *instruction) {
 
-	long mask = pos << 1;
-	while (mask >>= 1)
-		*str++ = !!(mask & num) + '0';
+	return binarySearch(instructions, 0, ARRAY_SIZE(instructions) - 1, instruction);
 }
 
-// Convert a binary string to a decimal value
-int getDec(char *bin) {
+// Binary Search the Array
+int binarySearch(char *instructions[], int low, int high, char *string) {
+
+	int mid = low + (high - low) / 2;
+	int comp = strcmp(instructions[mid], string);\
+
+	if (comp == 0)
+		return mid;
 
-	int  b, k, m, n;
-	int  len, sum = 0;
+	// Not found
+	if (high <= low)
+		return -1;
 
-	// Length - 1 to accomodate for null terminator
-	len = strlen(bin) - 1;
+	// If instructions[mid] is less than string
+	else if (comp > 0)
+		return binarySearch(instructions, low, mid - 1, string);
 
-	// Iterate the string
-	for(k = 0; k <= len; k++) {
+	// If instructions[mid] is larger than string
+	else if (comp < 0)
+		return binarySearch(instructions, mid + 1, high, string);
 
-		// Convert char to numeric value
-		n = (bin[k] - '0');
+	// Return position
+	else
+		return mid;
 
-		// Check the character is binary
-		if ((n > 1) || (n < 0))  {
-			return 0;
-		}
+	// Error
+	return -2;
+}
+
+// Determine Instruction Type
+char instruction_type(char *instruction) {
 
-		for(b = 1, m = len; m > k; m--)
-			b *= 2;
+	const struct isa_instruction *inst = isa_find_instruction(instruction);
 
-		// sum it up
-		sum = sum + n * b;
+	// la is expanded into lui and ori
+	if (strcmp(instruction, "la") == 0)
+		return 'i';
+
+	if (inst == NULL)
+		return 0;
+
+	switch (inst->format) {
+	case ISA_FORMAT_R:
+		return 'r';
+	case ISA_FORMAT_I:
+		return 'i';
+	case ISA_FORMAT_J:
+		return 'j';
 	}
 
-	return sum;
+	// Failsafe return statement
+	return 0;
+}
+
+// Return the number of the register. "00000" stands for an unused operand
+static unsigned int register_number(char *registerName) {
+
+	int reg = isa_register_number(registerName);
+
+	return reg < 0 ? 0 : reg;
 }
 
+// Write out the R-Type instruction
+void rtype_instruction(char *instruction, char *rs, char *rt, char *rd, int shamt, FILE *Out) {
+
+	const struct isa_instruction *inst = isa_find_instruction(instruction);
+	unsigned int values[ISA_NR_FIELDS] = { 0 };
+
+	values[ISA_FIELD_OPCODE] = inst->opcode;
+	values[ISA_FIELD_RS] = register_number(rs);
+	values[ISA_FIELD_RT] = register_number(rt);
+	values[ISA_FIELD_RD] = register_number(rd);
+	values[ISA_FIELD_SHAMT] = shamt;
+	values[ISA_FIELD_FUNCT] = inst->funct;
+
+	// Print out the instruction to the file
+	word_rep(isa_encode(ISA_FORMAT_R, values), Out);
+}
+
+// Write out the I-Type instruction
+void itype_instruction(char *instruction, char *rs, char *rt, int immediateNum, FILE *Out) {
+
+	const struct isa_instruction *inst = isa_find_instruction(instruction);
+	unsigned int values[ISA_NR_FIELDS] = { 0 };
+
+	values[ISA_FIELD_OPCODE] = inst->opcode;
+	values[ISA_FIELD_RS] = register_number(rs);
+	values[ISA_FIELD_RT] = register_number(rt);
+	values[ISA_FIELD_IMMEDIATE] = immediateNum;
+
+	// Print out the instruction to the file
+	word_rep(isa_encode(ISA_FORMAT_I, values), Out);
+}
+
+// Write out the J-Type instruction
+void jtype_instruction(char *instruction, int immediate, FILE *Out) {
+
+	const struct isa_instruction *inst = isa_find_instruction(instruction);
+	unsigned int values[ISA_NR_FIELDS] = { 0 };
+
+	values[ISA_FIELD_OPCODE] = inst->opcode;
+	values[ISA_FIELD_ADDRESS] = immediate;
+
+	// Print out instruction to file
+	word_rep(isa_encode(ISA_FORMAT_J, values), Out);
+}
+
+// Write out the variable in binary
+void word_rep(int binary_rep, FILE *Out) {
+
+	uint32_t word = binary_rep;
+
+	write_words(&word, 1, Out);
+}
+
+// Write out the ascii string and its NUL
+void ascii_rep(char string[], FILE *Out) {
+
+	write_bytes((const unsigned char *)string, strlen(string) + 1, Out);
+}
@@ -0,0 +1,41 @@
+#ifndef FILE_PARSER_H
+#define FILE_PARSER_H
+
+#include <stdio.h>
+
+#include "symbol.h"
+
+/*
+ * An assembler for MIPS sources with .text and .data sections, in the
+ * syntax of SPIM ("add $t0, $t1, $t2", "msg: .asciiz \"hi\""). Words are
+ * written as lines of 32 '0'/'1' characters, or as 4 big-endian bytes
+ * after set_raw_output(1).
+ *
+ * parse_file() is run twice over the source, first with pass 1 to define
+ * the labels and then with pass 2 to write the words. parse_file_single()
+ * and parse_file_parallel() do both passes themselves, and write the same
+ * output. All of them report undefined labels on stderr and return -1 for
+ * them, but only pass 2 of parse_file() has written its words by then.
+ */
+#define MAX_LINE_LENGTH 256
+
+void set_raw_output(int raw);
+
+int parse_file(FILE *fptr, int pass, struct symbol_table *symbols, FILE *Out);
+int parse_file_single(FILE *fptr, struct symbol_table *symbols, FILE *Out);
+int parse_file_parallel(FILE *fptr, int nr_threads, struct symbol_table *symbols, FILE *Out);
+
+// Position of @instruction among the instructions that are assembled, or -1
+int search(char *instruction);
+int binarySearch(char *instructions[], int low, int high, char *string);
+
+char instruction_type(char *instruction);
+
+void rtype_instruction(char *instruction, char *rs, char *rt, char *rd, int shamt, FILE *Out);
+void itype_instruction(char *instruction, char *rs, char *rt, int immediateNum, FILE *Out);
+void jtype_instruction(char *instruction, int immediate, FILE *Out);
+
+void word_rep(int binary_rep, FILE *Out);
+void ascii_rep(char string[], FILE *Out);
+
+#endif
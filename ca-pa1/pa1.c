@@ -19,6 +19,16 @@
 #include <ctype.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "isa.h"
+#include "image.h"
+#include "line_source.h"
+#include "symbol.h"
+#include "tokenizer.h"
 
 /* To avoid security error on Visual Studio */
 #define _CRT_SECURE_NO_WARNINGS
@@ -37,346 +47,344 @@ typedef unsigned char bool;
 /*====================================================================*/
 
 
+/***********************************************************************
+ * Labels
+ *
+ * DESCRIPTION
+ *   Instructions are placed one word apart from TEXT_START, where pa2 loads
+ *   programs, and a line may start with "label:" to name the address of
+ *   its instruction. A label operand is encoded the way the instruction
+ *   uses it:
+ *
+ *    - beq, bne: the offset from the next instruction, in words
+ *    - j, jal:   the target address
+ *    - lui:      the upper 16 bits of the address
+ *    - others:   the lower 16 bits of the address
+ *
+ *   In batch mode a label may be used before it is defined, and the word
+ *   is patched once the whole source is assembled. Interactively, only the
+ *   labels of earlier lines are known.
+ */
+#define TEXT_START	0x1000		/* Where pa2 loads programs */
+#define MAX_EXPANSION	2		/* Most words a line assembles to */
+
+enum label_uses {
+	LABEL_BRANCH = 0,
+	LABEL_TARGET,
+	LABEL_HI,
+	LABEL_LO,
+};
+
+/* The field of a word each use of a label is encoded in */
+static const unsigned int label_masks[] = {
+	[LABEL_BRANCH] = 0xffff,
+	[LABEL_TARGET] = 0x03ffffff,
+	[LABEL_HI] = 0xffff,
+	[LABEL_LO] = 0xffff,
+};
+
+/* The token that may be a label, for each operand layout. 0 if none */
+static const int label_operands[] = {
+	[ISA_OPERANDS_RT_RS_IMM] = 3,
+	[ISA_OPERANDS_RT_IMM] = 2,
+	[ISA_OPERANDS_TARGET] = 1,
+};
+
+struct fixup {
+	int use;
+	unsigned int address;	/* Of the word to patch */
+	unsigned int line;
+	const char *label;
+};
+
+static struct {
+	unsigned int address;	/* Of the next word */
+	struct symbol_table *labels;
+	bool deferred;		/* Patch unknown labels after the last line */
+	int label_use;		/* Of the last word translated, -1 if none */
+	const char *label;	/* Used by the last word translated */
+	int uses[MAX_EXPANSION];	/* Of the words of the last line assembled */
+	const char *refs[MAX_EXPANSION];	/* Labels of @uses */
+	const char *defined;	/* Label defined by the last line assembled, or NULL */
+	unsigned int line;	/* Being assembled in batch mode, 0 otherwise */
+	unsigned int nr_errors;	/* Unknown instructions, registers and labels */
+	struct fixup *fixups;
+	size_t nr_fixups;
+	size_t max_fixups;
+	struct name_pool names;
+} assembler = {
+	.address = TEXT_START,
+};
+
+static bool __is_label(const char *token)
+{
+	return (isalpha((unsigned char)token[0]) || token[0] == '_') && isa_register_number(token) < 0;
+}
+
+/* Report @token of the line being assembled as @what */
+static void __error(const char *what, const char *token)
+{
+	if (assembler.line) fprintf(stderr, "line %u: ", assembler.line);
+	fprintf(stderr, "%s %s\n", what, token);
+	assembler.nr_errors++;
+}
+
+static int __label_use(const struct isa_instruction *inst)
+{
+	if (inst->operands == ISA_OPERANDS_TARGET) return LABEL_TARGET;
+	if (inst == &isa_instructions[ISA_BEQ] || inst == &isa_instructions[ISA_BNE]) return LABEL_BRANCH;
+	if (inst == &isa_instructions[ISA_LUI]) return LABEL_HI;
+	return LABEL_LO;
+}
+
+/* OR @value of a label into the field of @word at @address */
+static unsigned int __patch(unsigned int word, int use, int32_t value, unsigned int address)
+{
+	switch (use) {
+	case LABEL_BRANCH:
+		return word | (((value - (int32_t)(address + 4)) / 4) & 0xffff);
+	case LABEL_TARGET:
+		return word | ((value & 0x0fffffff) >> 2);
+	case LABEL_HI:
+		return word | ((uint32_t)value >> 16);
+	default:
+		return word | (value & 0xffff);
+	}
+}
+
+static void __add_fixup(int use, const char *label)
+{
+	if (assembler.nr_fixups == assembler.max_fixups) {
+		size_t max_fixups = assembler.max_fixups ? assembler.max_fixups * 2 : 64;
+		struct fixup *fixups = realloc(assembler.fixups, max_fixups * sizeof(*fixups));
+
+		if (!fixups) {
+			fprintf(stderr, "Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		assembler.fixups = fixups;
+		assembler.max_fixups = max_fixups;
+	}
+
+	assembler.fixups[assembler.nr_fixups++] = (struct fixup) {
+		.use = use,
+		.address = assembler.address,
+		.line = assembler.line,
+		.label = name_pool_strdup(&assembler.names, label),
+	};
+}
+
+/* Encode @label into @word now, or once it is defined in batch mode */
+static unsigned int __refer(unsigned int word, int use, const char *label)
+{
+	int32_t value;
+
+	assembler.label_use = use;
+	assembler.label = label;
+	if (symbol_find(assembler.labels, label, &value))
+		return __patch(word, use, value, assembler.address);
+
+	if (assembler.deferred) {
+		__add_fixup(use, label);
+	} else {
+		__error("Undefined label", label);
+	}
+	return word;
+}
+
+/* Patch the words of @program that use later labels. Returns -1 if any is undefined */
+static int __resolve_fixups(unsigned int *program)
+{
+	int ret = 0;
+
+	for (size_t i = 0; i < assembler.nr_fixups; i++) {
+		struct fixup *fixup = &assembler.fixups[i];
+		unsigned int *word = &program[(fixup->address - TEXT_START) / 4];
+		int32_t value;
+
+		if (!symbol_find(assembler.labels, fixup->label, &value)) {
+			fprintf(stderr, "line %u: Undefined label %s\n", fixup->line, fixup->label);
+			ret = -1;
+			continue;
+		}
+		*word = __patch(*word, fixup->use, value, fixup->address);
+	}
+
+	free(assembler.fixups);
+	name_pool_free(&assembler.names);
+	assembler.fixups = NULL;
+	assembler.nr_fixups = assembler.max_fixups = 0;
+	return ret;
+}
+
+
+
 /***********************************************************************
  * translate()
  *
  * DESCRIPTION
- *   Translate assembly represented in @tokens[] into a MIPS instruction.
- *   This translate should support following 13 assembly commands
+ *   Translate assembly represented in @tokens[] into a MIPS instruction
+ *   at the current address. This translate should support following
+ *   assembly commands
+ *
+ *    - add, addi, sub, and, andi, or, ori, nor, slt, slti
+ *    - lw, sw, lui
+ *    - sll, srl, sra
+ *    - beq, bne, j, jal, jr
  *
- *    - add
- *    - addi
- *    - sub
- *    - and
- *    - andi
- *    - or
- *    - ori
- *    - nor
- *    - lw
- *    - sw
- *    - sll
- *    - srl
- *    - sra
+ *   The immediate of beq, bne, j, jal, lui and the other I-format
+ *   instructions may be a label. An unknown mnemonic, an operand that
+ *   should be a register but is not, and a label that is not defined
+ *   outside batch mode are reported and counted in assembler.nr_errors.
  *
  * RETURN VALUE
- *   Return a 32-bit MIPS instruction
+ *   Return a 32-bit MIPS instruction, or 0 on an error
  *
  */
 
-// Struct that stores registers and their respective binary reference
-struct {
-    const char *name;
-    char *address;
-} registerMap[] = {
-        //{ "zero", "00000" },
-        { "zr", "00000" },
-        { "at", "00001" },
-        { "v0", "00010" },
-        { "v1", "00011" },
-        { "a0", "00100" },
-        { "a1", "00101" },
-        { "a2", "00110" },
-        { "a3", "00111" },
-        { "t0", "01000" },
-        { "t1", "01001" },
-        { "t2", "01010" },
-        { "t3", "01011" },
-        { "t4", "01100" },
-        { "t5", "01101" },
-        { "t6", "01110" },
-        { "t7", "01111" },
-        { "s0", "10000" },
-        { "s1", "10001" },
-        { "s2", "10010" },
-        { "s3", "10011" },
-        { "s4", "10100" },
-        { "s5", "10101" },
-        { "s6", "10110" },
-        { "s7", "10111" },
-        { "t8", "11000" },
-        { "t9", "11001" },
-        { "k1", "11010" },
-        { "k2", "11011" },
-        { "gp", "11100" },
-        { "sp", "11101" },
-        { "fp", "11110" },
-        { "ra", "11111" },
-        { NULL, 0 }
-    
-};
-// Struct for R-Type instructions mapping for the 'function' field in the instruction
-struct {
-    const char *name;
-    char *function;
-} rMap[] = {
-        { "add", "100000" },
-        { "sub", "100010" },
-        { "and", "100100" },
-        { "or" , "100101" },
-        { "nor", "100111" },
-        { "sll", "000000" },
-        { "sra", "000011" },
-        { "srl", "000010" },
-        { "slt", "101010" },
-        { "jr" , "001000" },
-        { NULL, 0 }
+static unsigned int translate(int nr_tokens, char *tokens[])
+{
+	unsigned int word;
+	int bad = isa_translate(nr_tokens, tokens, &word);
+	const struct isa_instruction *inst;
+	int operand;
+
+	if (bad) {
+		if (bad < 0) {
+			__error("Unknown instruction", tokens[0]);
+		} else {
+			__error("Unknown register", tokens[bad]);
+		}
+		return word;
+	}
+	if (nr_tokens == 0 || !(inst = isa_find_instruction(tokens[0]))) return word;
+
+	operand = inst->operands < (int)(sizeof(label_operands) / sizeof(label_operands[0])) ?
+			label_operands[inst->operands] : 0;
+	if (!operand || operand >= nr_tokens || !__is_label(tokens[operand])) return word;
+
+	return __refer(word, __label_use(inst), tokens[operand]);
+}
+
+
+
+/***********************************************************************
+ * assemble()
+ *
+ * DESCRIPTION
+ *   Define the label at the start of @tokens[], if any, and translate the
+ *   rest into @words[]. Pseudo-instructions are expanded through
+ *   @pseudo_instructions, in which "$n" stands for the n-th operand and
+ *   hi()/lo() for a half of a numeric operand. A label operand is left to
+ *   translate(), which picks the half by the instruction. The first entry
+ *   whose condition holds is taken, so li is a single addi when the
+ *   immediate fits in 16 bits.
+ *
+ * RETURN VALUE
+ *   Return the number of words in @words[]
+ *
+ */
+enum pseudo_conditions {
+	ALWAYS = 0,
+	SHORT_IMMEDIATE,	/* The last operand is a number that fits in 16 bits */
 };
 
-// Struct for I-Type instructions
-struct {
-    const char *name;
-    char *address; //=> opcode
-} iMap[] = {
-        { "lw"  , "100011" },
-        { "sw"  , "101011" },
-        { "andi", "001100" },
-        { "ori" , "001101" },
-        { "addi", "001000" },
-        { "slti", "001010" },
-        { "beq" , "000100" },
-        { "bne" , "000101" },
-        { NULL, 0 }
+struct pseudo_instruction {
+	const char *name;
+	int condition;
+	int nr_words;
+	const char *expansion[MAX_EXPANSION][4];
 };
 
-// Struct for J-Type instructions
-struct {
-    const char *name;
-    char *opcode;
-} jMap[] = {
-        { "j"  , "000010" },
-        { "jal", "000011" },
-        { NULL, 0 }
+static const struct pseudo_instruction pseudo_instructions[] = {
+	{ "nop",  ALWAYS, 1, { { "sll", "zr", "zr", "0" } } },
+	{ "move", ALWAYS, 1, { { "add", "$1", "$2", "zr" } } },
+	{ "li",   SHORT_IMMEDIATE, 1, { { "addi", "$1", "zr", "$2" } } },
+	{ "li",   ALWAYS, 2, { { "lui", "$1", "hi($2)" }, { "ori", "$1", "$1", "lo($2)" } } },
+	{ "la",   ALWAYS, 2, { { "lui", "$1", "hi($2)" }, { "ori", "$1", "$1", "lo($2)" } } },
+	{ "blt",  ALWAYS, 2, { { "slt", "at", "$1", "$2" }, { "bne", "at", "zr", "$3" } } },
+	{ "bge",  ALWAYS, 2, { { "slt", "at", "$1", "$2" }, { "beq", "at", "zr", "$3" } } },
 };
 
-char instruction_type(char *instruction) {
-
-    if (strcmp(instruction, "add") == 0 || strcmp(instruction, "sub") == 0
-            || strcmp(instruction, "and") == 0 || strcmp(instruction, "or")
-            == 0 || strcmp(instruction, "sll") == 0 || strcmp(instruction,
-            "nor") == 0 || strcmp(instruction, "srl") == 0 || strcmp(
-            instruction, "sra") == 0|| strcmp(instruction, "slt") == 0 || strcmp(instruction, "jr") == 0 ) {
-
-        return 'r';
-    }
-
-    else if (strcmp(instruction, "lw") == 0 || strcmp(instruction, "sw") == 0
-            || strcmp(instruction, "andi") == 0 || strcmp(instruction, "ori")
-            == 0 || strcmp(instruction, "addi") == 0|| strcmp(instruction, "slti") == 0 || strcmp(instruction, "beq") == 0 || strcmp(instruction, "bne") == 0 ) {
-
-        return 'i';
-    }
-    else if(strcmp(instruction, "j") == 0 || strcmp(instruction, "jal") == 0){
-        return 'j';
-    }
-    return 0;
-}
-void getBin(int num, char *str, int padding) {
-
-    *(str + padding) = '\0';
-
-    long pos;
-    if (padding == 5)
-        pos = 0x10;
-    else if (padding == 16)
-        pos = 0x8000;
-    else if (padding == 26)
-        pos = 0x2000000;
-    else if (padding == 32)
-            pos = 0x80000000;
-    
-    long mask = pos;
-    while (mask){         // 이해 잘 안감.....
-        *str++ = !!(mask & num) + '0';
-        mask >>= 1;
-    }
-}
-
-// Return the binary representation of the register
-char *register_address(char *registerName) {
-
-    size_t i;
-    for (i = 0; registerMap[i].name != NULL; i++) {
-        if (strcmp(registerName, registerMap[i].name) == 0) {
-            return registerMap[i].address;
-        }
-    }
-    return NULL;
-}
-
-// Write out the R-Type instruction
-unsigned int rtype_instruction(char *instruction, char *rs, char *rt, char *rd, int shamt) {
-
-    long instcode;
-    unsigned int code32;
-    char* endptr;
-    // Set the instruction bits
-    char *opcode = "000000";
-    
-    char *rdBin = "00000"; // 0초기화
-    if (strcmp(rd, "00000") != 0)
-        rdBin = register_address(rd);
-
-    char *rsBin = "00000";
-    if (strcmp(rs, "00000") != 0)
-        rsBin = register_address(rs);
-
-    char *rtBin = "00000";
-    if (strcmp(rt, "00000") != 0)
-        rtBin = register_address(rt);
-
-    char *func = NULL;
-    char shamtBin[6];
-
-    // Convert shamt to binary and put in shamtBin as a char*
-    getBin(shamt, shamtBin, 5);
-
-    size_t i;
-    for (i = 0; rMap[i].name != NULL; i++) {
-        if (strcmp(instruction, rMap[i].name) == 0) {
-            func = rMap[i].function;
-        }
-    }
-
-    // Print out the instruction to the file
-    //printf("%s%s%s%s%s%s\n", opcode, rsBin, rtBin, rdBin, shamtBin, func);
-    
-    instcode = strtoimax(opcode, &endptr, 2);
-    code32 = (instcode & 0x3f) << 26;
-    instcode = strtoimax(rsBin, &endptr, 2);
-    code32 |= (instcode & 0x1f) << 21;
-    instcode = strtoimax(rtBin, &endptr, 2);
-    code32 |= (instcode & 0x1f) << 16;
-    instcode = strtoimax(rdBin, &endptr, 2);
-    code32 |= (instcode & 0x1f) << 11;
-    instcode = strtoimax(shamtBin, &endptr, 2);
-    code32 |= (instcode & 0x1f) << 6;
-    instcode = strtoimax(func, &endptr, 2);
-    code32 |= (instcode & 0x3f);
-
-    return code32;
-}
-
-// Write out the I-Type instruction
-unsigned int itype_instruction(char *instruction, char *rs, char *rt, int immediateNum) {
-
-    long instcode;
-    unsigned int code32;
-    char* endptr;
-    // Set the instruction bits
-    char *rsBin = "00000";
-    if (strcmp(rs, "00000") != 0)
-        rsBin = register_address(rs);
-
-    char *rtBin = "00000";
-        if (strcmp(rt, "00000") != 0)
-            rtBin = register_address(rt);
-
-    char *opcode = NULL;
-    char immediate[17];
-
-    size_t i;
-    for (i = 0; iMap[i].name != NULL; i++) {
-        if (strcmp(instruction, iMap[i].name) == 0) {
-            opcode = iMap[i].address;
-        }
-    }
-
-    // Convert immediate to binary
-    getBin(immediateNum, immediate, 16);
-
-    // Print out the instruction to the file
-    //printf("%s%s%s%s\n", opcode, rsBin, rtBin, immediate);
-    instcode = strtoimax(opcode, &endptr, 2);
-    code32 = (instcode & 0x3f) << 26;
-    instcode = strtoimax(rsBin, &endptr, 2);
-    code32 |= (instcode & 0x1f) << 21;
-    instcode = strtoimax(rtBin, &endptr, 2);
-    code32 |= (instcode & 0x1f) << 16;
-    instcode = strtoimax(immediate, &endptr, 2);
-    code32 |= (instcode & 0xffff);
-    
-    return code32;
-}
-
-unsigned int jtype_instruction(char *instruction, int address) {
-
-    long instcode;
-    char *opcode = NULL;
-    char* endptr;
-    unsigned int code32;
-
-    size_t i;
-    for (i = 0; jMap[i].name != NULL; i++) {
-        if (strcmp(instruction, jMap[i].name) == 0) {
-            opcode = jMap[i].opcode;
-        }
-    }
-    char addressBin[33];
-    getBin(address, addressBin, 32); // 32bit 주소를 바이너리 스트링으로 바꿈
-    
-    instcode = strtoimax(opcode, &endptr, 2);
-    code32 = (instcode & 0x3f) << 26; // opcode 만듬
-
-    instcode = strtoimax(addressBin, &endptr, 2);
-    instcode = instcode & 0x0fffffff; // 0x2048같이 입력된 타겟주소에서 맨앞 4비트 pc값을 뗌
-    instcode = instcode>>2;             // 글고 2비트 쉬프트=> 000000,address(26bit)이렇게 됨
-    code32 |= instcode;                 // opcode랑 address 합침
-    return code32;
+static const struct pseudo_instruction *__find_pseudo(int nr_tokens, char *tokens[])
+{
+	const char *last = tokens[nr_tokens - 1];
+
+	for (size_t i = 0; i < sizeof(pseudo_instructions) / sizeof(pseudo_instructions[0]); i++) {
+		const struct pseudo_instruction *pseudo = &pseudo_instructions[i];
+
+		if (strcmp(pseudo->name, tokens[0]) != 0) continue;
+
+		if (pseudo->condition == SHORT_IMMEDIATE) {
+			int value = (int)isa_immediate(last);
+			if (nr_tokens < 2 || __is_label(last) || value < -32768 || value > 32767) continue;
+		}
+		return pseudo;
+	}
+	return NULL;
 }
 
-static unsigned int translate(int nr_tokens, char *tokens[])
+/* The token for @pattern of an expansion. Numbers are formatted into @buffer */
+static char *__substitute(const char *pattern, int nr_tokens, char *tokens[], char buffer[16])
+{
+	const char *p = pattern;
+	char part = 0;
+	char *operand;
+	unsigned int value;
+
+	if (strncmp(p, "hi(", 3) == 0 || strncmp(p, "lo(", 3) == 0) {
+		part = p[0];
+		p += 3;
+	}
+	if (p[0] != '$') return (char *)pattern;
+
+	operand = p[1] - '0' < nr_tokens ? tokens[p[1] - '0'] : "";
+	if (!part || __is_label(operand)) return operand;
+
+	value = isa_immediate(operand);
+	sprintf(buffer, "%u", part == 'h' ? value >> 16 : value & 0xffff);
+	return buffer;
+}
+
+static int assemble(int nr_tokens, char *tokens[], unsigned int words[MAX_EXPANSION])
 {
-	/* TODO:
-	 * This is an example MIPS instruction. You should change it accordingly.
-	 */
-    unsigned int code32 =0;
-    char inst_type;
-    char* token = tokens[0];
-    char* endptr;
-    inst_type = instruction_type(token);
-    
-    if(inst_type == 'r')
-    {
-        // R-Type with $rd, $rs, $rt format
-        if (strcmp(token, "add") == 0 || strcmp(token, "sub") == 0|| strcmp(token, "and") == 0|| strcmp(token, "or") == 0 || strcmp(token, "nor") == 0 || strcmp(token, "slt") == 0){
-          code32 = rtype_instruction(tokens[0], tokens[2], tokens[3], tokens[1], 0);
-        }
-        // R-Type with $rd, $rt, shamt format
-        else if (strcmp(token, "sll") == 0 || strcmp(token, "srl") == 0|| strcmp(token, "sra") == 0){
-            //shamt가 16진수로 들어올 경우를 처리
-            if(strncmp(tokens[3], "0x", 2) == 0 || strncmp(tokens[3], "-0x", 3) == 0){
-                code32 = rtype_instruction(tokens[0], "00000", tokens[2], tokens[1], (int)(strtoimax(tokens[3], &endptr, 0)));
-            }                                     // rs가 없음 -> 0
-            else{ //shamt가 정수일 경우
-                code32 = rtype_instruction(tokens[0], "00000", tokens[2], tokens[1], atoi(tokens[3]));
-            }
-        }
-        else // jr
-        {
-            code32 = rtype_instruction(tokens[0], tokens[1], "00000", "00000", 0);
-
-        }
-    }
-    else if (inst_type == 'i')
-    {
-        //address가 16진수로 들어올 경우를 처리
-        if(strncmp(tokens[3], "0x", 2) == 0 || strncmp(tokens[3], "-0x", 3) == 0){
-            code32 = itype_instruction(tokens[0], tokens[2], tokens[1], (int)(strtoimax(tokens[3], &endptr, 0)));
-        }
-        else{        //address가 정수로 들어올 경우를 처리
-            code32 = itype_instruction(tokens[0], tokens[2], tokens[1], atoi(tokens[3]));
-        }
-    }
-    else if (inst_type == 'j')
-    {
-        code32 = jtype_instruction(tokens[0], (int)(strtoimax(tokens[1], &endptr, 0)));
-    }
-    else if (!strcmp(token, "halt"))
-    {
-        // code32 = 0xffffffff
-        return 0xffffffff;
-    }
-    return code32;
+	const struct pseudo_instruction *pseudo = NULL;
+	size_t len = nr_tokens ? strlen(tokens[0]) : 0;
+
+	if (len > 1 && tokens[0][len - 1] == ':') {
+		tokens[0][len - 1] = '\0';
+		symbol_define(assembler.labels, tokens[0], assembler.address);
+		assembler.defined = tokens[0];
+		if (--nr_tokens == 0) return 0;
+		tokens++;
+	}
+
+	if (nr_tokens && !isa_find_instruction(tokens[0])) pseudo = __find_pseudo(nr_tokens, tokens);
+
+	if (!pseudo) {
+		assembler.label_use = -1;
+		words[0] = translate(nr_tokens, tokens);
+		assembler.uses[0] = assembler.label_use;
+		assembler.refs[0] = assembler.label;
+		assembler.address += 4;
+		return 1;
+	}
+
+	for (int i = 0; i < pseudo->nr_words; i++) {
+		char buffers[4][16];
+		char *expanded[4];
+		int nr_expanded = 0;
+
+		for (int j = 0; j < 4 && pseudo->expansion[i][j]; j++) {
+			expanded[nr_expanded++] = __substitute(pseudo->expansion[i][j], nr_tokens, tokens, buffers[j]);
+		}
+		assembler.label_use = -1;
+		words[i] = translate(nr_expanded, expanded);
+		assembler.uses[i] = assembler.label_use;
+		assembler.refs[i] = assembler.label;
+		assembler.address += 4;
+	}
+	return pseudo->nr_words;
 }
 
 
@@ -404,37 +412,760 @@ static unsigned int translate(int nr_tokens, char *tokens[])
  *   Return 0 after filling in @nr_tokens and @tokens[] properly
  *
  */
-static bool __is_separator(char *c)
+static const struct tokenizer assembly_tokenizer =
+	TOKENIZER(" \t\r\n,.", TOKENIZER_HASH_COMMENTS | TOKENIZER_FOLD_CASE);
+
+static int parse_command(char *assembly, int *nr_tokens, char *tokens[])
+{
+	*nr_tokens = tokenize(&assembly_tokenizer, assembly, tokens, MAX_NR_TOKENS);
+
+	return 0;
+}
+
+
+
+/***********************************************************************
+ * Batch mode
+ *
+ * DESCRIPTION
+ *   With -f, -o or -c, the whole source is read into memory and assembled in
+ *   one pass. Each line is folded to lowercase and stripped of its # comment
+ *   in a single scan, and the machine code is written out in one of
+ *   @output_format_names through a large buffer:
+ *
+ *    - hex:   "0x%08x" per line, which pa2 can load
+ *    - bin:   raw big-endian words
+ *    - image: the container described in image.h
+ *
+ *   Lines without any token do not produce an instruction, and labels
+ *   may be used before they are defined. Errors are reported with their
+ *   line number, and nothing is written out when a label is left undefined
+ *   or a line has an unknown instruction or register.
+ */
+enum output_formats {
+	OUTPUT_HEX = 0,
+	OUTPUT_BINARY,
+	OUTPUT_IMAGE,
+	NR_OUTPUT_FORMATS,
+};
+
+static const char * const output_format_names[NR_OUTPUT_FORMATS] = {
+	"hex", "bin", "image",
+};
+
+#define OUTPUT_BUFFER	(1 << 20)	/* Size of each write to the output */
+
+struct output {
+	FILE *file;
+	unsigned char *buffer;
+	size_t used;
+};
+
+static void __flush_output(struct output *out)
+{
+	fwrite(out->buffer, 1, out->used, out->file);
+	out->used = 0;
+}
+
+/* Returns room for @size bytes in the output buffer */
+static unsigned char *__reserve_output(struct output *out, size_t size)
+{
+	if (out->used + size > OUTPUT_BUFFER) __flush_output(out);
+
+	out->used += size;
+	return out->buffer + out->used - size;
+}
+
+/***********************************************************************
+ * Assembly cache
+ *
+ * DESCRIPTION
+ *   With -c, batch mode keeps what it assembled in a cache file and
+ *   assembles again only the parts of the source that changed. The source
+ *   is cut into blocks of lines by its content: a block ends with the line
+ *   in which a rolling hash of the last bytes has CACHE_BLOCK_MASK clear,
+ *   once it is CACHE_MIN_BLOCK long. An edit thus changes the block it is
+ *   in, and the blocks after it are cut where they were before.
+ *
+ *   A block is kept with its text, its words, the labels it defines and
+ *   the words that use a label, and is looked up by the hash of its text.
+ *   It is taken from the cache only if its text is the same as that in the
+ *   source, its data match their checksum and every field is in range.
+ *   Anything else is a miss. The label fields of reused words are encoded
+ *   again from the current labels, so a block follows its labels, and
+ *   itself, when they move.
+ *
+ *   A run appends the blocks it assembled to the file, then a table of
+ *   the blocks of this source, and then points the header to the table.
+ *   Once the file has grown to twice what the table refers to, it is
+ *   rewritten with those blocks only. Nothing is written when the run
+ *   fails.
+ */
+#define CACHE_MAGIC	0x7f434143u	/* "\177CAC" */
+#define CACHE_VERSION	3
+#define CACHE_MIN_BLOCK	(4 << 10)
+#define CACHE_MAX_BLOCK	(64 << 10)	/* A longer block ends with the line it is in */
+#define CACHE_BLOCK_MASK	(((1ull << 13) - 1) << 51)
+#define CACHE_SLACK	(1 << 20)	/* Bytes a file may grow by before it is rewritten */
+
+struct cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t table;		/* Offset of the block table */
+	uint64_t nr_blocks;
+};
+
+/* A block in the table. Its data are its words, labels, uses, names and text */
+struct cache_block {
+	uint64_t hash;		/* Of the text */
+	uint64_t check;		/* Of the data before the text */
+	uint64_t data;		/* Offset of the data in the file */
+	uint32_t size;		/* Of the text */
+	uint32_t nr_lines;
+	uint32_t nr_words;
+	uint32_t nr_labels;
+	uint32_t nr_uses;
+	uint32_t names_size;
+};
+
+/* A label defined at a word of a block */
+struct cache_label {
+	uint32_t name;		/* Offset in the names of the block */
+	uint32_t word;
+};
+
+/* A word of a block that uses a label */
+struct cache_use {
+	uint32_t name;
+	uint32_t word;
+	uint32_t line;		/* In the block, for errors */
+	uint32_t use;		/* enum label_uses */
+};
+
+/* A block assembled in this run */
+struct cache_fresh {
+	struct cache_block block;
+	size_t first_word;	/* In the program */
+	char *text;		/* As it was before it was assembled in place */
+	struct cache_label *labels;
+	struct cache_use *uses;
+	char *names;
+	size_t max_labels;
+	size_t max_uses;
+	size_t max_names;
+};
+
+struct cache {
+	char *path;
+	int fd;			/* Of the file, or -1 if it is to be created */
+	unsigned char *old;	/* The file mapped, or NULL */
+	size_t old_size;
+	const struct cache_block *blocks;	/* The table of the file */
+	size_t nr_blocks;
+	uint32_t *index;	/* Of @blocks by hash. Index + 1, or 0 for an empty slot */
+	size_t index_mask;
+	unsigned char *used;	/* The blocks of the table this source has */
+	size_t nr_used;
+	struct cache_fresh *fresh;
+	size_t nr_fresh;
+	size_t max_fresh;
+};
+
+struct program {
+	unsigned int *words;
+	size_t nr_words;
+	size_t capacity;
+};
+
+static void *__grow(void *array, size_t *capacity, size_t needed, size_t size)
 {
-	char *separators = " \t\r\n,.";
+	size_t grown = *capacity ? *capacity : 64;
 
-	for (size_t i = 0; i < strlen(separators); i++) {
-		if (*c == separators[i]) return true;	
+	if (needed <= *capacity) return array;
+
+	while (grown < needed) grown *= 2;
+	array = realloc(array, grown * size);
+	if (!array) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
 	}
+	*capacity = grown;
+	return array;
+}
 
-	return false;
+static uint64_t __cache_hash(const void *data, size_t size)
+{
+	const unsigned char *p = data;
+	uint64_t hash = size * 0x9e3779b97f4a7c15ull, v = 0;
+
+	for (; size >= 8; p += 8, size -= 8) {
+		memcpy(&v, p, 8);
+		hash = (hash ^ v) * 0xff51afd7ed558ccdull;
+		hash ^= hash >> 32;
+	}
+	v = 0;
+	memcpy(&v, p, size);
+	hash = (hash ^ v) * 0xc4ceb9fe1a85ec53ull;
+	return hash ^ (hash >> 29);
 }
-static int parse_command(char *assembly, int *nr_tokens, char *tokens[])
+
+/* Where the block that starts at @begin ends, right after a '\n' or at @end */
+static char *__cache_block_end(char *begin, char *end)
 {
-	char *curr = assembly;
-	int token_started = false;
-	*nr_tokens = 0;
+	static uint64_t gear[256];
+	char *p = begin + CACHE_MIN_BLOCK, *eol;
+	uint64_t hash = 0;
+
+	if (!gear[0]) {
+		uint64_t seed = 0;
+
+		for (int i = 0; i < 256; i++) {
+			uint64_t z = (seed += 0x9e3779b97f4a7c15ull);
+
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+			gear[i] = z ^ (z >> 31);
+		}
+	}
+
+	if (end - begin <= CACHE_MIN_BLOCK) return end;
 
-	while (*curr != '\0') {  
-		if (__is_separator(curr)) {  
-			*curr = '\0';
-			token_started = false;
+	for (; p < end && p - begin < CACHE_MAX_BLOCK; p++) {
+		hash = (hash << 1) + gear[(unsigned char)*p];
+		if (!(hash & CACHE_BLOCK_MASK)) break;
+	}
+	eol = p < end ? memchr(p, '\n', end - p) : NULL;
+	return eol ? eol + 1 : end;
+}
+
+static size_t __cache_align(size_t size)
+{
+	return (size + 7) & ~(size_t)7;
+}
+
+/* Bytes of the data of @block before its text */
+static uint64_t __cache_head_size(const struct cache_block *block)
+{
+	return (uint64_t)block->nr_words * 4 + (uint64_t)block->nr_labels * sizeof(struct cache_label) +
+			(uint64_t)block->nr_uses * sizeof(struct cache_use) + block->names_size;
+}
+
+/* Open the cache at @path. A file that is missing or is not a cache is replaced when closed */
+static struct cache *__cache_open(const char *path)
+{
+	struct cache *cache = calloc(1, sizeof(*cache));
+	const struct cache_header *header;
+	struct stat st;
+	size_t nr_slots = 64;
+
+	if (!cache || !(cache->path = strdup(path))) {
+		free(cache);
+		return NULL;
+	}
+
+	cache->fd = open(path, O_RDWR);
+	if (cache->fd < 0) return cache;
+
+	if (fstat(cache->fd, &st) || st.st_size < (off_t)sizeof(*header) ||
+			(cache->old = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, cache->fd, 0)) == MAP_FAILED) {
+		cache->old = NULL;
+		goto invalid;
+	}
+	cache->old_size = st.st_size;
+
+	header = (const struct cache_header *)cache->old;
+	if (header->magic != CACHE_MAGIC || header->version != CACHE_VERSION ||
+			header->table % 8 || header->table < sizeof(*header) || header->table > cache->old_size ||
+			header->nr_blocks > (cache->old_size - header->table) / sizeof(struct cache_block)) {
+		goto invalid;
+	}
+	cache->blocks = (const struct cache_block *)(cache->old + header->table);
+	cache->nr_blocks = header->nr_blocks;
+
+	while (nr_slots < cache->nr_blocks * 2) nr_slots *= 2;
+	cache->index = calloc(nr_slots, sizeof(*cache->index));
+	cache->used = calloc(cache->nr_blocks + 1, 1);
+	if (!cache->index || !cache->used) goto invalid;
+	cache->index_mask = nr_slots - 1;
+
+	for (size_t i = 0; i < cache->nr_blocks; i++) {
+		size_t slot = cache->blocks[i].hash & cache->index_mask;
+
+		while (cache->index[slot]) slot = (slot + 1) & cache->index_mask;
+		cache->index[slot] = i + 1;
+	}
+	return cache;
+
+invalid:
+	if (cache->old) munmap(cache->old, cache->old_size);
+	free(cache->index);
+	free(cache->used);
+	close(cache->fd);
+	cache->fd = -1;
+	cache->old = NULL;
+	cache->blocks = NULL;
+	cache->nr_blocks = 0;
+	cache->index = NULL;
+	cache->used = NULL;
+	return cache;
+}
+
+/* Whether @names holds a name at @offset */
+static bool __cache_name_valid(const char *names, uint32_t size, uint32_t offset)
+{
+	return offset < size && memchr(names + offset, '\0', size - offset);
+}
+
+/* Whether @block can be taken for the @size bytes of @text */
+static bool __cache_valid(const struct cache *cache, const struct cache_block *block, const char *text, size_t size)
+{
+	uint64_t head = __cache_head_size(block);
+	const unsigned char *data;
+	const struct cache_label *labels;
+	const struct cache_use *uses;
+	const char *names;
+
+	if (block->size != size || block->nr_lines == 0 || block->nr_lines > size ||
+			block->nr_words > (uint64_t)block->nr_lines * MAX_EXPANSION) {
+		return false;
+	}
+	if (block->data % 8 || block->data < sizeof(struct cache_header) || block->data > cache->old_size ||
+			head + size > cache->old_size - block->data) {
+		return false;
+	}
+
+	data = cache->old + block->data;
+	if (memcmp(data + head, text, size) || __cache_hash(data, head) != block->check) return false;
+
+	labels = (const struct cache_label *)(data + block->nr_words * 4);
+	uses = (const struct cache_use *)(labels + block->nr_labels);
+	names = (const char *)(uses + block->nr_uses);
+
+	for (uint32_t i = 0; i < block->nr_labels; i++) {
+		if (labels[i].word > block->nr_words || (i && labels[i].word < labels[i - 1].word) ||
+				!__cache_name_valid(names, block->names_size, labels[i].name)) {
+			return false;
+		}
+	}
+	for (uint32_t i = 0; i < block->nr_uses; i++) {
+		if (uses[i].word >= block->nr_words || (i && uses[i].word < uses[i - 1].word) ||
+				uses[i].use > LABEL_LO || uses[i].line >= block->nr_lines ||
+				!__cache_name_valid(names, block->names_size, uses[i].name)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* The block of the table for the @size bytes of @text, whose hash is @hash, or NULL */
+static const struct cache_block *__cache_lookup(struct cache *cache, uint64_t hash, const char *text, size_t size)
+{
+	if (!cache->index) return NULL;
+
+	for (size_t slot = hash & cache->index_mask; cache->index[slot]; slot = (slot + 1) & cache->index_mask) {
+		size_t i = cache->index[slot] - 1;
+
+		if (cache->blocks[i].hash != hash || !__cache_valid(cache, &cache->blocks[i], text, size)) continue;
+
+		if (!cache->used[i]) cache->nr_used++;
+		cache->used[i] = 1;
+		return &cache->blocks[i];
+	}
+	return NULL;
+}
+
+static void __grow_program(struct program *program, size_t nr_words)
+{
+	program->words = __grow(program->words, &program->capacity, program->nr_words + nr_words,
+			sizeof(*program->words));
+}
+
+/* Assemble the words of @block, which has the text of the source from here */
+static void __cache_replay(const struct cache *cache, const struct cache_block *block, struct program *program)
+{
+	const unsigned char *data = cache->old + block->data;
+	const struct cache_label *labels = (const struct cache_label *)(data + block->nr_words * 4);
+	const struct cache_use *uses = (const struct cache_use *)(labels + block->nr_labels);
+	const char *names = (const char *)(uses + block->nr_uses);
+	unsigned int start = assembler.address, first_line = assembler.line;
+	unsigned int *words;
+	uint32_t i = 0;
+
+	__grow_program(program, block->nr_words);
+	words = program->words + program->nr_words;
+	memcpy(words, data, block->nr_words * 4);
+
+	/* In the order of the source, so that a label is defined before the words after it */
+	for (uint32_t j = 0; j < block->nr_uses; j++) {
+		const struct cache_use *use = &uses[j];
+
+		for (; i < block->nr_labels && labels[i].word <= use->word; i++) {
+			symbol_define(assembler.labels, names + labels[i].name, start + labels[i].word * 4);
+		}
+		assembler.address = start + use->word * 4;
+		assembler.line = first_line + use->line + 1;
+		words[use->word] = __refer(words[use->word] & ~label_masks[use->use], use->use, names + use->name);
+	}
+	for (; i < block->nr_labels; i++) {
+		symbol_define(assembler.labels, names + labels[i].name, start + labels[i].word * 4);
+	}
+
+	assembler.address = start + block->nr_words * 4;
+	assembler.line = first_line + block->nr_lines;
+	program->nr_words += block->nr_words;
+}
+
+/* Start a block of the @size bytes of @text to be assembled afresh at word @first_word */
+static struct cache_fresh *__cache_fresh(struct cache *cache, uint64_t hash, const char *text, size_t size,
+		size_t first_word)
+{
+	struct cache_fresh *fresh;
+
+	cache->fresh = __grow(cache->fresh, &cache->max_fresh, cache->nr_fresh + 1, sizeof(*cache->fresh));
+	fresh = memset(&cache->fresh[cache->nr_fresh++], 0, sizeof(*fresh));
+
+	fresh->block.hash = hash;
+	fresh->block.size = size;
+	fresh->first_word = first_word;
+	fresh->text = malloc(size ? size : 1);
+	if (!fresh->text) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(fresh->text, text, size);
+	return fresh;
+}
+
+static uint32_t __cache_name(struct cache_fresh *fresh, const char *name)
+{
+	size_t len = strlen(name) + 1;
+	uint32_t offset = fresh->block.names_size;
+
+	fresh->names = __grow(fresh->names, &fresh->max_names, offset + len, 1);
+	memcpy(fresh->names + offset, name, len);
+	fresh->block.names_size += len;
+	return offset;
+}
+
+/* Note the label that line @line defined and the labels used by its @nr_words words from @word */
+static void __cache_record(struct cache_fresh *fresh, uint32_t line, uint32_t word, int nr_words)
+{
+	if (assembler.defined) {
+		fresh->labels = __grow(fresh->labels, &fresh->max_labels, fresh->block.nr_labels + 1,
+				sizeof(*fresh->labels));
+		fresh->labels[fresh->block.nr_labels++] = (struct cache_label) {
+			.name = __cache_name(fresh, assembler.defined),
+			.word = word,
+		};
+	}
+
+	for (int i = 0; i < nr_words; i++) {
+		if (assembler.uses[i] < 0) continue;
+
+		fresh->uses = __grow(fresh->uses, &fresh->max_uses, fresh->block.nr_uses + 1, sizeof(*fresh->uses));
+		fresh->uses[fresh->block.nr_uses++] = (struct cache_use) {
+			.name = __cache_name(fresh, assembler.refs[i]),
+			.word = word + i,
+			.line = line,
+			.use = assembler.uses[i],
+		};
+	}
+}
+
+static int __cache_write(int fd, uint64_t *offset, const void *data, size_t size)
+{
+	while (size) {
+		ssize_t written = pwrite(fd, data, size, *offset);
+
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		data = (const char *)data + written;
+		size -= written;
+		*offset += written;
+	}
+	return 0;
+}
+
+/* Pad the file with zeros up to the next 8-byte boundary */
+static int __cache_pad(int fd, uint64_t *offset)
+{
+	static const unsigned char zeros[8];
+
+	return __cache_write(fd, offset, zeros, __cache_align(*offset) - *offset);
+}
+
+/* Write the data of @fresh, whose words are in @program, at @offset */
+static int __cache_write_fresh(int fd, uint64_t *offset, struct cache_fresh *fresh, const unsigned int *program)
+{
+	struct cache_block *block = &fresh->block;
+	size_t head = __cache_head_size(block);
+	unsigned char *data = malloc(head ? head : 1), *p = data;
+	int ret;
+
+	if (!data) return -1;
+
+	p = memcpy(p, program + fresh->first_word, block->nr_words * 4) + block->nr_words * 4;
+	p = memcpy(p, fresh->labels, block->nr_labels * sizeof(*fresh->labels)) + block->nr_labels * sizeof(*fresh->labels);
+	p = memcpy(p, fresh->uses, block->nr_uses * sizeof(*fresh->uses)) + block->nr_uses * sizeof(*fresh->uses);
+	memcpy(p, fresh->names, block->names_size);
+	block->check = __cache_hash(data, head);
+
+	ret = __cache_pad(fd, offset);
+	block->data = *offset;
+	if (!ret) ret = __cache_write(fd, offset, data, head);
+	if (!ret) ret = __cache_write(fd, offset, fresh->text, block->size);
+
+	free(data);
+	return ret;
+}
+
+/*
+ * Save the blocks of this source, whose words are in @program, into the
+ * file. The file is appended to, or rewritten when it has grown too much
+ */
+static int __cache_save(struct cache *cache, const unsigned int *program)
+{
+	struct cache_header header = { .magic = CACHE_MAGIC, .version = CACHE_VERSION };
+	size_t nr_blocks = cache->nr_used + cache->nr_fresh, n = 0;
+	struct cache_block *table = malloc((nr_blocks ? nr_blocks : 1) * sizeof(*table));
+	uint64_t table_size = nr_blocks * sizeof(*table) + 8, live = sizeof(header) + table_size, grown = table_size;
+	uint64_t offset;
+	char tmp[FILENAME_MAX];
+	bool rewrite;
+	int fd, ret = -1;
+
+	if (!table) return -1;
+
+	/* What the table refers to, and what appending would add to the file */
+	for (size_t i = 0; i < cache->nr_blocks; i++) {
+		if (cache->used[i]) live += __cache_head_size(&cache->blocks[i]) + cache->blocks[i].size + 8;
+	}
+	for (size_t i = 0; i < cache->nr_fresh; i++) {
+		uint64_t size = __cache_head_size(&cache->fresh[i].block) + cache->fresh[i].block.size + 8;
+
+		live += size;
+		grown += size;
+	}
+
+	rewrite = cache->fd < 0 || cache->old_size + grown > 2 * live + CACHE_SLACK;
+	if (rewrite) {
+		snprintf(tmp, sizeof(tmp), "%s.tmp", cache->path);
+		fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) goto out;
+		offset = sizeof(header);
+	} else {
+		fd = cache->fd;
+		offset = cache->old_size;
+	}
+
+	for (size_t i = 0; i < cache->nr_blocks; i++) {
+		if (!cache->used[i]) continue;
+
+		table[n] = cache->blocks[i];
+		if (rewrite) {
+			if (__cache_pad(fd, &offset)) goto out;
+			table[n].data = offset;
+			if (__cache_write(fd, &offset, cache->old + cache->blocks[i].data,
+						__cache_head_size(&cache->blocks[i]) + cache->blocks[i].size)) {
+				goto out;
+			}
+		}
+		n++;
+	}
+	for (size_t i = 0; i < cache->nr_fresh; i++) {
+		if (__cache_write_fresh(fd, &offset, &cache->fresh[i], program)) goto out;
+		table[n++] = cache->fresh[i].block;
+	}
+
+	if (__cache_pad(fd, &offset)) goto out;
+	header.table = offset;
+	header.nr_blocks = n;
+	if (__cache_write(fd, &offset, table, n * sizeof(*table))) goto out;
+
+	offset = 0;
+	if (__cache_write(fd, &offset, &header, sizeof(header))) goto out;
+	ret = 0;
+
+out:
+	if (rewrite && fd >= 0) {
+		if (close(fd)) ret = -1;
+		if (ret || rename(tmp, cache->path)) {
+			unlink(tmp);
+			ret = -1;
+		}
+	}
+	free(table);
+	return ret;
+}
+
+/* Close @cache, saving the blocks of this source unless @program is NULL */
+static void __cache_close(struct cache *cache, const unsigned int *program)
+{
+	if (program && (cache->nr_fresh || cache->nr_used != cache->nr_blocks)) {
+		if (__cache_save(cache, program)) perror("Cannot update the cache");
+	}
+
+	if (cache->old) munmap(cache->old, cache->old_size);
+	if (cache->fd >= 0) close(cache->fd);
+	for (size_t i = 0; i < cache->nr_fresh; i++) {
+		free(cache->fresh[i].text);
+		free(cache->fresh[i].labels);
+		free(cache->fresh[i].uses);
+		free(cache->fresh[i].names);
+	}
+	free(cache->fresh);
+	free(cache->index);
+	free(cache->used);
+	free(cache->path);
+	free(cache);
+}
+
+/*
+ * Assemble the lines from @begin to @end in place. What the cache needs
+ * is noted in @fresh unless it is NULL. Returns the number of lines
+ */
+static uint32_t __assemble_lines(char *begin, char *end, struct program *program, struct cache_fresh *fresh)
+{
+	char *curr = begin;
+	uint32_t nr_lines = 0;
+
+	while (curr < end) {
+		char *line = curr;
+		char *eol = memchr(curr, '\n', end - curr);
+		char *tokens[MAX_NR_TOKENS] = { NULL };
+		int nr_tokens = 0, nr_assembled;
+		size_t first_word = program->nr_words;
+
+		if (!eol) eol = end;
+		*eol = '\0';
+		curr = eol + 1;
+		assembler.line++;
+		nr_lines++;
+
+		parse_command(line, &nr_tokens, tokens);
+		if (nr_tokens == 0) continue;
+
+		__grow_program(program, MAX_EXPANSION);
+		assembler.defined = NULL;
+		nr_assembled = assemble(nr_tokens, tokens, program->words + first_word);
+		program->nr_words += nr_assembled;
+
+		if (fresh) __cache_record(fresh, nr_lines - 1, first_word - fresh->first_word, nr_assembled);
+	}
+	return nr_lines;
+}
+
+/* Assemble @source in place. Returns the number of words in @program */
+static size_t __assemble_source(char *source, size_t size, struct cache *cache, unsigned int **words)
+{
+	struct program program = { NULL };
+	char *curr = source, *end = source + size;
+
+	__grow_program(&program, 1024);
+
+	while (cache && curr < end) {
+		char *block_end = __cache_block_end(curr, end);
+		uint64_t hash = __cache_hash(curr, block_end - curr);
+		const struct cache_block *hit = __cache_lookup(cache, hash, curr, block_end - curr);
+
+		if (hit) {
+			__cache_replay(cache, hit, &program);
 		} else {
-			if (!token_started) {
-				tokens[*nr_tokens] = curr;
-				*nr_tokens += 1;
-				token_started = true;
+			struct cache_fresh *fresh = __cache_fresh(cache, hash, curr, block_end - curr, program.nr_words);
+
+			fresh->block.nr_lines = __assemble_lines(curr, block_end, &program, fresh);
+			fresh->block.nr_words = program.nr_words - fresh->first_word;
+		}
+		curr = block_end;
+	}
+	if (!cache) __assemble_lines(source, end, &program, NULL);
+
+	if (__resolve_fixups(program.words) < 0 || assembler.nr_errors) {
+		free(program.words);
+		program.words = NULL;
+	}
+
+	*words = program.words;
+	return program.words ? program.nr_words : 0;
+}
+
+static void __write_program(struct output *out, int format, unsigned int *program, size_t nr_words)
+{
+	static const char hex_digits[] = "0123456789abcdef";
+
+	if (format == OUTPUT_IMAGE) {
+		unsigned char *p = __reserve_output(out, IMAGE_HEADER_SIZE + IMAGE_SEGMENT_SIZE);
+
+		image_store32(p + 0, IMAGE_MAGIC);
+		image_store32(p + 4, IMAGE_VERSION);
+		image_store32(p + 8, TEXT_START);
+		image_store32(p + 12, 1);
+
+		image_store32(p + 16, IMAGE_SEGMENT_TEXT);
+		image_store32(p + 20, TEXT_START);
+		image_store32(p + 24, IMAGE_HEADER_SIZE + IMAGE_SEGMENT_SIZE);
+		image_store32(p + 28, nr_words * 4);
+	}
+
+	for (size_t i = 0; i < nr_words; i++) {
+		unsigned int word = program[i];
+
+		if (format == OUTPUT_HEX) {
+			unsigned char *p = __reserve_output(out, 11);
+
+			p[0] = '0';
+			p[1] = 'x';
+			for (int j = 0; j < 8; j++) {
+				p[2 + j] = hex_digits[(word >> (28 - j * 4)) & 0xf];
 			}
+			p[10] = '\n';
+		} else {
+			image_store32(__reserve_output(out, 4), word);
 		}
-		curr++;
 	}
+	__flush_output(out);
+}
 
-	return 0;
+static int assemble_batch(struct line_source *input, FILE *output, int format, const char *cache_path)
+{
+	struct output out = { .file = output };
+	struct cache *cache = NULL;
+	unsigned int *program = NULL;
+	size_t size, nr_words;
+	char *source;
+
+	source = line_source_rest(input, &size);
+	if (!source) {
+		perror("Cannot read the source");
+		return EXIT_FAILURE;
+	}
+
+	if (cache_path) cache = __cache_open(cache_path);
+
+	assembler.deferred = true;
+	nr_words = __assemble_source(source, size, cache, &program);
+	if (cache) __cache_close(cache, program);
+
+	out.buffer = malloc(OUTPUT_BUFFER);
+	if (!program || !out.buffer) {
+		fprintf(stderr, "Cannot assemble the source\n");
+		free(out.buffer);
+		free(program);
+		return EXIT_FAILURE;
+	}
+
+	__write_program(&out, format, program, nr_words);
+
+	free(out.buffer);
+	free(program);
+
+	if (fflush(output) || ferror(output)) {
+		perror("Cannot write the output");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
 }
 
 
@@ -447,18 +1178,59 @@ static int parse_command(char *assembly, int *nr_tokens, char *tokens[])
  */
 int main(int argc, char * const argv[])
 {
-	char assembly[MAX_ASSEMBLY] = { '\0' };
-	FILE *input = stdin;
+	struct line_source input;
+	char *assembly;
+	const char *path = NULL;
+	FILE *output = NULL;
+	char *cache_path = NULL;
+	int format = -1;
+	int opt;
 
-	if (argc > 1) {
-		input = fopen(argv[1], "r");
-		if (!input) {
-			fprintf(stderr, "No input file %s\n", argv[0]);
+	while ((opt = getopt(argc, argv, "c:f:o:")) != -1) {
+		switch (opt) {
+		case 'c':
+			cache_path = optarg;
+			break;
+		case 'o':
+			if (output) fclose(output);
+			output = fopen(optarg, "wb");
+			if (!output) {
+				perror("Output file error");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'f':
+			format = -1;
+			for (int i = 0; i < NR_OUTPUT_FORMATS; i++) {
+				if (strcmp(optarg, output_format_names[i]) == 0) format = i;
+			}
+			if (format >= 0) break;
+			/* fall through */
+		default:
+			fprintf(stderr, "Usage: %s [-c cache file] [-f hex|bin|image] [-o output file] [input file]\n", argv[0]);
 			return EXIT_FAILURE;
 		}
 	}
 
-	if (input == stdin) {
+	if (optind < argc) path = argv[optind];
+
+	if (line_source_open(&input, path)) {
+		fprintf(stderr, "No input file %s\n", path);
+		return EXIT_FAILURE;
+	}
+
+	assembler.labels = symbol_table_create();
+
+	if (format >= 0 || output || cache_path) {
+		int ret = assemble_batch(&input, output ? output : stdout, format >= 0 ? format : OUTPUT_HEX, cache_path);
+
+		line_source_close(&input);
+		if (output) fclose(output);
+		symbol_table_destroy(assembler.labels);
+		return ret;
+	}
+
+	if (!path) {
 		printf("*********************************************************\n");
 		printf("*          >> SCE212 MIPS translator  v0.01 <<          *\n");
 		printf("*                                                       *\n");
@@ -474,26 +1246,27 @@ int main(int argc, char * const argv[])
 		printf(">> ");
 	}
 
-	while (fgets(assembly, sizeof(assembly), input)) {
+	while ((assembly = line_source_next(&input, NULL))) {
 		char *tokens[MAX_NR_TOKENS] = { NULL };
 		int nr_tokens = 0;
-		unsigned int machine_code;
-
-		for (size_t i = 0; i < strlen(assembly); i++) {
-			assembly[i] = tolower(assembly[i]);
-		}
+		unsigned int machine_code[MAX_EXPANSION];
+		unsigned int nr_errors = assembler.nr_errors;
+		int nr_words;
 
 		if (parse_command(assembly, &nr_tokens, tokens) < 0)
 			continue;
 
-		machine_code = translate(nr_tokens, tokens);
+		nr_words = assemble(nr_tokens, tokens, machine_code);
 
-		fprintf(stderr, "0x%08x\n", machine_code);
+		for (int i = 0; i < nr_words && assembler.nr_errors == nr_errors; i++) {
+			fprintf(stderr, "0x%08x\n", machine_code[i]);
+		}
 
-		if (input == stdin) printf(">> ");
+		if (!path) printf(">> ");
 	}
 
-	if (input != stdin) fclose(input);
+	line_source_close(&input);
+	symbol_table_destroy(assembler.labels);
 
 	return EXIT_SUCCESS;
 }
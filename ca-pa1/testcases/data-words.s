@@ -0,0 +1,13 @@
+.text
+main:	addi $t0, $zero, 1
+	jr $ra
+.data
+str:	.asciiz "abc"
+words:	.word 7:3
+one:	.word -3
+bytes:	.word -16580095
+bytes2:	.word 151486719
+halves:	.word -126412
+halves2:	.word 7
+gap:	.word 0:3
+long:	.asciiz "hello, world!!!"
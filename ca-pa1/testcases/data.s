@@ -0,0 +1,11 @@
+.text
+main:	addi $t0, $zero, 1
+	jr $ra
+.data
+str:	.asciiz "abc"
+words:	.word 7:3
+one:	.word -3
+bytes:	.byte 1, 2, 3, 0xff, -1, 0x80, 7, 9
+halves:	.half 0x1234, -2, 7, 0
+gap:	.space 10
+long:	.asciiz "hello, world!!!"
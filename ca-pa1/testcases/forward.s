@@ -0,0 +1,17 @@
+.text
+start:	beq $t0, $t1, ahead
+	bne $t0, $zero, ahead	# Same label twice
+	j ahead
+	jal far
+	la $a0, far_data
+	la $a1, near_data
+	beq $t0, $t1, start	# Backward
+	bne $t1, $t2, ahead
+ahead:	add $t0, $t0, $t1
+	j start
+	jal ahead
+far:	jr $ra
+.data
+near_data:	.word 1
+pad:	.word 0:17500
+far_data:	.word 2
@@ -0,0 +1,37 @@
+.text
+main_0:	la $a0, msg_0
+	la $a1, table_0
+	lw $t0, 0($a1)
+	lw $t1, 4($a1)
+	addi $t2, $zero, 10
+	beq $t0, $t1, same_0
+	bne $t0, $zero, differ_0
+	jal helper_0
+loop_0:	add $t3, $t3, $t0
+	sub $t4, $t4, $t1
+	and $t5, $t3, $t4
+	or $t6, $t3, $t4
+	slt $t7, $t3, $t4
+	sll $s0, $t3, 2
+	srl $s1, $t4, 3
+	andi $s2, $t5, 255
+	ori $s3, $t6, 4096
+	slti $s4, $t7, -1
+	lui $s5, 4660
+	addi $t2, $t2, -1
+	bne $t2, $zero, loop_0
+	nop
+same_0:	sw $t3, 8($a1)
+	j done_0	# Forward
+differ_0:	sw $t4, 12($a1)
+	j loop_0
+helper_0:	add $v0, $a0, $a1
+	jr $ra
+done_0:	beq $zero, $zero, main_0
+.data
+msg_0:	.asciiz "hello, world"
+table_0:	.word 7:4
+count_0:	.word -3
+bytes_0:	.byte 1, 2, 3, 0xff, -1
+halves_0:	.half 0x1234, -2, 7
+gap_0:	.space 10
@@ -0,0 +1,4 @@
+.text
+	beq $t0, $t1, nowhere
+	la $a0, nothing
+	j nowhere
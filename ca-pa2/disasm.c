@@ -0,0 +1,335 @@
+/**********************************************************************
+ * disasm.c
+ *
+ * Stream a program through isa_disassemble(). The program may be the hex
+ * text pa2 loads, raw big-endian words, or an image written by pa1. The
+ * format is detected from the contents unless -f is given. Files are
+ * mapped, and pipes are read in large blocks, so the input is never
+ * copied line by line.
+ *
+ *   disasm [-a address] [-f hex|bin|image] [program file]
+ **********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "isa.h"
+#include "image.h"
+
+#define INITIAL_PC      0x1000       /* Where pa2 loads programs */
+#define BLOCK_SIZE      (1 << 20)    /* Of each read from a pipe */
+#define OUTPUT_BUFFER   (1 << 20)
+#define LINE_MAX_SIZE   (2 + 8 + 3 + 8 + 4 + ISA_DISASM_MAX + 1)
+
+enum input_formats {
+    INPUT_HEX = 0,
+    INPUT_BINARY,
+    INPUT_IMAGE,
+    NR_INPUT_FORMATS,
+};
+
+static const char * const input_format_names[NR_INPUT_FORMATS] = {
+    "hex", "bin", "image",
+};
+
+static char output[OUTPUT_BUFFER];
+static size_t output_used;
+
+static void __flush_output(void)
+{
+    fwrite(output, 1, output_used, stdout);
+    output_used = 0;
+}
+
+/* The two hex digits of each byte */
+static char hex_pairs[256][2];
+
+static void __build_hex_pairs(void)
+{
+    static const char hex_digits[] = "0123456789abcdef";
+
+    for (int i = 0; i < 256; i++) {
+        hex_pairs[i][0] = hex_digits[i >> 4];
+        hex_pairs[i][1] = hex_digits[i & 0xf];
+    }
+}
+
+static char *__put_hex(char *p, uint32_t value)
+{
+    memcpy(p + 0, hex_pairs[value >> 24], 2);
+    memcpy(p + 2, hex_pairs[(value >> 16) & 0xff], 2);
+    memcpy(p + 4, hex_pairs[(value >> 8) & 0xff], 2);
+    memcpy(p + 6, hex_pairs[value & 0xff], 2);
+    return p + 8;
+}
+
+/* "0x%08x:  %08x    %s\n" of @word at @pc, without going through printf */
+static void __print_instruction(uint32_t pc, uint32_t word)
+{
+    char *p;
+
+    if (output_used + LINE_MAX_SIZE > OUTPUT_BUFFER) __flush_output();
+
+    p = output + output_used;
+    *p++ = '0';
+    *p++ = 'x';
+    p = __put_hex(p, pc);
+    memcpy(p, ":  ", 3);
+    p = __put_hex(p + 3, word);
+    memcpy(p, "    ", 4);
+    p += 4;
+    p += isa_disassemble(word, pc, p);
+    *p++ = '\n';
+
+    output_used = p - output;
+}
+
+/* Disassemble the whole words in @data. Returns the number of bytes used */
+static size_t __disassemble_binary(const unsigned char *data, size_t size, uint32_t *pc)
+{
+    size_t i;
+
+    for (i = 0; i + 4 <= size; i += 4, *pc += 4) {
+        __print_instruction(*pc, image_load32(data + i));
+    }
+    return i;
+}
+
+/*
+ * Disassemble the lines of @data that start with a number, as pa2 does.
+ * The last line is left over unless @last. Returns the number of bytes
+ * used
+ */
+static size_t __disassemble_hex(const unsigned char *data, size_t size, uint32_t *pc, int last)
+{
+    const unsigned char *p = data, *end = data + size;
+
+    while (p < end) {
+        const unsigned char *eol = memchr(p, '\n', end - p);
+        uint32_t word = 0;
+        int nr_digits = 0;
+
+        if (!eol) {
+            if (!last) break;
+            eol = end;
+        }
+
+        while (p < eol && (*p == ' ' || *p == '\t')) p++;
+
+        if (eol - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+            for (p += 2; p < eol; p++, nr_digits++) {
+                unsigned int c = *p, digit;
+
+                if (c - '0' < 10) digit = c - '0';
+                else if ((c | 0x20) - 'a' < 6) digit = (c | 0x20) - 'a' + 10;
+                else break;
+                word = word << 4 | digit;
+            }
+        } else {
+            for (; p < eol && (unsigned int)*p - '0' < 10; p++, nr_digits++) {
+                word = word * 10 + (*p - '0');
+            }
+        }
+
+        if (nr_digits) {
+            __print_instruction(*pc, word);
+            *pc += 4;
+        }
+        p = eol + 1;
+    }
+    return p > end ? size : (size_t)(p - data);
+}
+
+static int __detect_format(const unsigned char *data, size_t size)
+{
+    if (size >= IMAGE_HEADER_SIZE && image_load32(data) == IMAGE_MAGIC) return INPUT_IMAGE;
+
+    for (size_t i = 0; i < size && i < 64; i++) {
+        unsigned char c = data[i];
+
+        if (c != '\n' && c != '\r' && c != '\t' && (c < ' ' || c > '~')) return INPUT_BINARY;
+    }
+    return INPUT_HEX;
+}
+
+static int __disassemble_image(const unsigned char *data, size_t size)
+{
+    uint32_t nr_segments;
+
+    if (size < IMAGE_HEADER_SIZE || image_load32(data) != IMAGE_MAGIC ||
+            image_load32(data + 4) != IMAGE_VERSION) {
+        fprintf(stderr, "Not a program image\n");
+        return -1;
+    }
+
+    nr_segments = image_load32(data + 12);
+    for (uint32_t i = 0; i < nr_segments; i++) {
+        const unsigned char *segment = data + IMAGE_HEADER_SIZE + (size_t)i * IMAGE_SEGMENT_SIZE;
+        uint32_t pc, offset, length;
+
+        if ((size_t)(segment - data) + IMAGE_SEGMENT_SIZE > size) break;
+        if (image_load32(segment) != IMAGE_SEGMENT_TEXT) continue;
+
+        pc = image_load32(segment + 4);
+        offset = image_load32(segment + 8);
+        length = image_load32(segment + 12);
+        if (offset > size || length > size - offset) {
+            fprintf(stderr, "Segment %u is out of the image\n", i);
+            return -1;
+        }
+        __disassemble_binary(data + offset, length, &pc);
+    }
+    return 0;
+}
+
+/* Read all of @fd, for images which are not streamed */
+static unsigned char *__read_all(int fd, unsigned char *data, size_t *size, size_t *capacity)
+{
+    ssize_t nr_read;
+
+    for (;;) {
+        if (*size == *capacity) {
+            unsigned char *grown = realloc(data, *capacity * 2);
+            if (!grown) {
+                free(data);
+                return NULL;
+            }
+            data = grown;
+            *capacity *= 2;
+        }
+        nr_read = read(fd, data + *size, *capacity - *size);
+        if (nr_read <= 0) break;
+        *size += nr_read;
+    }
+    return data;
+}
+
+static int __disassemble_stream(int fd, int format, uint32_t pc)
+{
+    size_t capacity = BLOCK_SIZE, used = 0;
+    unsigned char *block = malloc(capacity);
+    ssize_t nr_read = 1;
+    int ret = 0;
+
+    if (!block) return -1;
+
+    while (nr_read > 0) {
+        size_t consumed;
+
+        nr_read = read(fd, block + used, capacity - used);
+        if (nr_read > 0) used += nr_read;
+
+        if (format < 0) {
+            if (used < IMAGE_HEADER_SIZE && nr_read > 0) continue;
+            format = __detect_format(block, used);
+        }
+
+        if (format == INPUT_IMAGE) {
+            block = __read_all(fd, block, &used, &capacity);
+            ret = block ? __disassemble_image(block, used) : -1;
+            break;
+        }
+
+        if (format == INPUT_HEX) {
+            consumed = __disassemble_hex(block, used, &pc, nr_read <= 0);
+        } else {
+            consumed = __disassemble_binary(block, used, &pc);
+        }
+        memmove(block, block + consumed, used - consumed);
+        used -= consumed;
+
+        /* A line longer than a block */
+        if (used == capacity) {
+            unsigned char *grown = realloc(block, capacity * 2);
+            if (!grown) {
+                ret = -1;
+                break;
+            }
+            block = grown;
+            capacity *= 2;
+        }
+    }
+
+    free(block);
+    return ret;
+}
+
+static int __disassemble_file(int fd, int format, uint32_t pc)
+{
+    struct stat st;
+    unsigned char *data;
+    int ret = 0;
+
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        return __disassemble_stream(fd, format, pc);
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) return __disassemble_stream(fd, format, pc);
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    if (format < 0) format = __detect_format(data, st.st_size);
+
+    if (format == INPUT_IMAGE) {
+        ret = __disassemble_image(data, st.st_size);
+    } else if (format == INPUT_HEX) {
+        __disassemble_hex(data, st.st_size, &pc, 1);
+    } else {
+        __disassemble_binary(data, st.st_size, &pc);
+    }
+
+    munmap(data, st.st_size);
+    return ret;
+}
+
+int main(int argc, char * const argv[])
+{
+    uint32_t pc = INITIAL_PC;
+    int format = -1;
+    int fd = STDIN_FILENO;
+    int opt, ret;
+
+    while ((opt = getopt(argc, argv, "a:f:")) != -1) {
+        switch (opt) {
+        case 'a':
+            pc = strtoimax(optarg, NULL, 0);
+            break;
+        case 'f':
+            format = -1;
+            for (int i = 0; i < NR_INPUT_FORMATS; i++) {
+                if (strcmp(optarg, input_format_names[i]) == 0) format = i;
+            }
+            if (format >= 0) break;
+            /* fall through */
+        default:
+            fprintf(stderr, "Usage: %s [-a address] [-f hex|bin|image] [program file]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind < argc) {
+        fd = open(argv[optind], O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "No input file %s\n", argv[optind]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    __build_hex_pairs();
+    ret = __disassemble_file(fd, format, pc);
+    __flush_output();
+
+    if (fd != STDIN_FILENO) close(fd);
+
+    if (fflush(stdout) || ferror(stdout)) {
+        perror("Cannot write the output");
+        return EXIT_FAILURE;
+    }
+    return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -2,9 +2,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <errno.h>
+#include <endian.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/syscall.h>
 
+#include "program.h"
+
 #define OPCODE_BS   26
 #define RS_BS       21
 #define RT_BS       16
@@ -43,10 +48,8 @@ float fpregisters[32];
 unsigned int LO, HI;
 unsigned long long result, result2, result3, result4;
 float fresult;
-int *inst_p;
-int *inst_max;
-int *inst_base;
-int *base;
+uint32_t pc;         // Guest address of the instruction being executed
+uint32_t next_pc;    // Where to go after it; branches and jumps change it
 
 int opcode(int instruction){
     return (instruction >> OPCODE_BS) & SIX_MASK;
@@ -80,9 +83,13 @@ int address(int instruction){
     return instruction & ADDR_MASK;
 }
 
+void flush_output();
+void exit_guest(int status);
+
 void trap(char arg[]){
+    flush_output();
     printf("TRAP (%s)\n", arg);
-    exit(1);
+    exit_guest(1);
 }
 
 int mask_reg(long long reg){
@@ -107,6 +114,383 @@ int se_8_32(int reg){
     return value;
 }
 
+int se_16(int immediate){
+    return (int16_t) immediate;
+}
+
+/*
+ * Guest address space
+ *
+ * The guest sees only 32-bit guest addresses. Each segment is backed by a
+ * host mapping reserved up to the segment's limit, and every access goes
+ * through translate(), so no guest address can reach host memory outside
+ * the segments. Translations are cached per 4 KB page in a direct-mapped
+ * software TLB, one for reads and one for writes. A hit costs a compare
+ * and an add, like the host pointers this replaces. Guest memory is
+ * big-endian, like the programs pa1 writes, so the text of a program can
+ * be mapped straight from its file.
+ *
+ *   0x00400000  text   read-only, the program
+ *   0x10000000  data   gp points 0x8000 into it
+ *   (data end)  heap   grown by sbrk
+ *   0x7ffffffc  stack  grows down from here
+ */
+#define PAGE_SHIFT      12
+#define PAGE_SIZE       (1u << PAGE_SHIFT)
+#define PAGE_MASK       (PAGE_SIZE - 1)
+
+#define TEXT_BASE       0x00400000u
+#define DATA_BASE       0x10000000u
+#define DATA_SIZE       (64u << 10)
+#define HEAP_LIMIT      (256u << 20)
+#define STACK_TOP       0x80000000u
+#define STACK_LIMIT     (8u << 20)
+
+#define TLB_ENTRIES     256
+
+enum segment_ids {
+    SEGMENT_TEXT = 0,
+    SEGMENT_DATA,
+    SEGMENT_HEAP,
+    SEGMENT_STACK,
+    NR_SEGMENTS,
+};
+
+struct segment {
+    const char *name;
+    uint32_t base;
+    uint32_t size;           // Accessible bytes from base
+    uint32_t limit;          // Bytes reserved at host
+    int writable;
+    unsigned char *host;
+};
+
+struct tlb_entry {
+    uint32_t page;           // Guest page number, or TLB_INVALID
+    unsigned char *host;     // Host address of the page
+};
+
+#define TLB_INVALID     0xffffffffu
+
+struct segment segments[NR_SEGMENTS];
+struct tlb_entry read_tlb[TLB_ENTRIES], write_tlb[TLB_ENTRIES];
+uint32_t heap_break;     // Guest address of the end of the heap
+const unsigned char *decoded;   // Decoded text from the image, if it has any
+
+void trap_address(char what[], uint32_t vaddr){
+    flush_output();
+    printf("TRAP (%s at 0x%08x, pc 0x%08x)\n", what, vaddr, pc);
+    exit_guest(1);
+}
+
+// Reserve @limit bytes of host memory for a segment at @base, @size of them accessible
+void map_segment(int id, const char *name, uint32_t base, uint32_t size, uint32_t limit, int writable){
+    struct segment *segment = &segments[id];
+    void *host = mmap(NULL, limit, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (host == MAP_FAILED){
+        printf("Could not map the %s segment.\n", name);
+        exit(1);
+    }
+    segment->name = name;
+    segment->base = base;
+    segment->size = size;
+    segment->limit = limit;
+    segment->writable = writable;
+    segment->host = host;
+}
+
+void flush_tlb(){
+    for (int i = 0; i < TLB_ENTRIES; i++){
+        read_tlb[i].page = TLB_INVALID;
+        write_tlb[i].page = TLB_INVALID;
+    }
+}
+
+// The slow path of translate(): find the segment of @vaddr and cache its page
+unsigned char *fill_tlb(uint32_t vaddr, int write){
+    struct tlb_entry *entry = &(write ? write_tlb : read_tlb)[(vaddr >> PAGE_SHIFT) % TLB_ENTRIES];
+
+    for (int i = 0; i < NR_SEGMENTS; i++){
+        struct segment *segment = &segments[i];
+        uint32_t offset = vaddr - segment->base;
+
+        if (!segment->host || offset >= segment->size) continue;
+        if (write && !segment->writable) trap_address("write to read-only memory", vaddr);
+
+        // Host mappings are whole pages, so the whole page is backed even where the segment ends in it
+        entry->page = vaddr >> PAGE_SHIFT;
+        entry->host = segment->host + (offset & ~PAGE_MASK);
+        return entry->host + (vaddr & PAGE_MASK);
+    }
+    trap_address("bad address", vaddr);
+    return NULL;
+}
+
+// Host address of the @size bytes at @vaddr, which must be aligned to @size
+static inline unsigned char *translate(uint32_t vaddr, uint32_t size, int write){
+    struct tlb_entry *entry = &(write ? write_tlb : read_tlb)[(vaddr >> PAGE_SHIFT) % TLB_ENTRIES];
+
+    if (vaddr & (size - 1)) trap_address("unaligned access", vaddr);
+    if (entry->page == vaddr >> PAGE_SHIFT) return entry->host + (vaddr & PAGE_MASK);
+    return fill_tlb(vaddr, write);
+}
+
+uint32_t load_word(uint32_t vaddr){
+    uint32_t value;
+    memcpy(&value, translate(vaddr, 4, 0), 4);
+    return be32toh(value);
+}
+
+uint16_t load_half(uint32_t vaddr){
+    uint16_t value;
+    memcpy(&value, translate(vaddr, 2, 0), 2);
+    return be16toh(value);
+}
+
+uint8_t load_byte(uint32_t vaddr){
+    return *translate(vaddr, 1, 0);
+}
+
+void store_word(uint32_t vaddr, uint32_t value){
+    value = htobe32(value);
+    memcpy(translate(vaddr, 4, 1), &value, 4);
+}
+
+void store_half(uint32_t vaddr, uint16_t value){
+    value = htobe16(value);
+    memcpy(translate(vaddr, 2, 1), &value, 2);
+}
+
+void store_byte(uint32_t vaddr, uint8_t value){
+    *translate(vaddr, 1, 1) = value;
+}
+
+// Move the end of the heap by @increment bytes. Returns the old end, or -1 if it cannot move
+uint32_t sbrk_heap(int32_t increment){
+    struct segment *heap = &segments[SEGMENT_HEAP];
+    uint32_t old_break = heap_break;
+    int64_t used = (int64_t) (heap_break - heap->base) + increment;
+    uint32_t size;
+
+    if (used < 0 || used > heap->limit) return (uint32_t) -1;
+
+    size = (used + PAGE_MASK) & ~PAGE_MASK;
+    if (size < heap->size){
+        // Pages given back are zero when they are handed out again
+        madvise(heap->host + size, heap->size - size, MADV_DONTNEED);
+        flush_tlb();
+    }
+    heap->size = size;
+    heap_break = heap->base + used;
+    return old_break;
+}
+
+/*
+ * Syscall layer
+ *
+ * Guest output collects in one buffer that goes to the host in a single
+ * write() when it fills up, before the guest reads (so prompts show up),
+ * and when the guest exits or traps. Input is read a buffer at a time too,
+ * and the read services take their bytes from it. Integers are formatted
+ * and parsed here rather than by printf and scanf, so a print costs a few
+ * stores. Every service is counted, and "-s" prints the counts on exit.
+ */
+#define OUTPUT_BUFFER   (64u << 10)
+#define INPUT_BUFFER    (64u << 10)
+#define NR_SYSCALLS     13
+
+struct output {
+    char buffer[OUTPUT_BUFFER];
+    uint32_t used;
+    uint64_t nr_bytes;
+    uint64_t nr_writes;
+};
+
+struct input {
+    unsigned char buffer[INPUT_BUFFER];
+    uint32_t next;
+    uint32_t end;
+    int eof;
+    uint64_t nr_bytes;
+    uint64_t nr_reads;
+};
+
+const char *syscall_names[NR_SYSCALLS] = {
+    [1] = "print_int", [4] = "print_string", [5] = "read_int", [8] = "read_string",
+    [9] = "sbrk", [10] = "exit", [11] = "print_char", [12] = "read_char",
+};
+
+struct output output;
+struct input input;
+uint64_t syscall_counts[NR_SYSCALLS];
+int print_stats;
+
+void flush_output(){
+    uint32_t done = 0;
+
+    while (done < output.used){
+        ssize_t written = write(STDOUT_FILENO, output.buffer + done, output.used - done);
+        if (written <= 0) break;  // Nowhere to put it; drop the rest like a closed stdout would
+        done += written;
+        output.nr_writes++;
+    }
+    output.nr_bytes += output.used;
+    output.used = 0;
+}
+
+// Room for @size more bytes at the end of the output buffer
+static inline char *reserve_output(uint32_t size){
+    if (output.used + size > OUTPUT_BUFFER) flush_output();
+    return output.buffer + output.used;
+}
+
+void put_char(char c){
+    *reserve_output(1) = c;
+    output.used++;
+}
+
+void put_int(int32_t value){
+    char digits[11];
+    char *p = reserve_output(sizeof(digits) + 1);
+    uint32_t magnitude = value < 0 ? -(uint32_t) value : (uint32_t) value;
+    int n = 0;
+
+    do {
+        digits[n++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude);
+
+    if (value < 0) *p++ = '-';
+    while (n) *p++ = digits[--n];
+    output.used = p - output.buffer;
+}
+
+// Copy the string at @vaddr a page at a time, translating each page once
+void put_string(uint32_t vaddr){
+    for (;;){
+        const unsigned char *host = translate(vaddr, 1, 0);
+        uint32_t left = PAGE_SIZE - (vaddr & PAGE_MASK);
+        const unsigned char *nul = memchr(host, 0, left);
+        uint32_t length = nul ? (uint32_t) (nul - host) : left;
+
+        while (length){
+            uint32_t chunk = length < OUTPUT_BUFFER ? length : OUTPUT_BUFFER;
+            memcpy(reserve_output(chunk), host, chunk);
+            output.used += chunk;
+            host += chunk;
+            length -= chunk;
+        }
+        if (nul) return;
+        vaddr += left;
+    }
+}
+
+// Next byte of input, or EOF. Pending output is flushed before blocking on the host
+int get_char(){
+    if (input.next == input.end){
+        ssize_t nr_read;
+
+        if (input.eof) return EOF;
+        flush_output();
+        nr_read = read(STDIN_FILENO, input.buffer, INPUT_BUFFER);
+        input.nr_reads++;
+        if (nr_read <= 0){
+            input.eof = 1;
+            return EOF;
+        }
+        input.next = 0;
+        input.end = nr_read;
+        input.nr_bytes += nr_read;
+    }
+    return input.buffer[input.next++];
+}
+
+static inline int peek_char(){
+    int c = get_char();
+    if (c != EOF) input.next--;
+    return c;
+}
+
+// Like scanf("%d"): blanks, a sign and digits. Returns 0 if there is no number
+int32_t get_int(){
+    uint32_t value = 0;
+    int negative = 0;
+    int c;
+
+    while ((c = peek_char()) == ' ' || (c >= '\t' && c <= '\r')) input.next++;
+    if (c == '-' || c == '+'){
+        negative = c == '-';
+        input.next++;
+    }
+    while ((c = peek_char()) >= '0' && c <= '9'){
+        value = value * 10 + (c - '0');
+        input.next++;
+    }
+    return negative ? -value : value;
+}
+
+void exit_guest(int status){
+    flush_output();
+    if (print_stats){
+        fprintf(stderr, "%-16s %12s\n", "syscall", "calls");
+        for (int i = 0; i < NR_SYSCALLS; i++){
+            if (syscall_names[i]) fprintf(stderr, "%2d %-13s %12llu\n", i, syscall_names[i], (unsigned long long) syscall_counts[i]);
+        }
+        fprintf(stderr, "output: %llu bytes in %llu writes\n", (unsigned long long) output.nr_bytes, (unsigned long long) output.nr_writes);
+        fprintf(stderr, "input:  %llu bytes in %llu reads\n", (unsigned long long) input.nr_bytes, (unsigned long long) input.nr_reads);
+    }
+    exit(status);
+}
+
+void do_syscall(uint32_t service){
+    if (service >= NR_SYSCALLS || !syscall_names[service]) trap("invalid syscall");
+    syscall_counts[service]++;
+
+    switch(service){
+        case 1:
+            put_int(registers[4]); // print integer from a0
+            break;
+
+        case 4:
+            put_string(registers[4]); // print string at a0
+            break;
+
+        case 5:
+            registers[2] = get_int(); // read integer into v0
+            break;
+
+        case 8: { // Read a1 characters into pointer at a0, like fgets
+            uint32_t a = registers[4];
+            int c = 0;
+            if (registers[5] == 0) break;
+            for (uint32_t n = 1; n < registers[5] && c != '\n' && (c = get_char()) != EOF; n++){
+                store_byte(a++, c);
+            }
+            store_byte(a, 0);
+            break;
+        }
+
+        case 9:
+            registers[2] = sbrk_heap((int32_t) registers[4]); // Allocate a0 bytes of heap
+            break;
+
+        case 10:
+            exit_guest(0);
+            break;
+
+        case 11:
+            put_char(registers[4]); // Print character at a0
+            break;
+
+        case 12: {
+            int c = get_char(); // Read character into v0
+            registers[2] = c == EOF ? 0 : c;
+            break;
+        }
+    }
+}
+
 void process_r(r_instruction inst){
     // printf("%d %d %d %d %d %d\n", inst.opcode, inst.rs, inst.rt, inst.rd, inst.shamt, inst.funct);
     switch(inst.funct){
@@ -215,50 +599,11 @@ void process_r(r_instruction inst){
             break;
 
         case 0x8: // jr
-            inst_p = ((int *) (uintptr_t) registers[inst.rs]) - 4;
+            next_pc = registers[inst.rs];
             break;
 
         case 0xb: // syscall
-            // printf("syscall, register=%d\n", registers[2]);
-            switch(registers[2]){
-                case 1:
-                    printf("%d", registers[4]); // print integer from a0
-                    break;
-                // floating point
-
-                case 4:
-                    printf("%s", (uintptr_t) (base + registers[4])); // print string at a0
-                    break;
-
-                case 5:
-                    scanf("%d",registers[2]); // read integer into v0
-                    break;
-
-                // floating point
-
-                case 8:
-                    fgets((char*) (uintptr_t) registers[4], registers[5], stdin); // Read a1 characters into pointer at a0
-                    break;
-
-                case 9:
-                    registers[2] = (uintptr_t) malloc(registers[4]);
-                    break;
-
-                case 10:
-                    exit(0);
-                    break;
-
-                case 11:
-                    printf("%c", registers[4]); // Print character at a0
-                    break;
-
-                case 12:
-                    scanf("%c", registers[2]); // Read character into v0
-                    break;
-
-                default:
-                    trap("invalid syscall");
-            }
+            do_syscall(registers[2]);
             break;
         default:
             trap("invalid instruction");
@@ -271,12 +616,12 @@ void process_j(j_instruction inst){
     // printf("%x %d\n", inst.opcode, inst.address);
     switch(inst.opcode){
         case 0x2: // j
-            inst_p += inst.address;
+            next_pc = ((pc + 4) & 0xf0000000) | (inst.address << 2);
             break;
 
         case 0x3: // jal
-            registers[31] = (int) inst_p + 1;
-            inst_p += inst.address;
+            registers[31] = pc + 4;
+            next_pc = ((pc + 4) & 0xf0000000) | (inst.address << 2);
             break;
 
         default:
@@ -300,42 +645,42 @@ void process_i(i_instruction inst){
             break;
 
         case 0x23: // lw
-            result = *(int*) (uintptr_t) (registers[inst.rs] + 4*inst.immediate);
+            result = load_word(registers[inst.rs] + se_16(inst.immediate));
             registers[inst.rt] = result;
             break;
 
         case 0x21: // lh
-            result = *(short*) (uintptr_t) (registers[inst.rs] + 4*inst.immediate);
+            result = load_half(registers[inst.rs] + se_16(inst.immediate));
             result = se_16_32(result);
             registers[inst.rt] = result;
             break;
 
         case 0x25: // lhu
-            result = *(short*) (uintptr_t) (registers[inst.rs] + 4*inst.immediate);
+            result = load_half(registers[inst.rs] + se_16(inst.immediate));
             registers[inst.rt] = result;
             break;
 
         case 0x20: // lb
-            result = *(char*) (uintptr_t) (registers[inst.rs] + 4*inst.immediate);
+            result = load_byte(registers[inst.rs] + se_16(inst.immediate));
             result = se_8_32(result);
             registers[inst.rt] = result;
             break;
 
         case 0x24: // lbu
-            result = *(char*) (uintptr_t) (registers[inst.rs] + 4*inst.immediate);
+            result = load_byte(registers[inst.rs] + se_16(inst.immediate));
             registers[inst.rt] = result;
             break;
 
         case 0x2b: // sw
-            *(int*) (uintptr_t) (registers[inst.rs] + 4*inst.immediate) = registers[inst.rt];
+            store_word(registers[inst.rs] + se_16(inst.immediate), registers[inst.rt]);
             break;
 
         case 0x29: // sh
-            *(short*) (uintptr_t) (registers[inst.rs] + 4*inst.immediate) = (short) registers[inst.rt];
+            store_half(registers[inst.rs] + se_16(inst.immediate), registers[inst.rt]);
             break;
 
         case 0x28: // sb
-            *(char*) (uintptr_t) (registers[inst.rs] + 4*inst.immediate) = (char) registers[inst.rt];
+            store_byte(registers[inst.rs] + se_16(inst.immediate), registers[inst.rt]);
             break;
 
         case 0xf: // lui
@@ -357,11 +702,11 @@ void process_i(i_instruction inst){
             break;
 
         case 0x4: // beq
-            if (registers[inst.rs] == registers[inst.rt]) inst_p = inst_p + inst.immediate;
+            if (registers[inst.rs] == registers[inst.rt]) next_pc = pc + 4 + ((uint32_t) se_16(inst.immediate) << 2);
             break;
 
         case 0x5: // bne
-            if (registers[inst.rs] != registers[inst.rt]) inst_p = inst_p + inst.immediate;
+            if (registers[inst.rs] != registers[inst.rt]) next_pc = pc + 4 + ((uint32_t) se_16(inst.immediate) << 2);
             break;
         
         default:
@@ -370,8 +715,7 @@ void process_i(i_instruction inst){
     return;
 }
 
-void process_inst(){
-    int instruction = *inst_p;
+void process_inst(int instruction){
     // printf("Instruction=%d, Opcode=%d\n", instruction, opcode(instruction));
     if (opcode(instruction) == 0){
         // R instruction
@@ -404,13 +748,79 @@ void process_inst(){
     }
 }
 
+// Run an entry of the decoded segment, which image.h describes
+void process_decoded(const unsigned char *entry){
+    int op = entry[IMAGE_DECODED_OPCODE] & SIX_MASK;
+    int immediate = entry[IMAGE_DECODED_IMMEDIATE] << 8 | entry[IMAGE_DECODED_IMMEDIATE + 1];
+
+    if (op == 0){
+        r_instruction inst = { op, entry[IMAGE_DECODED_RS] & FIVE_MASK, entry[IMAGE_DECODED_RT] & FIVE_MASK,
+                               entry[IMAGE_DECODED_RD] & FIVE_MASK, entry[IMAGE_DECODED_SHAMT] & FIVE_MASK,
+                               entry[IMAGE_DECODED_FUNCT] & SIX_MASK };
+        process_r(inst);
+    }
+
+    else if (op == 2 || op == 3){
+        j_instruction inst = { op, (entry[IMAGE_DECODED_RS] & FIVE_MASK) << RS_BS |
+                                   (entry[IMAGE_DECODED_RT] & FIVE_MASK) << RT_BS | immediate };
+        process_j(inst);
+    }
+
+    else{
+        i_instruction inst = { op, entry[IMAGE_DECODED_RS] & FIVE_MASK, entry[IMAGE_DECODED_RT] & FIVE_MASK, immediate };
+        process_i(inst);
+    }
+}
+
+// Run until the program falls off the end of the text
 void inst_loop(){
-    while(inst_p < inst_max){
-        // printf("Executing instruction at %p\n", inst_p);
-        process_inst();
-        inst_p += 1;
+    const struct segment *text = &segments[SEGMENT_TEXT];
+    uint32_t end = text->base + text->limit;
+
+    while (pc != end){
+        uint32_t offset = pc - text->base;
+        uint32_t instruction;
+
+        if (offset >= text->limit || (pc & 3)) trap_address("bad pc", pc);
+
+        // printf("Executing instruction at 0x%08x\n", pc);
+        next_pc = pc + 4;
+        if (decoded){
+            process_decoded(decoded + offset / 4 * IMAGE_DECODED_SIZE);
+        }
+        else{
+            memcpy(&instruction, text->host + offset, 4);
+            process_inst(be32toh(instruction));
+        }
+        registers[0] = 0;
+        pc = next_pc;
     }
 }
+
+// Give the guest the text of @program, in place if it starts a page of the mapped file
+void load_text(const struct program *program, const struct program_segment *text){
+    if (text->size % 4 != 0){
+        trap("size must be a multiple of 4");
+    }
+    if (text->size == 0 || text->vaddr < PAGE_SIZE || (text->vaddr & PAGE_MASK) ||
+            text->vaddr >= DATA_BASE || text->size > DATA_BASE - text->vaddr){
+        trap("no room for the program");
+    }
+
+    // The mapping is read-only and whole pages, so it serves as the segment until exit.
+    // Words parsed from hex text are not in it
+    if (program->mapped && program->format != PROGRAM_HEX &&
+            text->offset != PROGRAM_NO_OFFSET && text->offset % PAGE_SIZE == 0){
+        segments[SEGMENT_TEXT] = (struct segment) {
+            "text", text->vaddr, text->size, text->size, 0, (unsigned char *) text->contents,
+        };
+        return;
+    }
+
+    map_segment(SEGMENT_TEXT, "text", text->vaddr, text->size, text->size, 0);
+    memcpy(segments[SEGMENT_TEXT].host, text->contents, text->size);
+}
+
 int main(int argc, char *argv[]){
     if(sizeof(int) != 4){
         printf("sizeof(int) has to be 4 for this interpreter to work.\n");
@@ -419,6 +829,13 @@ int main(int argc, char *argv[]){
 
     char* file;
 
+    // "-s" prints the syscall counts on exit
+    if (argc > 1 && strcmp(argv[1], "-s") == 0){
+        print_stats = 1;
+        argc--;
+        argv++;
+    }
+
     // Check if file is specified, if so set the file to argv
     if (argc > 1){
         file = argv[1];
@@ -435,36 +852,47 @@ int main(int argc, char *argv[]){
     LO = 0;
     HI = 0;
 
-    // Open instruction file
-    FILE *fp;
-    fp = fopen(file, "rb");
+    // Any program pa2 can load, or an image. Raw words and hex text start at TEXT_BASE
+    struct program program;
+    const struct program_segment *text, *table;
 
-    // Check if file opened successfully
-    if (fp == NULL){
-        printf("Could not open instruction file %s.\n", file);
+    if (program_open(&program, file, TEXT_BASE)){
+        printf("Could not open instruction file %s: %s.\n", file, strerror(errno));
         exit(1);
     }
 
-    fseek(fp, 0L, SEEK_END);
-    int size = ftell(fp);
-    fseek(fp, 0L, SEEK_SET);
+    text = program_find(&program, IMAGE_SEGMENT_TEXT, -1);
+    if (!text){
+        trap("no room for the program");
+    }
+    load_text(&program, text);
 
-    if (size % 4 != 0){
-        trap("size must be a multiple of 4");
+    map_segment(SEGMENT_DATA, "data", DATA_BASE, DATA_SIZE, DATA_SIZE, 1);
+    for (int i = 0; i < program.nr_segments; i++){
+        const struct program_segment *data = &program.segments[i];
+
+        if (data->type != IMAGE_SEGMENT_DATA) continue;
+        if (data->vaddr < DATA_BASE || data->vaddr - DATA_BASE > DATA_SIZE || data->size > DATA_SIZE - (data->vaddr - DATA_BASE)){
+            trap("data does not fit the data segment");
+        }
+        memcpy(segments[SEGMENT_DATA].host + (data->vaddr - DATA_BASE), data->contents, data->size);
     }
-    // printf("Read in %d instructions.\n", size/4);
 
-    int *instruction = malloc(size);
-    // printf("Allocated %d bytes at %p.\n", size, instruction);
-    fread(instruction, 4, size/4, fp);
-    inst_p = instruction;
-    inst_max = inst_p + size/4;
+    // The decoded text stays in the mapping of the image, which is kept open
+    table = program_find(&program, IMAGE_SEGMENT_DECODED, text->vaddr);
+    if (table) decoded = table->contents;
 
-    base = instruction;
+    map_segment(SEGMENT_HEAP, "heap", DATA_BASE + DATA_SIZE, 0, HEAP_LIMIT, 1);
+    map_segment(SEGMENT_STACK, "stack", STACK_TOP - STACK_LIMIT, STACK_LIMIT, STACK_LIMIT, 1);
+    heap_break = segments[SEGMENT_HEAP].base;
+    flush_tlb();
 
-    registers[28] = (uintptr_t) base;
+    registers[28] = DATA_BASE + 0x8000; // gp
+    registers[29] = STACK_TOP - 4;      // sp
+    pc = program.entry;
 
     inst_loop();
 
+    exit_guest(0);
     return 0;
-}
\ No newline at end of file
+}
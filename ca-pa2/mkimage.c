@@ -0,0 +1,166 @@
+/**********************************************************************
+ * mkimage.c
+ *
+ * Convert a program that pa2 can load, such as hex text, into an image
+ * (see image.h). The contents of every segment start on an IMAGE_ALIGN
+ * boundary so that loaders can map them in place. With -d, a decoded
+ * segment follows each text segment.
+ *
+ *   mkimage [-d] [-a address] [-e entry] [-o output file] program file
+ **********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "image.h"
+#include "program.h"
+
+#define INITIAL_PC      0x1000       /* Where pa2 loads programs */
+
+static size_t __align(size_t offset)
+{
+    return (offset + IMAGE_ALIGN - 1) & ~(size_t)(IMAGE_ALIGN - 1);
+}
+
+/* The decoded segment of the @size bytes of instructions at @text */
+static unsigned char *__decode(const unsigned char *text, uint32_t size)
+{
+    unsigned char *decoded = malloc(size / 4 * IMAGE_DECODED_SIZE + 1);
+
+    if (!decoded) return NULL;
+
+    for (uint32_t i = 0; i < size / 4; i++) {
+        image_decode(decoded + i * IMAGE_DECODED_SIZE, image_load32(text + i * 4));
+    }
+    return decoded;
+}
+
+static int __write_image(FILE *file, const struct program *program, uint32_t entry, int decode)
+{
+    struct program_segment segments[PROGRAM_MAX_SEGMENTS];
+    unsigned char *decoded[PROGRAM_MAX_SEGMENTS] = { NULL };
+    unsigned char header[IMAGE_HEADER_SIZE + PROGRAM_MAX_SEGMENTS * IMAGE_SEGMENT_SIZE] = { 0 };
+    static const unsigned char zeros[IMAGE_ALIGN];
+    int nr_segments = 0;
+    size_t offset, written;
+    int ret = -1;
+
+    for (int i = 0; i < program->nr_segments; i++) {
+        const struct program_segment *segment = &program->segments[i];
+
+        /* Decoded segments are made afresh */
+        if (segment->type == IMAGE_SEGMENT_DECODED) continue;
+        segments[nr_segments++] = *segment;
+
+        if (!decode || segment->type != IMAGE_SEGMENT_TEXT) continue;
+        if (nr_segments == PROGRAM_MAX_SEGMENTS) {
+            errno = E2BIG;
+            goto out;
+        }
+        decoded[nr_segments] = __decode(segment->contents, segment->size);
+        if (!decoded[nr_segments]) goto out;
+
+        segments[nr_segments].type = IMAGE_SEGMENT_DECODED;
+        segments[nr_segments].vaddr = segment->vaddr;
+        segments[nr_segments].size = segment->size / 4 * IMAGE_DECODED_SIZE;
+        segments[nr_segments].contents = decoded[nr_segments];
+        nr_segments++;
+    }
+
+    image_store32(header + 0, IMAGE_MAGIC);
+    image_store32(header + 4, IMAGE_VERSION);
+    image_store32(header + 8, entry);
+    image_store32(header + 12, nr_segments);
+
+    offset = __align(IMAGE_HEADER_SIZE + nr_segments * IMAGE_SEGMENT_SIZE);
+    for (int i = 0; i < nr_segments; i++) {
+        unsigned char *p = header + IMAGE_HEADER_SIZE + i * IMAGE_SEGMENT_SIZE;
+
+        if (offset > UINT32_MAX) {
+            errno = EFBIG;
+            goto out;
+        }
+        image_store32(p + 0, segments[i].type);
+        image_store32(p + 4, segments[i].vaddr);
+        image_store32(p + 8, offset);
+        image_store32(p + 12, segments[i].size);
+        segments[i].offset = offset;
+        offset = __align(offset + segments[i].size);
+    }
+
+    written = IMAGE_HEADER_SIZE + nr_segments * IMAGE_SEGMENT_SIZE;
+    if (fwrite(header, 1, written, file) != written) goto out;
+
+    for (int i = 0; i < nr_segments; i++) {
+        size_t padding = segments[i].offset - written;
+
+        if (fwrite(zeros, 1, padding, file) != padding ||
+                fwrite(segments[i].contents, 1, segments[i].size, file) != segments[i].size) {
+            goto out;
+        }
+        written = segments[i].offset + segments[i].size;
+    }
+    ret = 0;
+
+out:
+    for (int i = 0; i < PROGRAM_MAX_SEGMENTS; i++) free(decoded[i]);
+    return ret;
+}
+
+int main(int argc, char * const argv[])
+{
+    struct program program;
+    uint32_t vaddr = INITIAL_PC, entry = 0;
+    const char *output_path = NULL;
+    int decode = 0, has_entry = 0;
+    FILE *output = stdout;
+    int opt, ret;
+
+    while ((opt = getopt(argc, argv, "a:de:o:")) != -1) {
+        switch (opt) {
+        case 'a':
+            vaddr = strtoimax(optarg, NULL, 0);
+            break;
+        case 'd':
+            decode = 1;
+            break;
+        case 'e':
+            entry = strtoimax(optarg, NULL, 0);
+            has_entry = 1;
+            break;
+        case 'o':
+            output_path = optarg;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (optind != argc - 1) goto usage;
+
+    if (program_open(&program, argv[optind], vaddr)) {
+        fprintf(stderr, "Cannot load %s: %s\n", argv[optind], strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if (!has_entry) entry = program.entry;
+
+    if (output_path && !(output = fopen(output_path, "wb"))) {
+        fprintf(stderr, "Cannot open %s\n", output_path);
+        program_close(&program);
+        return EXIT_FAILURE;
+    }
+
+    ret = __write_image(output, &program, entry, decode);
+    if (fflush(output) || ferror(output)) ret = -1;
+    if (ret) fprintf(stderr, "Cannot write the image: %s\n", strerror(errno));
+
+    if (output != stdout) fclose(output);
+    program_close(&program);
+    return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+
+usage:
+    fprintf(stderr, "Usage: %s [-d] [-a address] [-e entry] [-o output file] program file\n", argv[0]);
+    return EXIT_FAILURE;
+}
@@ -20,6 +20,14 @@
 #include <inttypes.h>
 #include <ctype.h>
 
+#include "cache.h"
+#include "isa.h"
+#include "line_source.h"
+#include "program.h"
+#include "simpoint.h"
+#include "snapshot.h"
+#include "tokenizer.h"
+
 /*====================================================================*/
 /*          ****** DO NOT MODIFY ANYTHING FROM THIS LINE ******       */
 
@@ -293,6 +301,10 @@ int process_i(i_instruction inst){
 //            *(memory + result+3) = registers[inst.rt]>>24;
             break;
 
+        case 0xf: // lui
+            registers[inst.rt] = (unsigned int)(unsigned short)inst.immediate << 16;
+            break;
+
         case 0xa: // slti
             registers[inst.rt] = (registers[inst.rs] < (short)inst.immediate); // signextimm
             break;
@@ -342,6 +354,7 @@ int process_i(i_instruction inst){
  * | `sw`   | i-format  | 0x2b                    |
  * | `slt`  | r-format* | 0 + 0x2a                |
  * | `slti` | i-format* | 0x0a                    |
+ * | `lui`  | i-format  | 0x0f                    |
  * | `beq`  | i-format* | 0x04                    |
  * | `bne`  | i-format* | 0x05                    |
  * | `jr`   | r-format* | 0 + 0x08                |
@@ -417,7 +430,11 @@ static int process_instruction(unsigned int instr)
  *     'halt' instruction is appended to the loaded instructions to terminate
  *     your program properly.
  *
- *     Refer to the @main() for reading data from files. (fopen, fgets, fclose).
+ *   The program may also be an image written by pa1 or mkimage, or raw
+ *   big-endian words as pa1 -f bin writes them. The format is told from the
+ *   contents of the file (see program.h), and the segments of an image are
+ *   copied to their own addresses straight from the mapping of the file.
+ *   An image also sets @pc to its entry point.
  *
  * RETURN
  *     0 on successfully load the program
@@ -426,25 +443,32 @@ static int process_instruction(unsigned int instr)
 
 static int load_program(char * const filename)
 {
-    char command[MAX_COMMAND] = {'\0'};
-    FILE* fp = fopen(filename, "r");
-    unsigned int ptr = INITIAL_PC;
-    unsigned int temp;
-    if(fp == NULL)
+    struct program program;
+    uint32_t text_end = INITIAL_PC;
+
+    if (program_open(&program, filename, INITIAL_PC)) {
+        printf("Cannot load %s: %s\n", filename, strerror(errno));
         return 1;
-    while (fgets(command, sizeof(command), fp)){
-        temp = strtoimax(command, NULL, 0);
-        *(memory + ptr) = (0xff000000 & temp) >> 24;
-        *(memory + ptr+1) = (0x00ff0000 & temp) >> 16;
-        *(memory + ptr+2) = (0x0000ff00 & temp) >> 8;
-        *(memory + ptr+3) = 0x000000ff & temp;
-//        printf("%x\n", strtoimax(command, NULL, 0));
-//        printf("%x\n", *((int*)(memory + ptr)));
-       // *((int*)(memory + ptr)) = temp;rh
-        ptr+=4;
     }
-    *((int*)(memory + ptr)) = 0xffffffff; // halt
-    fclose(fp);
+
+    for (int i = 0; i < program.nr_segments; i++) {
+        const struct program_segment *segment = &program.segments[i];
+
+        if (segment->type != IMAGE_SEGMENT_TEXT && segment->type != IMAGE_SEGMENT_DATA) continue;
+
+        /* Room for the halt after the text as well */
+        if (segment->vaddr > sizeof(memory) || segment->size > sizeof(memory) - 4 - segment->vaddr) {
+            printf("Cannot load %s: segment at 0x%08x does not fit in memory\n", filename, segment->vaddr);
+            program_close(&program);
+            return 1;
+        }
+        memcpy(memory + segment->vaddr, segment->contents, segment->size);
+        if (segment->type == IMAGE_SEGMENT_TEXT) text_end = segment->vaddr + segment->size;
+    }
+
+    *((int*)(memory + text_end)) = 0xffffffff; // halt
+    if (program.format == PROGRAM_IMAGE) pc = program.entry;
+    program_close(&program);
     return 0;
 }
 
@@ -492,6 +516,241 @@ static int run_program(void)
 }
 
 
+/**********************************************************************
+ * Detailed runs and sampling
+ *
+ * DESCRIPTION
+ *   run_program() is functional: it executes instructions and nothing
+ *   else. In detailed mode an instruction also goes through a timing
+ *   model: it is fetched through an I-cache, a load or a store goes
+ *   through a D-cache (both from cache.h, tracking tags only), and a
+ *   taken branch or jump flushes the pipeline for @BRANCH_PENALTY cycles.
+ *
+ *   "run detailed" runs all of the program in detailed mode. "sample" runs
+ *   it twice from the current state instead. The first run is functional
+ *   and profiles the basic block vector of each interval, and the
+ *   intervals are clustered (see simpoint.h). The second run
+ *   fast-forwards functionally to each chosen interval, warms the caches
+ *   up in detailed mode over the @warm-up instructions before it, and
+ *   then times it. Both leave the machine where run_program() would.
+ *
+ *     sample [interval] [warm-up] [max clusters] [samples per cluster]
+ */
+#define BRANCH_PENALTY          2
+#define SAMPLE_INTERVAL         10000
+#define SAMPLE_WARMUP           2000
+#define SAMPLE_MAX_CLUSTERS     8
+#define SAMPLE_PER_CLUSTER      3
+
+static struct cache_config icache_config = {
+    .nr_words_per_block = 4,
+    .nr_blocks = 64,
+    .nr_ways = 2,
+    .index_function = CACHE_INDEX_MODULO,
+    .cycles_hit = 1,        /* The cycle every instruction takes */
+    .cycles_miss = 20,
+};
+
+static struct cache_config dcache_config = {
+    .nr_words_per_block = 4,
+    .nr_blocks = 64,
+    .nr_ways = 4,
+    .index_function = CACHE_INDEX_MODULO,
+    .cycles_hit = 0,
+    .cycles_miss = 20,
+    .cycles_writeback = 20,
+};
+
+static struct cache *icache, *dcache;
+static struct arena timing_arena;
+
+/* The state to go back to for the second run of "sample" */
+static unsigned int saved_registers[32];
+static unsigned int saved_pc;
+static unsigned char saved_memory[sizeof(memory)];
+
+/* Start the caches afresh. Returns 0, or -1 if out of memory */
+static int __reset_timing(void)
+{
+    if (!timing_arena.base) {
+        size_t size = cache_footprint(&icache_config) + cache_footprint(&dcache_config);
+        void *buffer = malloc(size);
+
+        if (!buffer) return -1;
+        arena_init(&timing_arena, buffer, size);
+    }
+    arena_reset(&timing_arena);
+    icache = cache_create(&icache_config, &timing_arena);
+    dcache = cache_create(&dcache_config, &timing_arena);
+    return icache && dcache ? 0 : -1;
+}
+
+/* The instruction at @addr. Running off the end of memory[] halts */
+static inline unsigned int __fetch(unsigned int addr)
+{
+    if (addr > sizeof(memory) - 4) return 0xffffffff;
+    return (unsigned int)memory[addr] << 24 | memory[addr + 1] << 16 | memory[addr + 2] << 8 | memory[addr + 3];
+}
+
+/* Execute the instruction at @pc. Returns 0 at 'halt' */
+static inline int __step(void)
+{
+    unsigned int instr = __fetch(pc);
+
+    pc += 4;
+    return process_instruction(instr);
+}
+
+/* Execute the instruction at @pc in detailed mode. Returns the cycles it took, or 0 at 'halt' */
+static unsigned int __step_detailed(void)
+{
+    unsigned int addr = pc, instr = __fetch(pc);
+    unsigned int cycles = cache_access(icache, addr, 0, 0).latency;
+
+    if (opcode(instr) == 0x23 || opcode(instr) == 0x2b) {
+        unsigned int target = registers[rs(instr)] + (short)immediate(instr);
+        cycles += cache_access(dcache, target, opcode(instr) == 0x2b, 0).latency;
+    }
+
+    pc += 4;
+    if (!process_instruction(instr)) return 0;
+    if (pc != addr + 4) cycles += BRANCH_PENALTY;
+    return cycles;
+}
+
+static void __print_timing(const char *what, uint64_t nr_instructions, uint64_t cycles)
+{
+    fprintf(stderr, "%s: %" PRIu64 " instructions, %" PRIu64 " cycles, CPI %.4f\n", what,
+            nr_instructions, cycles, nr_instructions ? (double)cycles / nr_instructions : 0.0);
+    fprintf(stderr, "  I-cache %" PRIu64 " hits %" PRIu64 " misses, D-cache %" PRIu64 " hits %" PRIu64 " misses\n",
+            icache->stats.hits, icache->stats.misses, dcache->stats.hits, dcache->stats.misses);
+}
+
+static void __run_detailed(void)
+{
+    uint64_t nr_instructions = 0, cycles = 0;
+    unsigned int latency;
+
+    if (__reset_timing()) {
+        printf("Cannot set up the caches\n");
+        return;
+    }
+
+    while ((latency = __step_detailed())) {
+        cycles += latency;
+        nr_instructions++;
+    }
+    __print_timing("detailed", nr_instructions, cycles);
+}
+
+/* The first run of "sample". Returns 0, or -1 if out of memory */
+static int __profile(struct simpoint *simpoint)
+{
+    unsigned int block = pc;
+
+    for (;;) {
+        unsigned int addr = pc;
+
+        if (!__step()) return 0;
+        if (simpoint_count(simpoint, block)) return -1;
+        if (pc != addr + 4) block = pc;
+    }
+}
+
+/* The second run of "sample": time @samples. Returns the instructions run in detailed mode */
+static uint64_t __run_samples(struct simpoint_sample *samples, int nr_samples, uint64_t warmup,
+        uint64_t *nr_warmup)
+{
+    uint64_t nr_run = 0, nr_detailed = 0;
+    int halted = 0;
+
+    for (int i = 0; i < nr_samples && !halted; i++) {
+        struct simpoint_sample *sample = &samples[i];
+        uint64_t cycles = 0, nr_timed = 0;
+        unsigned int latency = 1;
+
+        while (!halted && nr_run + warmup < sample->start) {
+            halted = !__step();
+            nr_run++;
+        }
+        while (!halted && nr_run < sample->start) {
+            halted = !__step_detailed();
+            nr_run++;
+            (*nr_warmup)++;
+        }
+        while (!halted && nr_timed < sample->length && (latency = __step_detailed())) {
+            cycles += latency;
+            nr_timed++;
+        }
+        if (!latency) halted = 1;
+
+        sample->cpi = nr_timed ? (double)cycles / nr_timed : 0;
+        nr_run += nr_timed;
+        nr_detailed += nr_timed;
+    }
+
+    while (!halted && __step());
+    return nr_detailed;
+}
+
+static void __sample(uint64_t interval, uint64_t warmup, int max_clusters, int per_cluster)
+{
+    struct simpoint simpoint;
+    struct simpoint_sample *samples = NULL;
+    uint64_t nr_detailed, nr_warmup = 0;
+    int nr_samples;
+    double cpi, error;
+
+    memcpy(saved_registers, registers, sizeof(registers));
+    saved_pc = pc;
+    memcpy(saved_memory, memory, sizeof(memory));
+
+    simpoint_init(&simpoint, interval);
+    if (__profile(&simpoint) || __reset_timing()) {
+        printf("Out of memory while profiling\n");
+        goto out;
+    }
+
+    simpoint_cluster(&simpoint, max_clusters);
+    nr_samples = simpoint_choose(&simpoint, per_cluster, &samples);
+    if (nr_samples < 0) {
+        printf("Out of memory while choosing the samples\n");
+        goto out;
+    }
+
+    memcpy(registers, saved_registers, sizeof(registers));
+    pc = saved_pc;
+    memcpy(memory, saved_memory, sizeof(memory));
+
+    nr_detailed = __run_samples(samples, nr_samples, warmup, &nr_warmup);
+    cpi = simpoint_estimate(&simpoint, samples, nr_samples, &error);
+
+    fprintf(stderr, "profiled: %" PRIu64 " instructions in %" PRIu64 " intervals of %" PRIu64 "\n",
+            simpoint.nr_instructions, simpoint.nr_intervals, simpoint.interval_length);
+    fprintf(stderr, "detailed: %" PRIu64 " instructions in %d samples (%.1f%%), %" PRIu64 " warming up\n",
+            nr_detailed, nr_samples,
+            simpoint.nr_instructions ? 100.0 * nr_detailed / simpoint.nr_instructions : 0.0, nr_warmup);
+    for (int c = 0; c < simpoint.nr_clusters; c++) {
+        fprintf(stderr, "  cluster %d:", c);
+        for (int i = 0; i < nr_samples; i++) {
+            if (samples[i].cluster == c) fprintf(stderr, " %" PRIu64 " (CPI %.4f)", samples[i].interval, samples[i].cpi);
+        }
+        fprintf(stderr, "\n");
+    }
+    if (error >= 0) {
+        fprintf(stderr, "estimated: CPI %.4f +- %.4f (95%%), %.0f cycles\n", cpi, 1.96 * error,
+                cpi * simpoint.nr_instructions);
+    } else {
+        fprintf(stderr, "estimated: CPI %.4f, %.0f cycles, no error estimate with one sample per cluster\n", cpi,
+                cpi * simpoint.nr_instructions);
+    }
+
+out:
+    free(samples);
+    simpoint_free(&simpoint);
+}
+
+
 /*====================================================================*/
 
 //#define INPUT_ASSEMBLY if(argv[0] == add ||\
@@ -538,339 +797,13 @@ static int run_program(void)
                         jal || \
                         halt
 
-// Struct that stores registers and their respective binary reference
-struct {
-    const char *name;
-    char *address;
-} registerMap[] = {
-        //{ "zero", "00000" },
-        { "zr", "00000" },
-        { "at", "00001" },
-        { "v0", "00010" },
-        { "v1", "00011" },
-        { "a0", "00100" },
-        { "a1", "00101" },
-        { "a2", "00110" },
-        { "a3", "00111" },
-        { "t0", "01000" },
-        { "t1", "01001" },
-        { "t2", "01010" },
-        { "t3", "01011" },
-        { "t4", "01100" },
-        { "t5", "01101" },
-        { "t6", "01110" },
-        { "t7", "01111" },
-        { "s0", "10000" },
-        { "s1", "10001" },
-        { "s2", "10010" },
-        { "s3", "10011" },
-        { "s4", "10100" },
-        { "s5", "10101" },
-        { "s6", "10110" },
-        { "s7", "10111" },
-        { "t8", "11000" },
-        { "t9", "11001" },
-        { "k1", "11010" },
-        { "k2", "11011" },
-        { "gp", "11100" },
-        { "sp", "11101" },
-        { "fp", "11110" },
-        { "ra", "11111" },
-        { NULL, 0 }
-    
-};
-// Struct for R-Type instructions mapping for the 'function' field in the instruction
-struct {
-    const char *name;
-    char *function;
-} rMap[] = {
-        { "add", "100000" },
-        { "sub", "100010" },
-        { "and", "100100" },
-        { "or" , "100101" },
-        { "nor", "100111" },
-        { "sll", "000000" },
-        { "sra", "000011" },
-        { "srl", "000010" },
-        { "slt", "101010" },
-        { "jr" , "001000" },
-        { NULL, 0 }
-};
-
-// Struct for I-Type instructions
-struct {
-    const char *name;
-    char *address; //=> opcode
-} iMap[] = {
-        { "lw"  , "100011" },
-        { "sw"  , "101011" },
-        { "andi", "001100" },
-        { "ori" , "001101" },
-        { "addi", "001000" },
-        { "slti", "001010" },
-        { "beq" , "000100" },
-        { "bne" , "000101" },
-        { NULL, 0 }
-};
-
-// Struct for J-Type instructions
-struct {
-    const char *name;
-    char *opcode;
-} jMap[] = {
-        { "j"  , "000010" },
-        { "jal", "000011" },
-        { NULL, 0 }
-};
-
-int checkAssembly(char* instruction)
+/* Returns 0 after putting the instruction in @word, or -1 if it cannot be encoded */
+static int translate(int nr_tokens, char *tokens[], unsigned int *word)
 {
-    if (strcmp(instruction, "add") == 0 || strcmp(instruction, "sub") == 0 || strcmp(instruction, "and") == 0 || strcmp(instruction, "or") == 0 || strcmp(instruction, "sll") == 0 || strcmp(instruction,"nor") == 0 || strcmp(instruction, "srl") == 0 || strcmp(instruction, "sra") == 0|| strcmp(instruction, "slt") == 0 || strcmp(instruction, "jr") == 0 || strcmp(instruction, "lw") == 0 || strcmp(instruction, "sw") == 0|| strcmp(instruction, "andi") == 0 || strcmp(instruction, "ori")== 0 || strcmp(instruction, "addi") == 0|| strcmp(instruction, "slti") == 0 || strcmp(instruction, "beq") == 0 || strcmp(instruction, "bne") == 0 || strcmp(instruction, "j") == 0 || strcmp(instruction, "jal")==0)
-        return 1;
-    else
-        return 0;
-}
-
-char instruction_type(char *instruction) {
-
-    if (strcmp(instruction, "add") == 0 || strcmp(instruction, "sub") == 0
-            || strcmp(instruction, "and") == 0 || strcmp(instruction, "or")
-            == 0 || strcmp(instruction, "sll") == 0 || strcmp(instruction,
-            "nor") == 0 || strcmp(instruction, "srl") == 0 || strcmp(
-            instruction, "sra") == 0|| strcmp(instruction, "slt") == 0 || strcmp(instruction, "jr") == 0 ) {
-
-        return 'r';
-    }
-
-    else if (strcmp(instruction, "lw") == 0 || strcmp(instruction, "sw") == 0
-            || strcmp(instruction, "andi") == 0 || strcmp(instruction, "ori")
-            == 0 || strcmp(instruction, "addi") == 0|| strcmp(instruction, "slti") == 0 || strcmp(instruction, "beq") == 0 || strcmp(instruction, "bne") == 0 ) {
+    int bad = isa_translate(nr_tokens, tokens, word);
 
-        return 'i';
-    }
-    else if(strcmp(instruction, "j") == 0 || strcmp(instruction, "jal") == 0){
-        return 'j';
-    }
-    return 0;
-}
-void getBin(int num, char *str, int padding) {
-
-    *(str + padding) = '\0';
-
-    long pos;
-    if (padding == 5)
-        pos = 0x10;
-    else if (padding == 16)
-        pos = 0x8000;
-    else if (padding == 26)
-        pos = 0x2000000;
-    else if (padding == 32)
-            pos = 0x80000000;
-
-    long mask = pos;
-    while (mask){         // 이해 잘 안감.....
-        *str++ = !!(mask & num) + '0';
-        mask >>= 1;
-    }
-}
-
-// Return the binary representation of the register
-char *register_address(char *registerName) {
-
-    size_t i;
-    for (i = 0; registerMap[i].name != NULL; i++) {
-        if (strcmp(registerName, registerMap[i].name) == 0) {
-            return registerMap[i].address;
-        }
-    }
-    return NULL;
-}
-
-// Write out the R-Type instruction
-unsigned int rtype_instruction(char *instruction, char *rs, char *rt, char *rd, int shamt) {
-
-    long instcode;
-    unsigned int code32;
-    char* endptr;
-    // Set the instruction bits
-    char *opcode = "000000";
-    
-    char *rdBin = "00000"; // 0초기화
-    if (strcmp(rd, "00000") != 0)
-        rdBin = register_address(rd);
-
-    char *rsBin = "00000";
-    if (strcmp(rs, "00000") != 0)
-        rsBin = register_address(rs);
-
-    char *rtBin = "00000";
-    if (strcmp(rt, "00000") != 0)
-        rtBin = register_address(rt);
-
-    char *func = NULL;
-    char shamtBin[6];
-
-    // Convert shamt to binary and put in shamtBin as a char*
-    getBin(shamt, shamtBin, 5);
-
-    size_t i;
-    for (i = 0; rMap[i].name != NULL; i++) {
-        if (strcmp(instruction, rMap[i].name) == 0) {
-            func = rMap[i].function;
-        }
-    }
-
-    // Print out the instruction to the file
-    //printf("%s%s%s%s%s%s\n", opcode, rsBin, rtBin, rdBin, shamtBin, func);
-    
-    instcode = strtoimax(opcode, &endptr, 2);
-    code32 = (instcode & 0x3f) << 26;
-    instcode = strtoimax(rsBin, &endptr, 2);
-    code32 |= (instcode & 0x1f) << 21;
-    instcode = strtoimax(rtBin, &endptr, 2);
-    code32 |= (instcode & 0x1f) << 16;
-    instcode = strtoimax(rdBin, &endptr, 2);
-    code32 |= (instcode & 0x1f) << 11;
-    instcode = strtoimax(shamtBin, &endptr, 2);
-    code32 |= (instcode & 0x1f) << 6;
-    instcode = strtoimax(func, &endptr, 2);
-    code32 |= (instcode & 0x3f);
-
-    
-    return code32;
-}
-
-// Write out the I-Type instruction
-unsigned int itype_instruction(char *instruction, char *rs, char *rt, int immediateNum) {
-
-    long instcode;
-    unsigned int code32;
-    char* endptr;
-    // Set the instruction bits
-    char *rsBin = "00000";
-    if (strcmp(rs, "00000") != 0)
-        rsBin = register_address(rs);
-
-    char *rtBin = "00000";
-        if (strcmp(rt, "00000") != 0)
-            rtBin = register_address(rt);
-
-    char *opcode = NULL;
-    char immediate[17];
-
-    size_t i;
-    for (i = 0; iMap[i].name != NULL; i++) {
-        if (strcmp(instruction, iMap[i].name) == 0) {
-            opcode = iMap[i].address;
-        }
-    }
-
-    // Convert immediate to binary
-    getBin(immediateNum, immediate, 16);
-
-    // Print out the instruction to the file
-    //printf("%s%s%s%s\n", opcode, rsBin, rtBin, immediate);
-    instcode = strtoimax(opcode, &endptr, 2);
-    code32 = (instcode & 0x3f) << 26;
-    instcode = strtoimax(rsBin, &endptr, 2);
-    code32 |= (instcode & 0x1f) << 21;
-    instcode = strtoimax(rtBin, &endptr, 2);
-    code32 |= (instcode & 0x1f) << 16;
-    instcode = strtoimax(immediate, &endptr, 2);
-    code32 |= (instcode & 0xffff);
-    
-    return code32;
-}
-
-unsigned int jtype_instruction(char *instruction, int address) {
-
-    long instcode;
-    char *opcode = NULL;
-    char* endptr;
-    unsigned int code32;
-
-    size_t i;
-    for (i = 0; jMap[i].name != NULL; i++) {
-        if (strcmp(instruction, jMap[i].name) == 0) {
-            opcode = jMap[i].opcode;
-        }
-    }
-//    char addressBin[27];
-//    getBin(address, addressBin, 26);
-//
-//    instcode = strtoimax(opcode, &endptr, 2);
-//    code32 = (instcode & 0x3f) << 26;
-//
-//    instcode = strtoimax(addressBin, &endptr, 2);
-//    instcode = instcode>>2;
-//    code32 |= instcode;
-//    return code32;
-    char addressBin[33];
-    getBin(address, addressBin, 32);
-    
-    instcode = strtoimax(opcode, &endptr, 2);
-    code32 = (instcode & 0x3f) << 26;
-
-    instcode = strtoimax(addressBin, &endptr, 2);
-    instcode = instcode & 0x0fffffff;
-    instcode = instcode>>2;
-    code32 |= instcode;
-    return code32;
-}
-
-static unsigned int translate(int nr_tokens, char *tokens[])
-{
-    /* TODO:
-     * This is an example MIPS instruction. You should change it accordingly.
-     */
-    unsigned int code32 =0;
-    char inst_type;
-    char* token = tokens[0];
-    char* endptr;
-    inst_type = instruction_type(token);
-    
-    if(inst_type == 'r')
-    {
-        // R-Type with $rd, $rs, $rt format
-        if (strcmp(token, "add") == 0 || strcmp(token, "sub") == 0|| strcmp(token, "and") == 0|| strcmp(token, "or") == 0 || strcmp(token, "nor") == 0 || strcmp(token, "slt") == 0){
-          code32 = rtype_instruction(tokens[0], tokens[2], tokens[3], tokens[1], 0);
-        }
-        // R-Type with $rd, $rt, shamt format
-        else if (strcmp(token, "sll") == 0 || strcmp(token, "srl") == 0|| strcmp(token, "sra") == 0){
-            //shamt가 16진수로 들어올 경우를 처리
-            if(strncmp(tokens[3], "0x", 2) == 0 || strncmp(tokens[3], "-0x", 3) == 0){
-                code32 = rtype_instruction(tokens[0], "00000", tokens[2], tokens[1], (int)(strtoimax(tokens[3], &endptr, 0)));
-            }                                     // rs가 없음 -> 0
-            else{ //shamt가 정수일 경우
-                code32 = rtype_instruction(tokens[0], "00000", tokens[2], tokens[1], atoi(tokens[3]));
-            }
-        }
-        else // jr
-        {
-            code32 = rtype_instruction(tokens[0], tokens[1], "00000", "00000", 0);
-
-        }
-    }
-    else if (inst_type == 'i')
-    {
-        //address가 16진수로 들어올 경우를 처리
-        if(strncmp(tokens[3], "0x", 2) == 0 || strncmp(tokens[3], "-0x", 3) == 0){
-            code32 = itype_instruction(tokens[0], tokens[2], tokens[1], (int)(strtoimax(tokens[3], &endptr, 0)));
-        }
-        else{        //address가 정수로 들어올 경우를 처리
-            code32 = itype_instruction(tokens[0], tokens[2], tokens[1], atoi(tokens[3]));
-        }
-    }
-    else if (inst_type == 'j')
-    {
-        code32 = jtype_instruction(tokens[0], (int)(strtoimax(tokens[1], &endptr, 0)));
-    }
-    else if (!strcmp(token, "halt"))
-    {
-        // code32 = 0xffffffff
-        return 0xffffffff;
-    }
-    return code32;
+    if (bad > 0) printf("Unknown register %s\n", tokens[bad]);
+    return bad ? -1 : 0;
 }
 
 /*====================================================================*/
@@ -917,6 +850,55 @@ static void __dump_memory(unsigned int addr, size_t length)
     }
 }
 
+static void __disassemble_memory(unsigned int addr, size_t length)
+{
+    char text[ISA_DISASM_MAX];
+
+    for (size_t i = 0; i < length && addr + i + 4 <= sizeof(memory); i += 4) {
+        unsigned int word = memory[addr + i] << 24 | memory[addr + i + 1] << 16 |
+                            memory[addr + i + 2] << 8 | memory[addr + i + 3];
+
+        isa_disassemble(word, addr + i, text);
+        fprintf(stderr, "0x%08lx:  %08x    %s\n", addr + i, word, text);
+    }
+}
+
+/* What memory[] holds before any command, which snapshots are taken against */
+static unsigned char pristine_memory[sizeof(memory)];
+
+static void __snapshot_state(struct snapshot_state *state)
+{
+    state->registers = registers;
+    state->nr_registers = sizeof(registers) / sizeof(*registers);
+    state->pc = &pc;
+    state->memory = memory;
+    state->pristine = pristine_memory;
+    state->size = sizeof(memory);
+}
+
+static void __checkpoint(const char *filename)
+{
+    struct snapshot_state state;
+    int nr_pages;
+
+    __snapshot_state(&state);
+    nr_pages = snapshot_save(filename, &state);
+    if (nr_pages < 0) {
+        printf("Cannot checkpoint to %s: %s\n", filename, strerror(errno));
+    }
+}
+
+static void __restore(const char *filename)
+{
+    struct snapshot_state state;
+
+    __snapshot_state(&state);
+    if (snapshot_restore(filename, &state) < 0) {
+        printf("Cannot restore from %s: %s\n", filename,
+                errno == EINVAL ? "Not a snapshot of this machine" : strerror(errno));
+    }
+}
+
 static void __process_command(int argc, char *argv[])
 {
     if (argc == 0) return;
@@ -930,8 +912,19 @@ static void __process_command(int argc, char *argv[])
     } else if (strmatch(argv[0], "run")) {
         if (argc == 1) {
             run_program();
+        } else if (argc == 2 && strmatch(argv[1], "detailed")) {
+            __run_detailed();
+        } else {
+            printf("Usage: run { detailed }\n");
+        }
+    } else if (strmatch(argv[0], "sample")) {
+        if (argc <= 5) {
+            __sample(argc > 1 ? strtoimax(argv[1], NULL, 0) : SAMPLE_INTERVAL,
+                     argc > 2 ? strtoimax(argv[2], NULL, 0) : SAMPLE_WARMUP,
+                     argc > 3 ? strtoimax(argv[3], NULL, 0) : SAMPLE_MAX_CLUSTERS,
+                     argc > 4 ? strtoimax(argv[4], NULL, 0) : SAMPLE_PER_CLUSTER);
         } else {
-            printf("Usage: run\n");
+            printf("Usage: sample { [interval] [warm-up] [max clusters] [samples per cluster] }\n");
         }
     } else if (strmatch(argv[0], "show")) {
         if (argc == 1) {
@@ -947,16 +940,34 @@ static void __process_command(int argc, char *argv[])
         } else {
             printf("Usage: dump [start address] [length]\n");
         }
+    } else if (strmatch(argv[0], "disasm")) {
+        if (argc == 3) {
+            __disassemble_memory(strtoimax(argv[1], NULL, 0), strtoimax(argv[2], NULL, 0));
+        } else {
+            printf("Usage: disasm [start address] [length]\n");
+        }
+    } else if (strmatch(argv[0], "checkpoint")) {
+        if (argc == 2) {
+            __checkpoint(argv[1]);
+        } else {
+            printf("Usage: checkpoint [snapshot filename]\n");
+        }
+    } else if (strmatch(argv[0], "restore")) {
+        if (argc == 2) {
+            __restore(argv[1]);
+        } else {
+            printf("Usage: restore [snapshot filename]\n");
+        }
     } else {
         /**
          * You may hook up @translate() from pa1 here to allow assembly input!
          */
         
 //#ifdef INPUT_ASSEMBLY
-        if(checkAssembly(argv[0]))
+        if(isa_find_instruction(argv[0]))
         {
-            unsigned int instr = translate(argc, argv);
-            process_instruction(instr);
+            unsigned int instr;
+            if (translate(argc, argv, &instr) == 0) process_instruction(instr);
         }
         else
             process_instruction(strtoimax(argv[0], NULL, 0));
@@ -968,49 +979,27 @@ static void __process_command(int argc, char *argv[])
 
 static int __parse_command(char *command, int *nr_tokens, char *tokens[])
 {
-    char *curr = command;
-    int token_started = false;
-    *nr_tokens = 0;
-
-    while (*curr != '\0') {
-        if (isspace(*curr)) {
-            *curr = '\0';
-            token_started = false;
-        } else {
-            if (!token_started) {
-                tokens[*nr_tokens] = curr;
-                *nr_tokens += 1;
-                token_started = true;
-            }
-        }
-        curr++;
-    }
-
-    /* Exclude comments from tokens */
-    for (int i = 0; i < *nr_tokens; i++) {
-        if (strmatch(tokens[i], "//") || strmatch(tokens[i], "#")) {
-            *nr_tokens = i;
-            tokens[i] = NULL;
-        }
-    }
+    static const struct tokenizer tokenizer =
+        TOKENIZER(TOKENIZER_WHITESPACE,
+                  TOKENIZER_HASH_COMMENTS | TOKENIZER_SLASH_COMMENTS | TOKENIZER_FOLD_CASE);
 
+    *nr_tokens = tokenize(&tokenizer, command, tokens, MAX_NR_TOKENS);
     return 0;
 }
 
 int main(int argc, char * const argv[])
 {
-    char command[MAX_COMMAND] = {'\0'};
-    FILE *input = stdin;
-
-    if (argc > 1) {
-        input = fopen(argv[1], "r");
-        if (!input) {
-            fprintf(stderr, "No input file %s\n", argv[0]);
-            return EXIT_FAILURE;
-        }
+    struct line_source input;
+    char *command;
+
+    memcpy(pristine_memory, memory, sizeof(memory));
+
+    if (line_source_open(&input, argc > 1 ? argv[1] : NULL)) {
+        fprintf(stderr, "No input file %s\n", argv[1]);
+        return EXIT_FAILURE;
     }
 
-    if (input == stdin) {
+    if (argc == 1) {
         printf("*********************************************************\n");
         printf("*          >> SCE212 MIPS Simulator v0.01 <<            *\n");
         printf("*                                                       *\n");
@@ -1026,23 +1015,19 @@ int main(int argc, char * const argv[])
         printf(">> ");
     }
 
-    while (fgets(command, sizeof(command), input)) {
+    while ((command = line_source_next(&input, NULL))) {
         char *tokens[MAX_NR_TOKENS] = { NULL };
         int nr_tokens = 0;
 
-        for (size_t i = 0; i < strlen(command); i++) {
-            command[i] = tolower(command[i]);
-        }
-
         if (__parse_command(command, &nr_tokens, tokens) < 0)
             continue;
 
         __process_command(nr_tokens, tokens);
 
-        if (input == stdin) printf(">> ");
+        if (argc == 1) printf(">> ");
     }
 
-    if (input != stdin) fclose(input);
+    line_source_close(&input);
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,51 @@
+/**********************************************************************
+ * arena.h
+ *
+ * A bump allocator over a caller-supplied buffer. Allocations are carved
+ * out of the buffer in order and are released all at once by
+ * arena_reset(). Nothing is ever returned to malloc().
+ **********************************************************************/
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+
+#define ARENA_ALIGN    16    /* Alignment of every allocation */
+
+struct arena {
+    unsigned char *base;
+    size_t size;
+    size_t used;
+};
+
+/* Size that an allocation of @size bytes takes up in an arena */
+static inline size_t arena_aligned(size_t size)
+{
+    return (size + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1);
+}
+
+static inline void arena_init(struct arena *arena, void *buffer, size_t size)
+{
+    arena->base = buffer;
+    arena->size = size;
+    arena->used = 0;
+}
+
+/* Returns @size bytes from @arena, or NULL if the arena is exhausted */
+static inline void *arena_alloc(struct arena *arena, size_t size)
+{
+    void *p;
+
+    if (arena->size - arena->used < arena_aligned(size)) return NULL;
+
+    p = arena->base + arena->used;
+    arena->used += arena_aligned(size);
+    return p;
+}
+
+static inline void arena_reset(struct arena *arena)
+{
+    arena->used = 0;
+}
+
+#endif
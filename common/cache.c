@@ -0,0 +1,349 @@
+/**********************************************************************
+ * cache.c
+ *
+ * The cache simulator core. See cache.h for the interface.
+ **********************************************************************/
+#include <string.h>
+
+#include "cache.h"
+
+const char * const cache_index_function_names[NR_CACHE_INDEX_FUNCTIONS] = {
+    "modulo", "xor", "prime", "skew",
+};
+
+/* Returns the integer part of log_2(@n) */
+static int log2_discrete(int n)
+{
+    int result = -1;
+    do {
+        n = n >> 1;
+        result++;
+    } while (n);
+
+    return result;
+}
+
+static int is_power_of_2(int n)
+{
+    return n > 0 && (n & (n - 1)) == 0;
+}
+
+static int largest_prime_upto(int n)
+{
+    for (int p = n; p > 2; p--) {
+        int prime = 1;
+        for (int d = 2; d * d <= p; d++) {
+            if (p % d == 0) {
+                prime = 0;
+                break;
+            }
+        }
+        if (prime) return p;
+    }
+    return n < 2 ? 1 : 2;
+}
+
+
+/**********************************************************************
+ * Set index functions
+ *
+ * DESCRIPTION
+ *   Let s be log2(nr_sets), low the lower s bits of the block address and
+ *   tag the remaining upper bits.
+ *
+ *   - modulo: low. Plain block_address % nr_sets
+ *   - xor:    low ^ every s-bit chunk of tag. Folds all the tag bits into
+ *             the index so that power-of-two strides spread over the sets
+ *   - prime:  block_address % p where p is the largest prime <= nr_sets.
+ *             The tag is block_address / p, and nr_sets - p sets stay unused
+ *   - skew:   low ^ h(tag, way). Skewed associativity; each way is a bank
+ *             indexed by its own hash, so blocks conflicting in one way are
+ *             likely to be apart in the others
+ *
+ *   Every function is invertible given the tag, so
+ *   cache_block_address_of() reconstructs the address of a dirty block for
+ *   the write-back.
+ */
+static unsigned int xor_fold(const struct cache *cache, unsigned int tag)
+{
+    int bits = log2_discrete(cache->nr_sets);
+    unsigned int folded = 0;
+
+    if (bits == 0) return 0;
+
+    for (; tag; tag >>= bits) {
+        folded ^= tag;
+    }
+    return folded % cache->nr_sets;
+}
+
+static unsigned int skew_hash(const struct cache *cache, unsigned int tag, int way)
+{
+    if (cache->nr_sets == 1) return 0;
+
+    return ((tag + way) * 0x9e3779b1u) >> (32 - log2_discrete(cache->nr_sets));
+}
+
+unsigned int cache_tag_of(const struct cache *cache, unsigned int block_address)
+{
+    if (cache->config.index_function == CACHE_INDEX_PRIME) {
+        return block_address / cache->nr_prime_sets;
+    }
+    return block_address / cache->nr_sets;
+}
+
+int cache_index_of(const struct cache *cache, unsigned int block_address, int way)
+{
+    unsigned int low = block_address % cache->nr_sets;
+    unsigned int tag = cache_tag_of(cache, block_address);
+
+    switch (cache->config.index_function) {
+    case CACHE_INDEX_XOR:
+        return low ^ xor_fold(cache, tag);
+    case CACHE_INDEX_PRIME:
+        return block_address % cache->nr_prime_sets;
+    case CACHE_INDEX_SKEW:
+        return (low ^ skew_hash(cache, tag, way)) % cache->nr_sets;
+    default:
+        return low;
+    }
+}
+
+unsigned int cache_block_address_of(const struct cache *cache, unsigned int tag, int index, int way)
+{
+    int nr_sets = cache->nr_sets;
+
+    switch (cache->config.index_function) {
+    case CACHE_INDEX_XOR:
+        return tag * nr_sets + (index ^ xor_fold(cache, tag));
+    case CACHE_INDEX_PRIME:
+        return tag * cache->nr_prime_sets + index;
+    case CACHE_INDEX_SKEW:
+        return tag * nr_sets + ((index ^ skew_hash(cache, tag, way)) % nr_sets);
+    default:
+        return tag * nr_sets + index;
+    }
+}
+
+
+/**********************************************************************
+ * cache_footprint
+ *
+ * DESCRIPTION
+ *   Return the number of bytes cache_create() takes from the arena for
+ *   @config.
+ */
+size_t cache_footprint(const struct cache_config *config)
+{
+    size_t size = arena_aligned(sizeof(struct cache));
+
+    size += arena_aligned(config->nr_blocks * sizeof(struct cache_block));
+    if (config->memory) {
+        size += arena_aligned((size_t)config->nr_blocks *
+                BYTES_PER_WORD * config->nr_words_per_block);
+    }
+    if (config->dram) {
+        size += arena_aligned(config->dram_nr_banks * sizeof(unsigned int));
+    }
+    return size;
+}
+
+
+/**********************************************************************
+ * cache_create
+ *
+ * DESCRIPTION
+ *   Build a cache described by @config in @arena. The number of blocks, the
+ *   number of ways and the words per block must be powers of 2.
+ *
+ * RETURN
+ *   The new cache, or NULL if @config is invalid or @arena has less than
+ *   cache_footprint(@config) bytes left.
+ */
+struct cache *cache_create(const struct cache_config *config, struct arena *arena)
+{
+    struct cache *cache;
+    unsigned char *data = NULL;
+
+    if (!is_power_of_2(config->nr_blocks) || !is_power_of_2(config->nr_ways) ||
+            !is_power_of_2(config->nr_words_per_block) ||
+            config->nr_ways > config->nr_blocks ||
+            config->nr_words_per_block > MAX_NR_WORDS_PER_BLOCK ||
+            config->index_function < 0 ||
+            config->index_function >= NR_CACHE_INDEX_FUNCTIONS ||
+            (config->dram && (config->dram_row_size <= 0 || config->dram_nr_banks <= 0))) {
+        return NULL;
+    }
+    if (arena->size - arena->used < cache_footprint(config)) return NULL;
+
+    cache = arena_alloc(arena, sizeof(*cache));
+    cache->config = *config;
+    cache->nr_sets = config->nr_blocks / config->nr_ways;
+    cache->nr_prime_sets = largest_prime_upto(cache->nr_sets);
+    cache->block_size = BYTES_PER_WORD * config->nr_words_per_block;
+    cache->lru_clock = 0;
+    memset(&cache->stats, 0, sizeof(cache->stats));
+
+    cache->blocks = arena_alloc(arena, config->nr_blocks * sizeof(struct cache_block));
+    if (config->memory) {
+        data = arena_alloc(arena, (size_t)config->nr_blocks * cache->block_size);
+        memset(data, 0x00, (size_t)config->nr_blocks * cache->block_size);
+    }
+    for (int i = 0; i < config->nr_blocks; i++) {
+        struct cache_block *c = cache->blocks + i;
+
+        c->valid = CB_INVALID;
+        c->dirty = CB_CLEAN;
+        c->tag = 0;
+        c->timestamp = 0;
+        c->data = data ? data + (size_t)i * cache->block_size : NULL;
+    }
+
+    cache->dram_open_rows = NULL;
+    if (config->dram) {
+        cache->dram_open_rows = arena_alloc(arena, config->dram_nr_banks * sizeof(unsigned int));
+        memset(cache->dram_open_rows, 0xff, config->dram_nr_banks * sizeof(unsigned int));
+    }
+
+    return cache;
+}
+
+
+/* Returns the slot in @cache->blocks holding @block_address, or -1 */
+static int lookup(struct cache *cache, unsigned int block_address)
+{
+    unsigned int tag = cache_tag_of(cache, block_address);
+    int nr_ways = cache->config.nr_ways;
+
+    for (int i = 0; i < nr_ways; i++) {
+        int slot = cache_index_of(cache, block_address, i) * nr_ways + i;
+        struct cache_block *c = cache->blocks + slot;
+
+        if (c->valid && c->tag == tag) return slot;
+    }
+    return -1;
+}
+
+/* Returns the slot to place @block_address; an invalid one or the LRU one */
+static int find_victim(struct cache *cache, unsigned int block_address)
+{
+    int nr_ways = cache->config.nr_ways;
+    int victim = -1;
+
+    for (int i = 0; i < nr_ways; i++) {
+        int slot = cache_index_of(cache, block_address, i) * nr_ways + i;
+        struct cache_block *c = cache->blocks + slot;
+
+        if (!c->valid) return slot;
+
+        if (victim < 0 || c->timestamp < cache->blocks[victim].timestamp) {
+            victim = slot;
+        }
+    }
+    return victim;
+}
+
+/* Returns the cycles to access the memory block at @byte_address */
+static unsigned int memory_latency(struct cache *cache, unsigned int byte_address, unsigned int cycles)
+{
+    unsigned int row, *open_row;
+
+    if (!cache->config.dram) return cycles;
+
+    row = byte_address / cache->config.dram_row_size;
+    open_row = cache->dram_open_rows + row % cache->config.dram_nr_banks;
+
+    if (*open_row == row) {
+        cache->stats.row_hits++;
+        return cache->config.cycles_row_hit;
+    }
+    cache->stats.row_misses++;
+    *open_row = row;
+    return cache->config.cycles_row_miss;
+}
+
+/* Evicts the block in @slot, writing it back if dirty, and fills it with @block_address */
+static void fill(struct cache *cache, unsigned int block_address, int slot, struct cache_cost *cost)
+{
+    const struct cache_config *config = &cache->config;
+    struct cache_block *c = cache->blocks + slot;
+    int block_size = cache->block_size;
+
+    if (c->valid && c->dirty) {
+        unsigned int victim = cache_block_address_of(cache, c->tag,
+                slot / config->nr_ways, slot % config->nr_ways);
+
+        if (c->data) {
+            memcpy(config->memory + (size_t)victim * block_size, c->data, block_size);
+        }
+        cost->writeback = memory_latency(cache, victim * block_size, config->cycles_writeback);
+        cache->stats.dirty_misses++;
+    } else {
+        cache->stats.clean_misses++;
+    }
+
+    c->valid = CB_VALID;
+    c->dirty = CB_CLEAN;
+    c->tag = cache_tag_of(cache, block_address);
+    if (c->data) {
+        memcpy(c->data, config->memory + (size_t)block_address * block_size, block_size);
+    }
+
+    if (config->dram) {
+        cost->miss = config->cycles_hit + memory_latency(cache, block_address * block_size, 0);
+    } else {
+        cost->miss = config->cycles_miss;
+    }
+}
+
+
+/**********************************************************************
+ * cache_access
+ *
+ * DESCRIPTION
+ *   Read the word at @addr, or write @value to it if @is_write. The word
+ *   is stored in big endian. On a miss, the least recently used block in
+ *   the set is replaced, and written back if it is dirty.
+ *
+ * RETURN
+ *   Whether the access hit, the cycles it took, and the word read.
+ */
+struct cache_result cache_access(struct cache *cache, unsigned int addr, int is_write, unsigned int value)
+{
+    struct cache_result result = { .hit = CACHE_HIT };
+    unsigned int block_address = addr / cache->block_size;
+    int word_offset = (addr / BYTES_PER_WORD) % cache->config.nr_words_per_block;
+    int slot = lookup(cache, block_address);
+    struct cache_block *c;
+
+    cache->lru_clock++;
+
+    if (slot < 0) {
+        result.hit = CACHE_MISS;
+        slot = find_victim(cache, block_address);
+        fill(cache, block_address, slot, &result.cost);
+        cache->stats.misses++;
+    } else {
+        result.cost.hit = cache->config.cycles_hit;
+        cache->stats.hits++;
+    }
+
+    c = cache->blocks + slot;
+    c->timestamp = cache->lru_clock;
+
+    if (c->data) {
+        unsigned char *word = c->data + word_offset * BYTES_PER_WORD;
+
+        if (is_write) {
+            word[0] = value >> 24;
+            word[1] = value >> 16;
+            word[2] = value >> 8;
+            word[3] = value;
+        }
+        result.value = ((unsigned int)word[0] << 24) | (word[1] << 16) | (word[2] << 8) | word[3];
+    }
+    if (is_write) c->dirty = CB_DIRTY;
+
+    result.latency = result.cost.hit + result.cost.miss + result.cost.writeback;
+    return result;
+}
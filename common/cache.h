@@ -0,0 +1,127 @@
+/**********************************************************************
+ * cache.h
+ *
+ * A set-associative, write-back and write-allocate cache simulator that
+ * can be embedded into other simulators. A cache is described by a
+ * struct cache_config and lives entirely in an arena supplied by the
+ * caller, so a process can host as many caches as it wants and
+ * cache_access() never allocates memory.
+ *
+ *   struct arena arena;
+ *   arena_init(&arena, malloc(cache_footprint(&config)),
+ *              cache_footprint(&config));
+ *   struct cache *cache = cache_create(&config, &arena);
+ *
+ *   struct cache_result r = cache_access(cache, addr, 0, 0);
+ **********************************************************************/
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+enum cache_constants {
+    CACHE_HIT = 0,
+    CACHE_MISS,
+
+    CB_INVALID = 0,    /* Cache block is invalid */
+    CB_VALID = 1,    /* Cache block is valid */
+
+    CB_CLEAN = 0,    /* Cache block is clean */
+    CB_DIRTY = 1,    /* Cache block is dirty */
+
+    BYTES_PER_WORD = 4,    /* This is 32 bit machine (1 word is 4 bytes) */
+    MAX_NR_WORDS_PER_BLOCK = 32,    /* Maximum cache block size */
+};
+
+/* Set index functions. See cache_index_of() */
+enum cache_index_functions {
+    CACHE_INDEX_MODULO = 0,
+    CACHE_INDEX_XOR,
+    CACHE_INDEX_PRIME,
+    CACHE_INDEX_SKEW,
+    NR_CACHE_INDEX_FUNCTIONS,
+};
+
+extern const char * const cache_index_function_names[NR_CACHE_INDEX_FUNCTIONS];
+
+struct cache_config {
+    int nr_words_per_block;
+    int nr_blocks;
+    int nr_ways;                /* 1 for direct mapped, @nr_blocks for fully associative */
+    int index_function;         /* One of enum cache_index_functions */
+
+    unsigned int cycles_hit;
+    unsigned int cycles_miss;   /* Lookup and fill */
+    unsigned int cycles_writeback;  /* Writing back a dirty victim */
+
+    /* Model the memory as DRAM banks with row buffers */
+    int dram;
+    int dram_row_size;
+    int dram_nr_banks;
+    unsigned int cycles_row_hit;
+    unsigned int cycles_row_miss;
+
+    /* Backing memory. Accesses must fall within @memory_size bytes.
+     * With @memory == NULL, the cache only tracks tags */
+    unsigned char *memory;
+    size_t memory_size;
+};
+
+struct cache_block {
+    unsigned char valid;    /* CB_INVALID or CB_VALID */
+    unsigned char dirty;    /* CB_CLEAN or CB_DIRTY */
+    unsigned int tag;
+    uint64_t timestamp;     /* Access sequence number to implement LRU */
+    unsigned char *data;    /* NULL for tag-only caches */
+};
+
+/* Cycles spent by an access, by cause */
+struct cache_cost {
+    unsigned int hit;
+    unsigned int miss;
+    unsigned int writeback;
+};
+
+struct cache_result {
+    int hit;                /* CACHE_HIT or CACHE_MISS */
+    unsigned int latency;   /* Sum of @cost */
+    struct cache_cost cost;
+    unsigned int value;     /* The word read */
+};
+
+struct cache_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t clean_misses;
+    uint64_t dirty_misses;
+    uint64_t row_hits;
+    uint64_t row_misses;
+};
+
+struct cache {
+    struct cache_config config;
+
+    int nr_sets;
+    int nr_prime_sets;      /* The divisor for CACHE_INDEX_PRIME */
+    int block_size;
+
+    struct cache_block *blocks;     /* blocks[set * nr_ways + way] */
+    unsigned int *dram_open_rows;
+
+    uint64_t lru_clock;
+    struct cache_stats stats;
+};
+
+size_t cache_footprint(const struct cache_config *config);
+struct cache *cache_create(const struct cache_config *config, struct arena *arena);
+
+struct cache_result cache_access(struct cache *cache, unsigned int addr, int is_write, unsigned int value);
+
+unsigned int cache_tag_of(const struct cache *cache, unsigned int block_address);
+int cache_index_of(const struct cache *cache, unsigned int block_address, int way);
+unsigned int cache_block_address_of(const struct cache *cache, unsigned int tag, int index, int way);
+
+#endif
@@ -0,0 +1,93 @@
+/**********************************************************************
+ * image.h
+ *
+ * The program image container written by pa1 in batch mode. An image is
+ * a header, a table of segments and the contents of the segments. Every
+ * field is a 32-bit big-endian word, like the instructions themselves.
+ *
+ * A text segment may be followed by a decoded segment at the same vaddr,
+ * with an IMAGE_DECODED_SIZE entry for each of its instructions so that
+ * the fields need not be pulled out of the words again at run time.
+ * Contents that start at an IMAGE_ALIGN boundary can be mapped in place.
+ *
+ *   +-----------------------------+  0
+ *   | magic version entry nr_segs |
+ *   +-----------------------------+  IMAGE_HEADER_SIZE
+ *   | type vaddr offset size      |  x nr_segs
+ *   +-----------------------------+
+ *   | segment contents ...        |  at their offsets
+ *   +-----------------------------+
+ **********************************************************************/
+#ifndef __IMAGE_H__
+#define __IMAGE_H__
+
+#include <stdint.h>
+
+#define IMAGE_MAGIC         0x7f4d4950u    /* "\177MIP" */
+#define IMAGE_VERSION       1
+
+#define IMAGE_HEADER_SIZE   16
+#define IMAGE_SEGMENT_SIZE  16
+#define IMAGE_DECODED_SIZE  8
+#define IMAGE_ALIGN         4096
+
+enum image_segment_types {
+    IMAGE_SEGMENT_TEXT = 1,
+    IMAGE_SEGMENT_DATA,
+    IMAGE_SEGMENT_DECODED,   /* Of the text segment at the same vaddr */
+};
+
+struct image_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entry;          /* Initial pc */
+    uint32_t nr_segments;
+};
+
+struct image_segment {
+    uint32_t type;
+    uint32_t vaddr;          /* Where the segment is loaded */
+    uint32_t offset;         /* Where the contents are in the image */
+    uint32_t size;           /* In bytes */
+};
+
+static inline void image_store32(unsigned char *p, uint32_t value)
+{
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+static inline uint32_t image_load32(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+/*
+ * An instruction pulled apart, one byte per field and the immediate
+ * big-endian. The target of a jump is rs, rt and the immediate together.
+ */
+enum image_decoded_fields {
+    IMAGE_DECODED_OPCODE = 0,
+    IMAGE_DECODED_RS,
+    IMAGE_DECODED_RT,
+    IMAGE_DECODED_RD,
+    IMAGE_DECODED_SHAMT,
+    IMAGE_DECODED_FUNCT,
+    IMAGE_DECODED_IMMEDIATE,
+};
+
+static inline void image_decode(unsigned char *entry, uint32_t word)
+{
+    entry[IMAGE_DECODED_OPCODE] = word >> 26;
+    entry[IMAGE_DECODED_RS] = (word >> 21) & 0x1f;
+    entry[IMAGE_DECODED_RT] = (word >> 16) & 0x1f;
+    entry[IMAGE_DECODED_RD] = (word >> 11) & 0x1f;
+    entry[IMAGE_DECODED_SHAMT] = (word >> 6) & 0x1f;
+    entry[IMAGE_DECODED_FUNCT] = word & 0x3f;
+    entry[IMAGE_DECODED_IMMEDIATE] = word >> 8;
+    entry[IMAGE_DECODED_IMMEDIATE + 1] = word;
+}
+
+#endif
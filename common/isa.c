@@ -0,0 +1,438 @@
+/**********************************************************************
+ * isa.c
+ *
+ * Instruction and register descriptors. See isa.h for the interface.
+ **********************************************************************/
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "isa.h"
+
+const struct isa_format isa_formats[ISA_NR_FORMATS] = {
+    [ISA_FORMAT_R] = { 6, {
+        { ISA_FIELD_OPCODE,    26,  6, 0 },
+        { ISA_FIELD_RS,        21,  5, 0 },
+        { ISA_FIELD_RT,        16,  5, 0 },
+        { ISA_FIELD_RD,        11,  5, 0 },
+        { ISA_FIELD_SHAMT,      6,  5, 1 },
+        { ISA_FIELD_FUNCT,      0,  6, 0 },
+    } },
+    [ISA_FORMAT_I] = { 4, {
+        { ISA_FIELD_OPCODE,    26,  6, 0 },
+        { ISA_FIELD_RS,        21,  5, 0 },
+        { ISA_FIELD_RT,        16,  5, 0 },
+        { ISA_FIELD_IMMEDIATE,  0, 16, 1 },
+    } },
+    [ISA_FORMAT_J] = { 2, {
+        { ISA_FIELD_OPCODE,    26,  6, 0 },
+        { ISA_FIELD_ADDRESS,    0, 26, 0 },
+    } },
+};
+
+const struct isa_instruction isa_instructions[ISA_NR_INSTRUCTIONS] = {
+    [ISA_ADD]  = { "add",  ISA_FORMAT_R, 0x00, 0x20, ISA_OPERANDS_RD_RS_RT },
+    [ISA_SUB]  = { "sub",  ISA_FORMAT_R, 0x00, 0x22, ISA_OPERANDS_RD_RS_RT },
+    [ISA_AND]  = { "and",  ISA_FORMAT_R, 0x00, 0x24, ISA_OPERANDS_RD_RS_RT },
+    [ISA_OR]   = { "or",   ISA_FORMAT_R, 0x00, 0x25, ISA_OPERANDS_RD_RS_RT },
+    [ISA_NOR]  = { "nor",  ISA_FORMAT_R, 0x00, 0x27, ISA_OPERANDS_RD_RS_RT },
+    [ISA_SLT]  = { "slt",  ISA_FORMAT_R, 0x00, 0x2a, ISA_OPERANDS_RD_RS_RT },
+    [ISA_SLL]  = { "sll",  ISA_FORMAT_R, 0x00, 0x00, ISA_OPERANDS_RD_RT_SHAMT },
+    [ISA_SRL]  = { "srl",  ISA_FORMAT_R, 0x00, 0x02, ISA_OPERANDS_RD_RT_SHAMT },
+    [ISA_SRA]  = { "sra",  ISA_FORMAT_R, 0x00, 0x03, ISA_OPERANDS_RD_RT_SHAMT },
+    [ISA_JR]   = { "jr",   ISA_FORMAT_R, 0x00, 0x08, ISA_OPERANDS_RS },
+    [ISA_LW]   = { "lw",   ISA_FORMAT_I, 0x23, 0x00, ISA_OPERANDS_RT_RS_IMM },
+    [ISA_SW]   = { "sw",   ISA_FORMAT_I, 0x2b, 0x00, ISA_OPERANDS_RT_RS_IMM },
+    [ISA_ANDI] = { "andi", ISA_FORMAT_I, 0x0c, 0x00, ISA_OPERANDS_RT_RS_IMM },
+    [ISA_ORI]  = { "ori",  ISA_FORMAT_I, 0x0d, 0x00, ISA_OPERANDS_RT_RS_IMM },
+    [ISA_ADDI] = { "addi", ISA_FORMAT_I, 0x08, 0x00, ISA_OPERANDS_RT_RS_IMM },
+    [ISA_SLTI] = { "slti", ISA_FORMAT_I, 0x0a, 0x00, ISA_OPERANDS_RT_RS_IMM },
+    [ISA_BEQ]  = { "beq",  ISA_FORMAT_I, 0x04, 0x00, ISA_OPERANDS_RT_RS_IMM },
+    [ISA_BNE]  = { "bne",  ISA_FORMAT_I, 0x05, 0x00, ISA_OPERANDS_RT_RS_IMM },
+    [ISA_LUI]  = { "lui",  ISA_FORMAT_I, 0x0f, 0x00, ISA_OPERANDS_RT_IMM },
+    [ISA_J]    = { "j",    ISA_FORMAT_J, 0x02, 0x00, ISA_OPERANDS_TARGET },
+    [ISA_JAL]  = { "jal",  ISA_FORMAT_J, 0x03, 0x00, ISA_OPERANDS_TARGET },
+};
+
+const char * const isa_register_names[ISA_NR_REGISTERS] = {
+    "zr", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+    "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+    "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+    "t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra",
+};
+
+/*
+ * Perfect hashes over names. Every mnemonic and register name fits in four
+ * bytes, which are packed into a 32-bit key and hashed multiplicatively
+ * into a 64-slot table. The multipliers were searched for offline so that
+ * no two names share a slot; a collision after a change to the tables
+ * shows up as an overridden initializer (-Woverride-init), and the
+ * multiplier has to be searched for again.
+ */
+#define HASH_BITS                   6
+#define INSTRUCTION_MULTIPLIER      0x9e377b93u
+#define REGISTER_MULTIPLIER         0x9e4c7947u
+
+#define KEY(a, b, c, d) \
+    ((uint32_t)(a) | (uint32_t)(b) << 8 | (uint32_t)(c) << 16 | (uint32_t)(d) << 24)
+#define SLOT(key, multiplier) \
+    ((uint32_t)((key) * (multiplier)) >> (32 - HASH_BITS))
+
+struct slot {
+    uint32_t key;    /* 0 for an empty slot */
+    int value;
+};
+
+#define INSTRUCTION(a, b, c, d, value) \
+    [SLOT(KEY(a, b, c, d), INSTRUCTION_MULTIPLIER)] = { KEY(a, b, c, d), value }
+
+static const struct slot instruction_slots[1 << HASH_BITS] = {
+    INSTRUCTION('a', 'd', 'd', 0, ISA_ADD),
+    INSTRUCTION('s', 'u', 'b', 0, ISA_SUB),
+    INSTRUCTION('a', 'n', 'd', 0, ISA_AND),
+    INSTRUCTION('o', 'r', 0, 0, ISA_OR),
+    INSTRUCTION('n', 'o', 'r', 0, ISA_NOR),
+    INSTRUCTION('s', 'l', 't', 0, ISA_SLT),
+    INSTRUCTION('s', 'l', 'l', 0, ISA_SLL),
+    INSTRUCTION('s', 'r', 'l', 0, ISA_SRL),
+    INSTRUCTION('s', 'r', 'a', 0, ISA_SRA),
+    INSTRUCTION('j', 'r', 0, 0, ISA_JR),
+    INSTRUCTION('l', 'w', 0, 0, ISA_LW),
+    INSTRUCTION('s', 'w', 0, 0, ISA_SW),
+    INSTRUCTION('a', 'n', 'd', 'i', ISA_ANDI),
+    INSTRUCTION('o', 'r', 'i', 0, ISA_ORI),
+    INSTRUCTION('a', 'd', 'd', 'i', ISA_ADDI),
+    INSTRUCTION('s', 'l', 't', 'i', ISA_SLTI),
+    INSTRUCTION('b', 'e', 'q', 0, ISA_BEQ),
+    INSTRUCTION('b', 'n', 'e', 0, ISA_BNE),
+    INSTRUCTION('l', 'u', 'i', 0, ISA_LUI),
+    INSTRUCTION('j', 0, 0, 0, ISA_J),
+    INSTRUCTION('j', 'a', 'l', 0, ISA_JAL),
+};
+
+#define REGISTER(a, b, c, d, value) \
+    [SLOT(KEY(a, b, c, d), REGISTER_MULTIPLIER)] = { KEY(a, b, c, d), value }
+
+static const struct slot register_slots[1 << HASH_BITS] = {
+    REGISTER('z', 'e', 'r', 'o', 0),
+    REGISTER('z', 'r', 0, 0, 0),
+    REGISTER('a', 't', 0, 0, 1),
+    REGISTER('v', '0', 0, 0, 2),
+    REGISTER('v', '1', 0, 0, 3),
+    REGISTER('a', '0', 0, 0, 4),
+    REGISTER('a', '1', 0, 0, 5),
+    REGISTER('a', '2', 0, 0, 6),
+    REGISTER('a', '3', 0, 0, 7),
+    REGISTER('t', '0', 0, 0, 8),
+    REGISTER('t', '1', 0, 0, 9),
+    REGISTER('t', '2', 0, 0, 10),
+    REGISTER('t', '3', 0, 0, 11),
+    REGISTER('t', '4', 0, 0, 12),
+    REGISTER('t', '5', 0, 0, 13),
+    REGISTER('t', '6', 0, 0, 14),
+    REGISTER('t', '7', 0, 0, 15),
+    REGISTER('s', '0', 0, 0, 16),
+    REGISTER('s', '1', 0, 0, 17),
+    REGISTER('s', '2', 0, 0, 18),
+    REGISTER('s', '3', 0, 0, 19),
+    REGISTER('s', '4', 0, 0, 20),
+    REGISTER('s', '5', 0, 0, 21),
+    REGISTER('s', '6', 0, 0, 22),
+    REGISTER('s', '7', 0, 0, 23),
+    REGISTER('t', '8', 0, 0, 24),
+    REGISTER('t', '9', 0, 0, 25),
+    REGISTER('k', '0', 0, 0, 26),
+    REGISTER('k', '1', 0, 0, 27),
+    REGISTER('g', 'p', 0, 0, 28),
+    REGISTER('s', 'p', 0, 0, 29),
+    REGISTER('f', 'p', 0, 0, 30),
+    REGISTER('r', 'a', 0, 0, 31),
+};
+
+/* Pack up to four bytes of @name into a key. Returns 0 if it is longer */
+static inline uint32_t key_of(const char *name)
+{
+    uint32_t key = 0;
+
+    for (int i = 0; i < 4 && name[i]; i++) {
+        key |= (uint32_t)(unsigned char)name[i] << (i * 8);
+    }
+    if (key & 0xff000000u && name[4]) return 0;
+    return key;
+}
+
+static inline const struct slot *lookup(const struct slot *slots,
+        uint32_t multiplier, const char *name)
+{
+    uint32_t key = key_of(name);
+    const struct slot *slot = slots + SLOT(key, multiplier);
+
+    if (key == 0 || slot->key != key) return NULL;
+    return slot;
+}
+
+const struct isa_instruction *isa_find_instruction(const char *name)
+{
+    const struct slot *slot;
+
+    if (name == NULL) return NULL;
+
+    slot = lookup(instruction_slots, INSTRUCTION_MULTIPLIER, name);
+    return slot ? isa_instructions + slot->value : NULL;
+}
+
+int isa_register_number(const char *name)
+{
+    const struct slot *slot;
+
+    if (name == NULL) return -1;
+
+    slot = lookup(register_slots, REGISTER_MULTIPLIER, name);
+    return slot ? slot->value : -1;
+}
+
+unsigned int isa_immediate(const char *str)
+{
+    const char *digits = str;
+
+    if (str == NULL) return 0;
+    if (*digits == '-') digits++;
+
+    return (unsigned int)strtoimax(str, NULL, strncmp(digits, "0x", 2) == 0 ? 16 : 10);
+}
+
+unsigned int isa_encode(int format, const unsigned int values[ISA_NR_FIELDS])
+{
+    const struct isa_format *desc = isa_formats + format;
+    unsigned int code32 = 0;
+
+    for (int i = 0; i < desc->nr_fields; i++) {
+        const struct isa_field *f = desc->fields + i;
+
+        code32 |= (values[f->field] & ((1u << f->width) - 1)) << f->shift;
+    }
+    return code32;
+}
+
+/*
+ * The number of the register in operand @index of @operand[], or 0 if it
+ * is missing. An unknown name sets @bad to the index of its token
+ */
+static unsigned int register_operand(const char *operand[3], int index, int *bad)
+{
+    int reg = isa_register_number(operand[index]);
+
+    if (reg >= 0) return reg;
+    if (operand[index] && !*bad) *bad = index + 1;
+    return 0;
+}
+
+int isa_translate(int nr_tokens, char * const tokens[], unsigned int *word)
+{
+    const struct isa_instruction *inst;
+    unsigned int values[ISA_NR_FIELDS] = { 0 };
+    const char *operand[3] = { NULL };
+    int bad = 0;
+
+    *word = 0;
+    if (nr_tokens == 0) return 0;
+    if (strcmp(tokens[0], "halt") == 0) {
+        *word = 0xffffffff;
+        return 0;
+    }
+
+    inst = isa_find_instruction(tokens[0]);
+    if (inst == NULL) return ISA_UNKNOWN_INSTRUCTION;
+
+    for (int i = 0; i < 3 && i + 1 < nr_tokens; i++) {
+        operand[i] = tokens[i + 1];
+    }
+
+    values[ISA_FIELD_OPCODE] = inst->opcode;
+    values[ISA_FIELD_FUNCT] = inst->funct;
+
+    switch (inst->operands) {
+    case ISA_OPERANDS_RD_RS_RT:
+        values[ISA_FIELD_RD] = register_operand(operand, 0, &bad);
+        values[ISA_FIELD_RS] = register_operand(operand, 1, &bad);
+        values[ISA_FIELD_RT] = register_operand(operand, 2, &bad);
+        break;
+    case ISA_OPERANDS_RD_RT_SHAMT:
+        values[ISA_FIELD_RD] = register_operand(operand, 0, &bad);
+        values[ISA_FIELD_RT] = register_operand(operand, 1, &bad);
+        values[ISA_FIELD_SHAMT] = isa_immediate(operand[2]);
+        break;
+    case ISA_OPERANDS_RS:
+        values[ISA_FIELD_RS] = register_operand(operand, 0, &bad);
+        break;
+    case ISA_OPERANDS_RT_RS_IMM:
+        values[ISA_FIELD_RT] = register_operand(operand, 0, &bad);
+        values[ISA_FIELD_RS] = register_operand(operand, 1, &bad);
+        values[ISA_FIELD_IMMEDIATE] = isa_immediate(operand[2]);
+        break;
+    case ISA_OPERANDS_RT_IMM:
+        values[ISA_FIELD_RT] = register_operand(operand, 0, &bad);
+        values[ISA_FIELD_IMMEDIATE] = isa_immediate(operand[1]);
+        break;
+    case ISA_OPERANDS_TARGET:
+        /*
+         * Drop the upper 4 bits of the target which come from the pc,
+         * and the lower 2 bits which are always 0
+         */
+        values[ISA_FIELD_ADDRESS] = (isa_immediate(operand[0]) & 0x0fffffff) >> 2;
+        break;
+    }
+
+    if (bad) return bad;
+    *word = isa_encode(inst->format, values);
+    return 0;
+}
+
+/*
+ * Decoding. The descriptors are indexed by opcode, and R-format ones by
+ * funct, in tables built from isa_instructions[] on first use. Entries
+ * hold the index of the descriptor plus 1, so 0 is an unknown encoding.
+ */
+static unsigned char opcode_table[64];
+static unsigned char funct_table[64];
+static int decode_tables_built;
+
+static void build_decode_tables(void)
+{
+    for (int i = 0; i < ISA_NR_INSTRUCTIONS; i++) {
+        const struct isa_instruction *inst = isa_instructions + i;
+
+        if (inst->format == ISA_FORMAT_R) {
+            funct_table[inst->funct] = i + 1;
+        } else {
+            opcode_table[inst->opcode] = i + 1;
+        }
+    }
+    decode_tables_built = 1;
+}
+
+const struct isa_instruction *isa_decode(uint32_t word)
+{
+    unsigned int index;
+
+    if (!decode_tables_built) build_decode_tables();
+
+    if (word >> 26 == 0) {
+        index = funct_table[word & 0x3f];
+    } else {
+        index = opcode_table[word >> 26];
+    }
+    return index ? isa_instructions + index - 1 : NULL;
+}
+
+/* The fields of @format in @word, sign-extended where they are signed */
+static void extract_fields(int format, uint32_t word, int values[ISA_NR_FIELDS])
+{
+    const struct isa_format *desc = isa_formats + format;
+
+    for (int i = 0; i < desc->nr_fields; i++) {
+        const struct isa_field *f = desc->fields + i;
+        uint32_t value = (word >> f->shift) & ((1u << f->width) - 1);
+
+        if (f->is_signed && value >> (f->width - 1)) value -= 1u << f->width;
+        values[f->field] = (int)value;
+    }
+}
+
+static char *put_string(char *p, const char *s)
+{
+    while (*s) *p++ = *s++;
+    return p;
+}
+
+/* Every register name is two characters long */
+static char *put_register(char *p, int reg)
+{
+    p[0] = ' ';
+    p[1] = isa_register_names[reg][0];
+    p[2] = isa_register_names[reg][1];
+    return p + 3;
+}
+
+static char *put_decimal(char *p, int value)
+{
+    char digits[12];
+    int n = 0;
+    unsigned int u = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+
+    *p++ = ' ';
+    if (value < 0) *p++ = '-';
+    do {
+        digits[n++] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    while (n) *p++ = digits[--n];
+    return p;
+}
+
+/* @value in hexadecimal with @width digits at least */
+static char *put_hex(char *p, uint32_t value, int width)
+{
+    static const char hex_digits[] = "0123456789abcdef";
+    int n = 8;
+
+    while (n > width && !(value >> ((n - 1) * 4))) n--;
+
+    *p++ = ' ';
+    *p++ = '0';
+    *p++ = 'x';
+    while (n--) *p++ = hex_digits[(value >> (n * 4)) & 0xf];
+    return p;
+}
+
+int isa_disassemble(uint32_t word, uint32_t pc, char text[ISA_DISASM_MAX])
+{
+    const struct isa_instruction *inst = isa_decode(word);
+    int values[ISA_NR_FIELDS];
+    char *p = text;
+
+    if (word == 0xffffffff) {
+        p = put_string(p, "halt");
+    } else if (inst == NULL) {
+        p = put_hex(put_string(p, ".word"), word, 8);
+    } else {
+        extract_fields(inst->format, word, values);
+        p = put_string(p, inst->name);
+
+        switch (inst->operands) {
+        case ISA_OPERANDS_RD_RS_RT:
+            p = put_register(p, values[ISA_FIELD_RD]);
+            p = put_register(p, values[ISA_FIELD_RS]);
+            p = put_register(p, values[ISA_FIELD_RT]);
+            break;
+        case ISA_OPERANDS_RD_RT_SHAMT:
+            p = put_register(p, values[ISA_FIELD_RD]);
+            p = put_register(p, values[ISA_FIELD_RT]);
+            p = put_decimal(p, values[ISA_FIELD_SHAMT] & 0x1f);
+            break;
+        case ISA_OPERANDS_RS:
+            p = put_register(p, values[ISA_FIELD_RS]);
+            break;
+        case ISA_OPERANDS_RT_RS_IMM:
+            p = put_register(p, values[ISA_FIELD_RT]);
+            p = put_register(p, values[ISA_FIELD_RS]);
+            /* andi and ori zero-extend their immediate */
+            if (inst == isa_instructions + ISA_ANDI || inst == isa_instructions + ISA_ORI) {
+                p = put_hex(p, values[ISA_FIELD_IMMEDIATE] & 0xffff, 1);
+            } else {
+                p = put_decimal(p, values[ISA_FIELD_IMMEDIATE]);
+            }
+            break;
+        case ISA_OPERANDS_RT_IMM:
+            p = put_register(p, values[ISA_FIELD_RT]);
+            p = put_hex(p, values[ISA_FIELD_IMMEDIATE] & 0xffff, 1);
+            break;
+        case ISA_OPERANDS_TARGET:
+            p = put_hex(p, ((pc + 4) & 0xf0000000) | (uint32_t)values[ISA_FIELD_ADDRESS] << 2, 8);
+            break;
+        }
+    }
+
+    *p = '\0';
+    return p - text;
+}
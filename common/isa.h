@@ -0,0 +1,121 @@
+/**********************************************************************
+ * isa.h
+ *
+ * Descriptors of the MIPS subset used throughout the assignments and the
+ * lookups the assemblers are built on. Mnemonics and register names are
+ * mapped in constant time through perfect hashes over their first four
+ * bytes, instructions are encoded from integer field values, and decoded
+ * back through tables indexed by opcode and funct.
+ *
+ *   const struct isa_instruction *inst = isa_find_instruction("addi");
+ *   int reg = isa_register_number("sp");
+ *   if (isa_translate(nr_tokens, tokens, &code) == 0) ...
+ *   int len = isa_disassemble(code, pc, text);
+ **********************************************************************/
+#ifndef __ISA_H__
+#define __ISA_H__
+
+#include <stdint.h>
+
+enum isa_fields {
+    ISA_FIELD_OPCODE = 0,
+    ISA_FIELD_RS,
+    ISA_FIELD_RT,
+    ISA_FIELD_RD,
+    ISA_FIELD_SHAMT,
+    ISA_FIELD_FUNCT,
+    ISA_FIELD_IMMEDIATE,
+    ISA_FIELD_ADDRESS,
+    ISA_NR_FIELDS,
+};
+
+enum isa_formats {
+    ISA_FORMAT_R = 0,
+    ISA_FORMAT_I,
+    ISA_FORMAT_J,
+    ISA_NR_FORMATS,
+};
+
+struct isa_field {
+    int field;
+    int shift;
+    int width;
+    int is_signed;    /* Negative values are stored in two's complement */
+};
+
+/* The fields a format is made of, and where they are placed */
+struct isa_format {
+    int nr_fields;
+    struct isa_field fields[6];
+};
+
+extern const struct isa_format isa_formats[ISA_NR_FORMATS];
+
+/* How the operands after the mnemonic map to the fields */
+enum isa_operand_layouts {
+    ISA_OPERANDS_RD_RS_RT = 0,    /* add rd rs rt */
+    ISA_OPERANDS_RD_RT_SHAMT,     /* sll rd rt shamt */
+    ISA_OPERANDS_RS,              /* jr rs */
+    ISA_OPERANDS_RT_RS_IMM,       /* addi rt rs imm, beq rt rs offset */
+    ISA_OPERANDS_RT_IMM,          /* lui rt imm */
+    ISA_OPERANDS_TARGET,          /* j target */
+};
+
+enum isa_opcodes {
+    ISA_ADD = 0, ISA_SUB, ISA_AND, ISA_OR, ISA_NOR, ISA_SLT,
+    ISA_SLL, ISA_SRL, ISA_SRA, ISA_JR,
+    ISA_LW, ISA_SW, ISA_ANDI, ISA_ORI, ISA_ADDI, ISA_SLTI,
+    ISA_BEQ, ISA_BNE, ISA_LUI,
+    ISA_J, ISA_JAL,
+    ISA_NR_INSTRUCTIONS,
+};
+
+struct isa_instruction {
+    const char *name;
+    int format;
+    unsigned int opcode;
+    unsigned int funct;    /* R format only */
+    int operands;
+};
+
+extern const struct isa_instruction isa_instructions[ISA_NR_INSTRUCTIONS];
+
+#define ISA_NR_REGISTERS    32
+
+extern const char * const isa_register_names[ISA_NR_REGISTERS];
+
+/* Returns the descriptor of @name, or NULL if it is not an instruction */
+const struct isa_instruction *isa_find_instruction(const char *name);
+
+/* Returns the number of register @name, or -1 if it is not a register */
+int isa_register_number(const char *name);
+
+/* Decimal, or hexadecimal with the 0x prefix. Both may be negative */
+unsigned int isa_immediate(const char *str);
+
+/* OR every field of @format into place, masked to its width */
+unsigned int isa_encode(int format, const unsigned int values[ISA_NR_FIELDS]);
+
+#define ISA_DISASM_MAX    32    /* Longest text of an instruction, with the NUL */
+
+/* Returns the descriptor @word is an instance of, or NULL */
+const struct isa_instruction *isa_decode(uint32_t word);
+
+/*
+ * Write the instruction @word fetched from @pc into @text, in the syntax
+ * isa_translate() reads back. Branches show their offset in words and
+ * jumps their target address. Returns the length of the text
+ */
+int isa_disassemble(uint32_t word, uint32_t pc, char text[ISA_DISASM_MAX]);
+
+#define ISA_UNKNOWN_INSTRUCTION    -1
+
+/*
+ * Encode the instruction in @tokens into @word. Missing operands encode
+ * as 0, and "halt" as 0xffffffff. Returns 0, ISA_UNKNOWN_INSTRUCTION if
+ * @tokens[0] is not an instruction, or the index in @tokens of the first
+ * operand that should be a register but is not. @word is 0 on an error.
+ */
+int isa_translate(int nr_tokens, char * const tokens[], unsigned int *word);
+
+#endif
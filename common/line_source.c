@@ -0,0 +1,180 @@
+/**********************************************************************
+ * line_source.c
+ *
+ * The mapped and the buffered line sources. A mapping is private, so
+ * writing into a line copies only the page written and never reaches the
+ * file.
+ **********************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "line_source.h"
+
+static int __map(struct line_source *source)
+{
+    struct stat st;
+    void *data;
+
+    if (fstat(source->fd, &st) || !S_ISREG(st.st_mode) || st.st_size == 0) return -1;
+
+    data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, source->fd, 0);
+    if (data == MAP_FAILED) return -1;
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    source->data = data;
+    source->size = st.st_size;
+    return 0;
+}
+
+int line_source_open(struct line_source *source, const char *path)
+{
+    memset(source, 0, sizeof(*source));
+
+    source->fd = path ? open(path, O_RDONLY) : STDIN_FILENO;
+    if (source->fd < 0) return -1;
+
+    if (__map(source) == 0) return 0;
+
+    source->capacity = LINE_SOURCE_BLOCK;
+    source->data = malloc(source->capacity + 1);
+    if (!source->data) {
+        if (path) close(source->fd);
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+static char *__line(char *line, size_t length, size_t *lengthp)
+{
+    line[length] = '\0';
+    if (lengthp) *lengthp = length;
+    return line;
+}
+
+static char *__next_mapped(struct line_source *source, size_t *length)
+{
+    char *line = source->data + source->next;
+    size_t left = source->size - source->next;
+    char *eol;
+
+    if (!left) return NULL;
+
+    eol = memchr(line, '\n', left);
+    if (eol) {
+        source->next += eol - line + 1;
+        return __line(line, eol - line, length);
+    }
+
+    /* The mapping may end right at a page boundary, leaving no room for the '\0' */
+    source->next = source->size;
+    free(source->tail);
+    source->tail = malloc(left + 1);
+    if (!source->tail) return NULL;
+    memcpy(source->tail, line, left);
+    return __line(source->tail, left, length);
+}
+
+/* Read once more into the buffer after the @size bytes in it, growing it if full */
+static int __fill(struct line_source *source)
+{
+    ssize_t nr_read;
+
+    if (source->size == source->capacity) {
+        char *grown = realloc(source->data, source->capacity * 2 + 1);
+
+        if (!grown) return -1;
+        source->data = grown;
+        source->capacity *= 2;
+    }
+
+    do {
+        nr_read = read(source->fd, source->data + source->size, source->capacity - source->size);
+    } while (nr_read < 0 && errno == EINTR);
+
+    if (nr_read <= 0) {
+        source->eof = 1;
+    } else {
+        source->size += nr_read;
+    }
+    return 0;
+}
+
+static char *__next_buffered(struct line_source *source, size_t *length)
+{
+    size_t scanned = 0;    /* Of the partial line, known to have no '\n' */
+
+    for (;;) {
+        char *line = source->data + source->next;
+        size_t left = source->size - source->next;
+        char *eol = memchr(line + scanned, '\n', left - scanned);
+
+        if (eol) {
+            source->next += eol - line + 1;
+            return __line(line, eol - line, length);
+        }
+
+        if (source->eof) {
+            if (!left) return NULL;
+            source->next = source->size;
+            return __line(line, left, length);
+        }
+
+        /* Move the partial line to the front and read more after it */
+        memmove(source->data, line, left);
+        source->next = 0;
+        source->size = left;
+        scanned = left;
+
+        if (__fill(source)) return NULL;
+    }
+}
+
+char *line_source_rest(struct line_source *source, size_t *size)
+{
+    char *rest = source->data + source->next;
+    size_t left = source->size - source->next;
+
+    if (source->capacity) {
+        memmove(source->data, rest, left);
+        source->size = left;
+        while (!source->eof) {
+            if (__fill(source)) return NULL;
+        }
+        rest = source->data;
+        left = source->size;
+    } else if (source->size % sysconf(_SC_PAGESIZE) == 0) {
+        /* No room for the '\0' in the last page of the mapping */
+        free(source->tail);
+        source->tail = malloc(left + 1);
+        if (!source->tail) return NULL;
+        rest = memcpy(source->tail, rest, left);
+    }
+
+    source->next = source->size;
+    *size = left;
+    rest[left] = '\0';
+    return rest;
+}
+
+char *line_source_next(struct line_source *source, size_t *length)
+{
+    if (source->capacity) return __next_buffered(source, length);
+    return __next_mapped(source, length);
+}
+
+void line_source_close(struct line_source *source)
+{
+    if (source->capacity) {
+        free(source->data);
+    } else if (source->data) {
+        munmap(source->data, source->size);
+    }
+    free(source->tail);
+    if (source->fd != STDIN_FILENO && source->fd >= 0) close(source->fd);
+}
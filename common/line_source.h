@@ -0,0 +1,54 @@
+/**********************************************************************
+ * line_source.h
+ *
+ * Hand out the lines of an input one at a time, without a limit on their
+ * length. A regular file is mapped privately and its lines are handed
+ * out where they are in the mapping. Anything else, like a terminal or a
+ * pipe, is read in large blocks into a buffer that grows to fit the
+ * longest line. Either way a line is '\0'-terminated in place of its
+ * '\n' and may be written to, such as by tokenize().
+ *
+ *   struct line_source source;
+ *   char *line;
+ *
+ *   if (line_source_open(&source, path)) return -1;
+ *   while ((line = line_source_next(&source, NULL))) ...
+ *   line_source_close(&source);
+ **********************************************************************/
+#ifndef __LINE_SOURCE_H__
+#define __LINE_SOURCE_H__
+
+#include <stddef.h>
+
+#define LINE_SOURCE_BLOCK   (1 << 16)    /* Initial size of the buffer */
+
+struct line_source {
+    int fd;
+    char *data;          /* The mapping, or the buffer */
+    size_t size;         /* Of the mapping, or of the bytes in the buffer */
+    size_t next;         /* Where the next line starts in @data */
+    size_t capacity;     /* Of the buffer. 0 when @data is mapped */
+    char *tail;          /* Copy of the last line of a mapping without '\n' */
+    int eof;
+};
+
+/* Open @path, or the standard input if @path is NULL. Returns 0 or -1 with errno set */
+int line_source_open(struct line_source *source, const char *path);
+
+/*
+ * The next line, or NULL at the end of the input. Its length without the
+ * '\n' is put into @length unless it is NULL. The line is valid until the
+ * next call.
+ */
+char *line_source_next(struct line_source *source, size_t *length);
+
+/*
+ * All the rest of the input as one block of @size bytes, '\0'-terminated,
+ * for those who want the whole input at once. Valid until the source is
+ * closed.
+ */
+char *line_source_rest(struct line_source *source, size_t *size);
+
+void line_source_close(struct line_source *source);
+
+#endif
@@ -0,0 +1,213 @@
+/**********************************************************************
+ * program.c
+ *
+ * Loading programs. Images are checked before any segment is handed out:
+ * every segment must lie within the file, and a decoded segment must go
+ * with a text segment of as many instructions.
+ **********************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "program.h"
+
+#define BLOCK_SIZE      (1 << 16)    /* Of each read from a pipe */
+
+int program_detect(const unsigned char *data, size_t size)
+{
+    if (size >= IMAGE_HEADER_SIZE && image_load32(data) == IMAGE_MAGIC) return PROGRAM_IMAGE;
+
+    for (size_t i = 0; i < size && i < 64; i++) {
+        unsigned char c = data[i];
+
+        if (c != '\n' && c != '\r' && c != '\t' && (c < ' ' || c > '~')) return PROGRAM_BINARY;
+    }
+    return PROGRAM_HEX;
+}
+
+static int __read_file(struct program *program, int fd)
+{
+    struct stat st;
+    size_t capacity = BLOCK_SIZE;
+    ssize_t nr_read;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data != MAP_FAILED) {
+            program->data = data;
+            program->size = st.st_size;
+            program->mapped = 1;
+            return 0;
+        }
+    }
+
+    program->data = malloc(capacity);
+    if (!program->data) return -1;
+
+    while ((nr_read = read(fd, program->data + program->size, capacity - program->size)) > 0) {
+        program->size += nr_read;
+        if (program->size == capacity) {
+            unsigned char *grown = realloc(program->data, capacity * 2);
+
+            if (!grown) return -1;
+            program->data = grown;
+            capacity *= 2;
+        }
+    }
+    return nr_read < 0 ? -1 : 0;
+}
+
+/* @offset is that of @contents in the file, or PROGRAM_NO_OFFSET if they are not in it */
+static int __add_segment(struct program *program, uint32_t type, uint32_t vaddr,
+        const unsigned char *contents, size_t offset, size_t size)
+{
+    struct program_segment *segment;
+
+    if (program->nr_segments == PROGRAM_MAX_SEGMENTS || size > UINT32_MAX) return -1;
+
+    segment = &program->segments[program->nr_segments++];
+    segment->type = type;
+    segment->vaddr = vaddr;
+    segment->size = size;
+    segment->contents = contents;
+    segment->offset = offset;
+    return 0;
+}
+
+static int __parse_image(struct program *program)
+{
+    const unsigned char *data = program->data;
+    uint32_t nr_segments;
+
+    if (program->size < IMAGE_HEADER_SIZE || image_load32(data + 4) != IMAGE_VERSION) return -1;
+
+    program->entry = image_load32(data + 8);
+    nr_segments = image_load32(data + 12);
+    if (nr_segments > PROGRAM_MAX_SEGMENTS ||
+            IMAGE_HEADER_SIZE + (size_t)nr_segments * IMAGE_SEGMENT_SIZE > program->size) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < nr_segments; i++) {
+        const unsigned char *segment = data + IMAGE_HEADER_SIZE + (size_t)i * IMAGE_SEGMENT_SIZE;
+        uint32_t offset = image_load32(segment + 8);
+        uint32_t size = image_load32(segment + 12);
+
+        if (offset > program->size || size > program->size - offset) return -1;
+        __add_segment(program, image_load32(segment), image_load32(segment + 4), data + offset, offset, size);
+    }
+
+    for (int i = 0; i < program->nr_segments; i++) {
+        const struct program_segment *decoded = &program->segments[i];
+        const struct program_segment *text;
+
+        if (decoded->type != IMAGE_SEGMENT_DECODED) continue;
+
+        text = program_find(program, IMAGE_SEGMENT_TEXT, decoded->vaddr);
+        if (!text || (uint64_t)text->size / 4 * IMAGE_DECODED_SIZE != decoded->size) return -1;
+    }
+    return 0;
+}
+
+/*
+ * Each line is a word as strtoimax() reads it, so a line without a
+ * number is a 0, like pa2 has always loaded them
+ */
+static int __parse_hex(struct program *program, uint32_t vaddr)
+{
+    const char *p = (const char *)program->data, *end = p + program->size;
+    size_t nr_words = 0;
+
+    for (const char *q = p; q < end; nr_words++) {
+        const char *eol = memchr(q, '\n', end - q);
+        q = eol ? eol + 1 : end;
+    }
+
+    program->words = malloc(nr_words * 4 + 1);
+    if (!program->words) return -1;
+
+    for (size_t i = 0; i < nr_words; i++) {
+        const char *eol = memchr(p, '\n', end - p);
+        uint32_t word = 0;
+
+        if (!eol) eol = end;
+        while (p < eol && strchr(" \t\r\v\f", *p)) p++;
+
+        if (p < eol) {
+            char line[64];
+            size_t length = eol - p < (long)sizeof(line) - 1 ? (size_t)(eol - p) : sizeof(line) - 1;
+
+            /* The last line may end the mapping without a '\n' to stop at */
+            memcpy(line, p, length);
+            line[length] = '\0';
+            word = strtoimax(line, NULL, 0);
+        }
+        image_store32(program->words + i * 4, word);
+        p = eol + 1;
+    }
+    return __add_segment(program, IMAGE_SEGMENT_TEXT, vaddr, program->words, PROGRAM_NO_OFFSET, nr_words * 4);
+}
+
+int program_open(struct program *program, const char *path, uint32_t vaddr)
+{
+    int fd, ret;
+
+    memset(program, 0, sizeof(*program));
+    program->entry = vaddr;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    ret = __read_file(program, fd);
+    close(fd);
+    if (ret) goto fail;
+
+    program->format = program_detect(program->data, program->size);
+    switch (program->format) {
+    case PROGRAM_IMAGE:
+        if (__parse_image(program)) {
+            errno = EINVAL;
+            goto fail;
+        }
+        break;
+    case PROGRAM_BINARY:
+        __add_segment(program, IMAGE_SEGMENT_TEXT, vaddr, program->data, 0, program->size & ~(size_t)3);
+        break;
+    default:
+        if (__parse_hex(program, vaddr)) goto fail;
+        break;
+    }
+    return 0;
+
+fail:
+    ret = errno;
+    program_close(program);
+    errno = ret ? ret : ENOMEM;
+    return -1;
+}
+
+const struct program_segment *program_find(const struct program *program, uint32_t type, uint32_t vaddr)
+{
+    for (int i = 0; i < program->nr_segments; i++) {
+        const struct program_segment *segment = &program->segments[i];
+
+        if (segment->type == type && (vaddr == (uint32_t)-1 || segment->vaddr == vaddr)) return segment;
+    }
+    return NULL;
+}
+
+void program_close(struct program *program)
+{
+    if (program->mapped) {
+        munmap(program->data, program->size);
+    } else {
+        free(program->data);
+    }
+    free(program->words);
+    memset(program, 0, sizeof(*program));
+}
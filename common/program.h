@@ -0,0 +1,69 @@
+/**********************************************************************
+ * program.h
+ *
+ * Open a program in any of the formats the tools write, and hand out its
+ * segments: an image (see image.h), raw big-endian words, or the hex text
+ * pa2 loads, one instruction per line. The format is told from the
+ * contents. A regular file is mapped, so the contents of an image are
+ * not copied or even read until they are used. Raw words and hex text
+ * become a single text segment at the address given to program_open().
+ *
+ *   struct program program;
+ *
+ *   if (program_open(&program, path, 0x1000)) return -1;
+ *   for (int i = 0; i < program.nr_segments; i++) ... program.segments[i]
+ *   program_close(&program);
+ **********************************************************************/
+#ifndef __PROGRAM_H__
+#define __PROGRAM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "image.h"
+
+#define PROGRAM_MAX_SEGMENTS    8
+#define PROGRAM_NO_OFFSET       ((size_t)-1)
+
+enum program_formats {
+    PROGRAM_HEX = 0,
+    PROGRAM_BINARY,
+    PROGRAM_IMAGE,
+    NR_PROGRAM_FORMATS,
+};
+
+struct program_segment {
+    uint32_t type;                 /* IMAGE_SEGMENT_* */
+    uint32_t vaddr;
+    uint32_t size;                 /* In bytes */
+    const unsigned char *contents;
+    size_t offset;                 /* Of @contents in the file, or PROGRAM_NO_OFFSET */
+};
+
+struct program {
+    int format;
+    uint32_t entry;
+    int nr_segments;
+    struct program_segment segments[PROGRAM_MAX_SEGMENTS];
+
+    unsigned char *data;           /* The whole file */
+    size_t size;
+    int mapped;                    /* Whether @data is a mapping of the file */
+    unsigned char *words;          /* Parsed from hex text */
+};
+
+/* The format of the @size bytes at @data */
+int program_detect(const unsigned char *data, size_t size);
+
+/*
+ * Open the program at @path, putting raw words and hex text at @vaddr.
+ * Returns 0, or -1 with errno set. EINVAL means a malformed image.
+ */
+int program_open(struct program *program, const char *path, uint32_t vaddr);
+
+/* The first segment of @type at @vaddr, or the first of @type if @vaddr is -1. NULL if there is none */
+const struct program_segment *program_find(const struct program *program, uint32_t type, uint32_t vaddr);
+
+void program_close(struct program *program);
+
+#endif
@@ -0,0 +1,330 @@
+/**********************************************************************
+ * simpoint.c
+ *
+ * BBV profiling, k-means and the estimate. k-means starts from the first
+ * interval and then the interval farthest from the centres so far, so
+ * the same run always gives the same clusters. The number of clusters is
+ * the smallest that takes away 90% of the spread that the most clusters
+ * take away, much like SimPoint picks it by BIC.
+ **********************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+#include "simpoint.h"
+
+#define MAX_ITERATIONS      100
+#define INITIAL_CAPACITY    256
+
+int simpoint_init(struct simpoint *simpoint, uint64_t interval_length)
+{
+    memset(simpoint, 0, sizeof(*simpoint));
+    simpoint->interval_length = interval_length ? interval_length : 1;
+    return 0;
+}
+
+static int __grow(struct simpoint *simpoint)
+{
+    uint64_t capacity = simpoint->capacity ? simpoint->capacity * 2 : INITIAL_CAPACITY;
+    float *vectors = realloc(simpoint->vectors, capacity * SIMPOINT_DIMENSIONS * sizeof(*vectors));
+    uint64_t *lengths;
+
+    if (!vectors) return -1;
+    simpoint->vectors = vectors;
+
+    lengths = realloc(simpoint->lengths, capacity * sizeof(*lengths));
+    if (!lengths) return -1;
+    simpoint->lengths = lengths;
+
+    simpoint->capacity = capacity;
+    return 0;
+}
+
+/* One of the SIMPOINT_DIMENSIONS, which are 1 << 5 */
+static inline unsigned int __dimension(uint32_t block)
+{
+    return ((block >> 2) * 0x9e3779b1u) >> (32 - 5);
+}
+
+int simpoint_count(struct simpoint *simpoint, uint32_t block)
+{
+    uint64_t i;
+
+    if (simpoint->nr_instructions % simpoint->interval_length == 0) {
+        if (simpoint->nr_intervals == simpoint->capacity && __grow(simpoint)) return -1;
+
+        i = simpoint->nr_intervals++;
+        memset(simpoint->vectors + i * SIMPOINT_DIMENSIONS, 0, SIMPOINT_DIMENSIONS * sizeof(float));
+        simpoint->lengths[i] = 0;
+    }
+
+    i = simpoint->nr_intervals - 1;
+    simpoint->vectors[i * SIMPOINT_DIMENSIONS + __dimension(block)] += 1;
+    simpoint->lengths[i]++;
+    simpoint->nr_instructions++;
+    return 0;
+}
+
+static double __distance(const float *vector, const double *centre)
+{
+    double sum = 0;
+
+    for (int d = 0; d < SIMPOINT_DIMENSIONS; d++) {
+        double delta = vector[d] - centre[d];
+        sum += delta * delta;
+    }
+    return sum;
+}
+
+/* The centre of each of the @k clusters of @clusters into @centres */
+static void __centres(const struct simpoint *simpoint, const int *clusters, int k, double *centres)
+{
+    uint64_t counts[SIMPOINT_MAX_CLUSTERS] = { 0 };
+
+    memset(centres, 0, k * SIMPOINT_DIMENSIONS * sizeof(*centres));
+    for (uint64_t i = 0; i < simpoint->nr_intervals; i++) {
+        const float *vector = simpoint->vectors + i * SIMPOINT_DIMENSIONS;
+        double *centre = centres + clusters[i] * SIMPOINT_DIMENSIONS;
+
+        for (int d = 0; d < SIMPOINT_DIMENSIONS; d++) centre[d] += vector[d];
+        counts[clusters[i]]++;
+    }
+
+    for (int c = 0; c < k; c++) {
+        for (int d = 0; d < SIMPOINT_DIMENSIONS && counts[c]; d++) {
+            centres[c * SIMPOINT_DIMENSIONS + d] /= counts[c];
+        }
+    }
+}
+
+/* Cluster the intervals into @k clusters. Returns the sum of the squared distances to the centres */
+static double __kmeans(const struct simpoint *simpoint, int k, int *clusters)
+{
+    const uint64_t n = simpoint->nr_intervals;
+    double centres[SIMPOINT_MAX_CLUSTERS * SIMPOINT_DIMENSIONS];
+    double spread = 0;
+    int changed = 1;
+
+    /* The first interval, then the farthest from the centres so far */
+    for (int c = 0; c < k; c++) {
+        uint64_t farthest = 0;
+        double farthest_distance = -1;
+
+        for (uint64_t i = 0; i < n && c; i++) {
+            double nearest = DBL_MAX;
+
+            for (int j = 0; j < c; j++) {
+                double distance = __distance(simpoint->vectors + i * SIMPOINT_DIMENSIONS,
+                        centres + j * SIMPOINT_DIMENSIONS);
+                if (distance < nearest) nearest = distance;
+            }
+            if (nearest > farthest_distance) {
+                farthest = i;
+                farthest_distance = nearest;
+            }
+        }
+        for (int d = 0; d < SIMPOINT_DIMENSIONS; d++) {
+            centres[c * SIMPOINT_DIMENSIONS + d] = simpoint->vectors[farthest * SIMPOINT_DIMENSIONS + d];
+        }
+    }
+
+    for (uint64_t i = 0; i < n; i++) clusters[i] = -1;
+
+    for (int iteration = 0; iteration < MAX_ITERATIONS && changed; iteration++) {
+        changed = 0;
+        spread = 0;
+
+        for (uint64_t i = 0; i < n; i++) {
+            double nearest = DBL_MAX;
+            int cluster = 0;
+
+            for (int c = 0; c < k; c++) {
+                double distance = __distance(simpoint->vectors + i * SIMPOINT_DIMENSIONS,
+                        centres + c * SIMPOINT_DIMENSIONS);
+                if (distance < nearest) {
+                    nearest = distance;
+                    cluster = c;
+                }
+            }
+            if (clusters[i] != cluster) changed = 1;
+            clusters[i] = cluster;
+            spread += nearest;
+        }
+
+        if (changed) __centres(simpoint, clusters, k, centres);
+    }
+    return spread;
+}
+
+int simpoint_cluster(struct simpoint *simpoint, int max_clusters)
+{
+    const uint64_t n = simpoint->nr_intervals;
+    double spreads[SIMPOINT_MAX_CLUSTERS + 1];
+    int *candidates;
+    int k;
+
+    free(simpoint->clusters);
+    simpoint->clusters = NULL;
+    simpoint->nr_clusters = 0;
+    if (!n) return 0;
+
+    /* Intervals compare by where their instructions went, not by how many there were */
+    for (uint64_t i = 0; i < n; i++) {
+        float *vector = simpoint->vectors + i * SIMPOINT_DIMENSIONS;
+        float sum = 0;
+
+        for (int d = 0; d < SIMPOINT_DIMENSIONS; d++) sum += vector[d];
+        for (int d = 0; d < SIMPOINT_DIMENSIONS && sum > 0; d++) vector[d] /= sum;
+    }
+
+    if (max_clusters > SIMPOINT_MAX_CLUSTERS) max_clusters = SIMPOINT_MAX_CLUSTERS;
+    if ((uint64_t)max_clusters > n) max_clusters = n;
+    if (max_clusters < 1) max_clusters = 1;
+
+    candidates = malloc(max_clusters * n * sizeof(*candidates));
+    simpoint->clusters = malloc(n * sizeof(*simpoint->clusters));
+    if (!candidates || !simpoint->clusters) {
+        free(candidates);
+        free(simpoint->clusters);
+        simpoint->clusters = NULL;
+        return 0;
+    }
+
+    for (k = 1; k <= max_clusters; k++) {
+        spreads[k] = __kmeans(simpoint, k, candidates + (k - 1) * n);
+    }
+
+    for (k = 1; k < max_clusters; k++) {
+        if (spreads[k] - spreads[max_clusters] <= 0.1 * (spreads[1] - spreads[max_clusters])) break;
+    }
+
+    memcpy(simpoint->clusters, candidates + (k - 1) * n, n * sizeof(*simpoint->clusters));
+    simpoint->nr_clusters = k;
+    free(candidates);
+    return k;
+}
+
+static int __by_interval(const void *a, const void *b)
+{
+    const struct simpoint_sample *x = a, *y = b;
+
+    return x->interval < y->interval ? -1 : x->interval > y->interval;
+}
+
+static void __add_sample(const struct simpoint *simpoint, uint64_t interval, struct simpoint_sample *sample)
+{
+    sample->interval = interval;
+    sample->start = interval * simpoint->interval_length;
+    sample->length = simpoint->lengths[interval];
+    sample->cluster = simpoint->clusters[interval];
+    sample->cpi = 0;
+}
+
+int simpoint_choose(const struct simpoint *simpoint, int per_cluster, struct simpoint_sample **samples)
+{
+    const uint64_t n = simpoint->nr_intervals;
+    double centres[SIMPOINT_MAX_CLUSTERS * SIMPOINT_DIMENSIONS];
+    uint64_t *members;
+    int nr_samples = 0;
+
+    *samples = NULL;
+    if (!simpoint->clusters) return 0;
+    if (per_cluster < 1) per_cluster = 1;
+
+    members = malloc(n * sizeof(*members));
+    *samples = malloc((size_t)simpoint->nr_clusters * per_cluster * sizeof(**samples));
+    if (!members || !*samples) {
+        free(members);
+        free(*samples);
+        *samples = NULL;
+        return -1;
+    }
+
+    __centres(simpoint, simpoint->clusters, simpoint->nr_clusters, centres);
+
+    for (int c = 0; c < simpoint->nr_clusters; c++) {
+        const double *centre = centres + c * SIMPOINT_DIMENSIONS;
+        uint64_t nr_members = 0, nearest = 0, nr_others;
+        double nearest_distance = DBL_MAX;
+        int nr_more;
+
+        for (uint64_t i = 0; i < n; i++) {
+            double distance;
+
+            if (simpoint->clusters[i] != c) continue;
+
+            distance = __distance(simpoint->vectors + i * SIMPOINT_DIMENSIONS, centre);
+            if (distance < nearest_distance) {
+                nearest = nr_members;
+                nearest_distance = distance;
+            }
+            members[nr_members++] = i;
+        }
+        if (!nr_members) continue;
+
+        __add_sample(simpoint, members[nearest], &(*samples)[nr_samples++]);
+
+        /* The rest spread evenly over the other members */
+        memmove(members + nearest, members + nearest + 1, (nr_members - nearest - 1) * sizeof(*members));
+        nr_others = nr_members - 1;
+        nr_more = (uint64_t)(per_cluster - 1) < nr_others ? per_cluster - 1 : (int)nr_others;
+        for (int j = 0; j < nr_more; j++) {
+            __add_sample(simpoint, members[(2 * j + 1) * nr_others / (2 * nr_more)], &(*samples)[nr_samples++]);
+        }
+    }
+
+    free(members);
+    qsort(*samples, nr_samples, sizeof(**samples), __by_interval);
+    return nr_samples;
+}
+
+double simpoint_estimate(const struct simpoint *simpoint, const struct simpoint_sample *samples,
+        int nr_samples, double *error)
+{
+    double cpi = 0, variance = 0;
+    int exact = 1;
+
+    for (int c = 0; c < simpoint->nr_clusters; c++) {
+        uint64_t nr_members = 0, nr_instructions = 0;
+        double weight, sum = 0, squares = 0, mean;
+        int n = 0;
+
+        for (uint64_t i = 0; i < simpoint->nr_intervals; i++) {
+            if (simpoint->clusters[i] != c) continue;
+            nr_members++;
+            nr_instructions += simpoint->lengths[i];
+        }
+        for (int i = 0; i < nr_samples; i++) {
+            if (samples[i].cluster != c) continue;
+            sum += samples[i].cpi;
+            n++;
+        }
+        if (!n || !simpoint->nr_instructions) continue;
+
+        weight = (double)nr_instructions / simpoint->nr_instructions;
+        mean = sum / n;
+        cpi += weight * mean;
+
+        if (n == 1) {
+            if (nr_members > 1) exact = 0;
+            continue;
+        }
+        for (int i = 0; i < nr_samples; i++) {
+            if (samples[i].cluster == c) squares += (samples[i].cpi - mean) * (samples[i].cpi - mean);
+        }
+        /* With the finite population correction, as the members are drawn without replacement */
+        variance += weight * weight * squares / (n - 1) / n * (1 - (double)n / nr_members);
+    }
+
+    *error = exact ? sqrt(variance) : -1;
+    return cpi;
+}
+
+void simpoint_free(struct simpoint *simpoint)
+{
+    free(simpoint->vectors);
+    free(simpoint->lengths);
+    free(simpoint->clusters);
+    memset(simpoint, 0, sizeof(*simpoint));
+}
@@ -0,0 +1,82 @@
+/**********************************************************************
+ * simpoint.h
+ *
+ * Pick the intervals of a run that stand for all of it, after SimPoint.
+ * A functional run is cut into intervals of as many instructions, and a
+ * basic block vector (BBV) is kept for each: how many instructions each
+ * basic block ran in the interval, hashed down to SIMPOINT_DIMENSIONS.
+ * The vectors are clustered with k-means, and a few intervals of each
+ * cluster are then simulated in detail. The CPI of the run is the mean
+ * CPI of the samples of each cluster, weighted by the instructions of the
+ * cluster. Its standard error comes from the spread of the samples within
+ * each cluster, as in stratified sampling.
+ *
+ *   struct simpoint simpoint;
+ *
+ *   simpoint_init(&simpoint, 10000);
+ *   for (each instruction) simpoint_count(&simpoint, start of its block);
+ *   simpoint_cluster(&simpoint, 8);
+ *   nr_samples = simpoint_choose(&simpoint, 3, &samples);
+ *   (simulate each of samples[] in detail, setting its cpi)
+ *   cpi = simpoint_estimate(&simpoint, samples, nr_samples, &error);
+ **********************************************************************/
+#ifndef __SIMPOINT_H__
+#define __SIMPOINT_H__
+
+#include <stdint.h>
+
+#define SIMPOINT_DIMENSIONS     32
+#define SIMPOINT_MAX_CLUSTERS   32
+
+struct simpoint_sample {
+    uint64_t interval;
+    uint64_t start;          /* Instructions run before the interval */
+    uint64_t length;
+    int cluster;
+    double cpi;              /* Filled in by the caller */
+};
+
+struct simpoint {
+    uint64_t interval_length;
+    uint64_t nr_instructions;
+    uint64_t nr_intervals;
+    uint64_t capacity;       /* Of the arrays below, in intervals */
+
+    float *vectors;          /* vectors[interval * SIMPOINT_DIMENSIONS + dimension] */
+    uint64_t *lengths;       /* Of each interval. Only the last may be short */
+    int *clusters;           /* Of each interval */
+    int nr_clusters;
+};
+
+/* Returns 0, or -1 if out of memory */
+int simpoint_init(struct simpoint *simpoint, uint64_t interval_length);
+
+/* Count an instruction of the basic block starting at @block. Returns 0, or -1 if out of memory */
+int simpoint_count(struct simpoint *simpoint, uint32_t block);
+
+/*
+ * Cluster the intervals into at most @max_clusters clusters. Fewer are
+ * taken when they explain the vectors nearly as well. Returns the number
+ * of clusters
+ */
+int simpoint_cluster(struct simpoint *simpoint, int max_clusters);
+
+/*
+ * The intervals to simulate in detail: the one nearest to the centre of
+ * each cluster and up to @per_cluster - 1 more of it, in the order they
+ * run. @*samples is to be freed by the caller. Returns the number of
+ * samples, or -1 if out of memory
+ */
+int simpoint_choose(const struct simpoint *simpoint, int per_cluster, struct simpoint_sample **samples);
+
+/*
+ * The CPI of the whole run from the CPI of @samples. Its standard error
+ * is put into @error, which is negative when a cluster has a single
+ * sample to tell its spread from.
+ */
+double simpoint_estimate(const struct simpoint *simpoint, const struct simpoint_sample *samples,
+        int nr_samples, double *error);
+
+void simpoint_free(struct simpoint *simpoint);
+
+#endif
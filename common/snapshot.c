@@ -0,0 +1,244 @@
+/**********************************************************************
+ * snapshot.c
+ *
+ * Snapshots and the PackBits codec of their pages. A PackBits stream is
+ * a run of packets, each led by a signed byte n: 0..127 is followed by
+ * n + 1 bytes as they are, -127..-1 by one byte that repeats 1 - n
+ * times. Memory is mostly runs of zeros, so pages shrink a lot.
+ **********************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "image.h"
+#include "snapshot.h"
+
+#define MAX_PACKET      128
+#define MAX_PACKED      (SNAPSHOT_PAGE_SIZE + SNAPSHOT_PAGE_SIZE / MAX_PACKET + 1)
+
+/* Pack the @size bytes at @src into @dst, which has room for MAX_PACKED. Returns the size packed */
+static size_t __pack(const unsigned char *src, size_t size, unsigned char *dst)
+{
+    unsigned char *p = dst;
+    size_t i = 0;
+
+    while (i < size) {
+        size_t run = 1, start = i;
+
+        while (i + run < size && run < MAX_PACKET && src[i + run] == src[i]) run++;
+
+        if (run > 1) {
+            *p++ = (unsigned char)(1 - (int)run);
+            *p++ = src[i];
+            i += run;
+            continue;
+        }
+
+        /* Bytes as they are, up to where a run starts */
+        for (i++; i < size && i - start < MAX_PACKET; i++) {
+            if (i + 1 < size && src[i] == src[i + 1]) break;
+        }
+        *p++ = i - start - 1;
+        memcpy(p, src + start, i - start);
+        p += i - start;
+    }
+    return p - dst;
+}
+
+/* Unpack the @size bytes at @src into exactly @length bytes at @dst. Returns 0, or -1 if they do not fit */
+static int __unpack(const unsigned char *src, size_t size, unsigned char *dst, size_t length)
+{
+    const unsigned char *end = src + size;
+    size_t filled = 0;
+
+    while (src < end) {
+        int n = (signed char)*src++;
+
+        if (n >= 0) {
+            if ((size_t)(end - src) < (size_t)n + 1 || length - filled < (size_t)n + 1) return -1;
+            memcpy(dst + filled, src, n + 1);
+            src += n + 1;
+            filled += n + 1;
+        } else if (n != -128) {
+            if (src == end || length - filled < (size_t)(1 - n)) return -1;
+            memset(dst + filled, *src++, 1 - n);
+            filled += 1 - n;
+        }
+    }
+    return filled == length ? 0 : -1;
+}
+
+static size_t __page_length(const struct snapshot_state *state, size_t index)
+{
+    size_t offset = index * SNAPSHOT_PAGE_SIZE;
+
+    return state->size - offset < SNAPSHOT_PAGE_SIZE ? state->size - offset : SNAPSHOT_PAGE_SIZE;
+}
+
+static int __write_all(int fd, const unsigned char *data, size_t size)
+{
+    while (size) {
+        ssize_t written = write(fd, data, size);
+
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += written;
+        size -= written;
+    }
+    return 0;
+}
+
+int snapshot_save(const char *path, const struct snapshot_state *state)
+{
+    const size_t nr_pages = (state->size + SNAPSHOT_PAGE_SIZE - 1) / SNAPSHOT_PAGE_SIZE;
+    const size_t table = SNAPSHOT_HEADER_SIZE + state->nr_registers * 4;
+    unsigned char *buffer, *p;
+    size_t nr_stored = 0;
+    int fd, ret;
+
+    /* Room for every page stored and the table of all of them */
+    buffer = malloc(table + nr_pages * (SNAPSHOT_ENTRY_SIZE + MAX_PACKED));
+    if (!buffer) return -1;
+
+    image_store32(buffer + 0, SNAPSHOT_MAGIC);
+    image_store32(buffer + 4, SNAPSHOT_VERSION);
+    image_store32(buffer + 8, *state->pc);
+    image_store32(buffer + 12, state->nr_registers);
+    image_store32(buffer + 16, state->size);
+    for (int i = 0; i < state->nr_registers; i++) {
+        image_store32(buffer + SNAPSHOT_HEADER_SIZE + i * 4, state->registers[i]);
+    }
+
+    for (size_t i = 0; i < nr_pages; i++) {
+        nr_stored += !!memcmp(state->memory + i * SNAPSHOT_PAGE_SIZE,
+                state->pristine + i * SNAPSHOT_PAGE_SIZE, __page_length(state, i));
+    }
+    image_store32(buffer + 20, nr_stored);
+
+    p = buffer + table + nr_stored * SNAPSHOT_ENTRY_SIZE;
+    for (size_t i = 0, j = 0; i < nr_pages; i++) {
+        const unsigned char *page = state->memory + i * SNAPSHOT_PAGE_SIZE;
+        unsigned char *entry = buffer + table + j * SNAPSHOT_ENTRY_SIZE;
+        size_t length = __page_length(state, i), size;
+
+        if (!memcmp(page, state->pristine + i * SNAPSHOT_PAGE_SIZE, length)) continue;
+
+        size = __pack(page, length, p);
+        if (size >= length) {
+            memcpy(p, page, length);
+            size = length;
+        }
+        image_store32(entry + 0, i);
+        image_store32(entry + 4, p - buffer);
+        image_store32(entry + 8, size);
+        p += size;
+        j++;
+    }
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ret = fd < 0 ? -1 : __write_all(fd, buffer, p - buffer);
+    if (fd >= 0 && close(fd)) ret = -1;
+
+    free(buffer);
+    return ret ? -1 : (int)nr_stored;
+}
+
+/* Returns 0 if the page at @i in the table of @data is sound, decoding it into @scratch */
+static int __check_entry(const unsigned char *data, size_t file_size, size_t table,
+        uint32_t i, const struct snapshot_state *state, unsigned char *scratch)
+{
+    const unsigned char *entry = data + table + (size_t)i * SNAPSHOT_ENTRY_SIZE;
+    uint32_t index = image_load32(entry), offset = image_load32(entry + 4), size = image_load32(entry + 8);
+    size_t length;
+
+    if ((size_t)index * SNAPSHOT_PAGE_SIZE >= state->size) return -1;
+    if (offset > file_size || size > file_size - offset) return -1;
+
+    length = __page_length(state, index);
+    if (size == length) return 0;
+    return __unpack(data + offset, size, scratch, length);
+}
+
+int snapshot_restore(const char *path, struct snapshot_state *state)
+{
+    const size_t nr_pages = (state->size + SNAPSHOT_PAGE_SIZE - 1) / SNAPSHOT_PAGE_SIZE;
+    const size_t table = SNAPSHOT_HEADER_SIZE + state->nr_registers * 4;
+    unsigned char scratch[SNAPSHOT_PAGE_SIZE];
+    unsigned char *data, *stored = NULL;
+    struct stat st;
+    uint32_t nr_stored = 0;
+    int fd, ret = -1;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size < SNAPSHOT_HEADER_SIZE) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return -1;
+
+    errno = EINVAL;
+    if (image_load32(data) != SNAPSHOT_MAGIC || image_load32(data + 4) != SNAPSHOT_VERSION ||
+            image_load32(data + 12) != (uint32_t)state->nr_registers ||
+            image_load32(data + 16) != state->size) {
+        goto out;
+    }
+
+    nr_stored = image_load32(data + 20);
+    if (nr_stored > nr_pages || table + (size_t)nr_stored * SNAPSHOT_ENTRY_SIZE > (size_t)st.st_size) goto out;
+
+    for (uint32_t i = 0; i < nr_stored; i++) {
+        if (__check_entry(data, st.st_size, table, i, state, scratch)) goto out;
+    }
+
+    stored = calloc(nr_pages, 1);
+    if (!stored) {
+        errno = ENOMEM;
+        goto out;
+    }
+
+    /* The file is sound, so nothing below can fail */
+    for (uint32_t i = 0; i < nr_stored; i++) {
+        const unsigned char *entry = data + table + (size_t)i * SNAPSHOT_ENTRY_SIZE;
+        uint32_t index = image_load32(entry), offset = image_load32(entry + 4), size = image_load32(entry + 8);
+        size_t length = __page_length(state, index);
+        unsigned char *page = state->memory + (size_t)index * SNAPSHOT_PAGE_SIZE;
+
+        if (size == length) {
+            memcpy(page, data + offset, length);
+        } else {
+            __unpack(data + offset, size, page, length);
+        }
+        stored[index] = 1;
+    }
+
+    for (size_t i = 0; i < nr_pages; i++) {
+        if (stored[i]) continue;
+        memcpy(state->memory + i * SNAPSHOT_PAGE_SIZE, state->pristine + i * SNAPSHOT_PAGE_SIZE,
+                __page_length(state, i));
+    }
+
+    *state->pc = image_load32(data + 8);
+    for (int i = 0; i < state->nr_registers; i++) {
+        state->registers[i] = image_load32(data + SNAPSHOT_HEADER_SIZE + i * 4);
+    }
+    ret = nr_stored;
+
+out:
+    free(stored);
+    munmap(data, st.st_size);
+    return ret;
+}
@@ -0,0 +1,57 @@
+/**********************************************************************
+ * snapshot.h
+ *
+ * Save the state of a machine to a file and bring it back. Only the pages
+ * of memory that differ from @pristine, the contents the machine powers
+ * on with, are stored, each compressed with PackBits. Restoring maps the
+ * file and decodes the pages straight from the mapping. The pages that
+ * are not in the file are set back to @pristine.
+ *
+ *   +---------------------------------------+  0
+ *   | magic version pc nr_registers         |
+ *   | memory_size nr_pages                  |
+ *   +---------------------------------------+  SNAPSHOT_HEADER_SIZE
+ *   | registers                             |  x nr_registers
+ *   +---------------------------------------+
+ *   | index offset size                     |  x nr_pages
+ *   +---------------------------------------+
+ *   | compressed pages ...                  |  at their offsets
+ *   +---------------------------------------+
+ *
+ * Every field is a 32-bit big-endian word, as in image.h. A page whose
+ * size is SNAPSHOT_PAGE_SIZE is stored as it is.
+ **********************************************************************/
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SNAPSHOT_MAGIC          0x7f434b50u    /* "\177CKP" */
+#define SNAPSHOT_VERSION        1
+
+#define SNAPSHOT_HEADER_SIZE    24
+#define SNAPSHOT_ENTRY_SIZE     12
+#define SNAPSHOT_PAGE_SIZE      4096
+
+struct snapshot_state {
+    uint32_t *registers;
+    int nr_registers;
+    uint32_t *pc;
+    unsigned char *memory;
+    const unsigned char *pristine;    /* What @memory holds at power-on */
+    size_t size;                      /* Of @memory and @pristine */
+};
+
+/* Write @state to @path. Returns the number of pages stored, or -1 with errno set */
+int snapshot_save(const char *path, const struct snapshot_state *state);
+
+/*
+ * Bring @state back from @path. The file is checked as a whole before
+ * any of @state is touched. Returns the number of pages restored, or -1
+ * with errno set. EINVAL means the file is not a snapshot of a machine
+ * like @state.
+ */
+int snapshot_restore(const char *path, struct snapshot_state *state);
+
+#endif
@@ -0,0 +1,121 @@
+/**********************************************************************
+ * symbol.c
+ *
+ * Name pools and symbol tables. See symbol.h for the interface.
+ **********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "symbol.h"
+
+#define INITIAL_SLOTS    1024
+
+static void *__alloc_or_die(void *p)
+{
+    if (!p) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+char *name_pool_strdup(struct name_pool *pool, const char *name)
+{
+    size_t size = strlen(name) + 1;
+    char *copy = pool->blocks ? arena_alloc(&pool->blocks->arena, size) : NULL;
+
+    if (!copy) {
+        size_t block_size = arena_aligned(size) > NAME_BLOCK_SIZE ? arena_aligned(size) : NAME_BLOCK_SIZE;
+        struct name_block *block = __alloc_or_die(malloc(sizeof(*block) + block_size));
+
+        arena_init(&block->arena, block + 1, block_size);
+        block->next = pool->blocks;
+        pool->blocks = block;
+        copy = arena_alloc(&block->arena, size);
+    }
+
+    return memcpy(copy, name, size);
+}
+
+void name_pool_free(struct name_pool *pool)
+{
+    while (pool->blocks) {
+        struct name_block *block = pool->blocks;
+        pool->blocks = block->next;
+        free(block);
+    }
+}
+
+/* FNV-1a */
+static uint32_t __hash_name(const char *name)
+{
+    uint32_t hash = 2166136261u;
+
+    while (*name) hash = (hash ^ (unsigned char)*name++) * 16777619u;
+    return hash;
+}
+
+static struct symbol *__symbol_slot(struct symbol *symbols, size_t nr_slots, const char *name, uint32_t hash)
+{
+    for (size_t i = hash & (nr_slots - 1); ; i = (i + 1) & (nr_slots - 1)) {
+        struct symbol *symbol = &symbols[i];
+
+        if (!symbol->name || (symbol->hash == hash && strcmp(symbol->name, name) == 0))
+            return symbol;
+    }
+}
+
+struct symbol_table *symbol_table_create(void)
+{
+    struct symbol_table *table = __alloc_or_die(calloc(1, sizeof(*table)));
+
+    table->symbols = __alloc_or_die(calloc(INITIAL_SLOTS, sizeof(struct symbol)));
+    table->nr_slots = INITIAL_SLOTS;
+    return table;
+}
+
+void symbol_table_destroy(struct symbol_table *table)
+{
+    name_pool_free(&table->names);
+    free(table->symbols);
+    free(table);
+}
+
+void symbol_define(struct symbol_table *table, const char *name, int32_t value)
+{
+    uint32_t hash = __hash_name(name);
+    struct symbol *symbol;
+
+    if ((table->nr_symbols + 1) * 2 > table->nr_slots) {
+        size_t nr_slots = table->nr_slots * 2;
+        struct symbol *symbols = __alloc_or_die(calloc(nr_slots, sizeof(struct symbol)));
+
+        for (size_t i = 0; i < table->nr_slots; i++) {
+            struct symbol *old = &table->symbols[i];
+            if (old->name) *__symbol_slot(symbols, nr_slots, old->name, old->hash) = *old;
+        }
+
+        free(table->symbols);
+        table->symbols = symbols;
+        table->nr_slots = nr_slots;
+    }
+
+    symbol = __symbol_slot(table->symbols, table->nr_slots, name, hash);
+    if (!symbol->name) {
+        symbol->name = name_pool_strdup(&table->names, name);
+        symbol->hash = hash;
+        table->nr_symbols++;
+    }
+    symbol->value = value;
+}
+
+int symbol_find(const struct symbol_table *table, const char *name, int32_t *value)
+{
+    struct symbol *symbol = __symbol_slot(table->symbols, table->nr_slots, name, __hash_name(name));
+
+    if (!symbol->name) return 0;
+
+    *value = symbol->value;
+    return 1;
+}
@@ -0,0 +1,57 @@
+/**********************************************************************
+ * symbol.h
+ *
+ * Symbol tables for the assemblers. A table maps label names to their
+ * values through open addressing, and keeps the names in a pool of
+ * blocks that is released with the table, so defining a symbol does not
+ * call malloc() per name.
+ *
+ *   struct symbol_table *labels = symbol_table_create();
+ *   symbol_define(labels, "loop", 0x1000);
+ *   if (symbol_find(labels, "loop", &value)) ...
+ **********************************************************************/
+#ifndef __SYMBOL_H__
+#define __SYMBOL_H__
+
+#include <stdint.h>
+
+#include "arena.h"
+
+#define NAME_BLOCK_SIZE    (64 << 10)
+
+struct name_block {
+    struct name_block *next;
+    struct arena arena;
+};
+
+/* Interned strings, all freed at once by name_pool_free() */
+struct name_pool {
+    struct name_block *blocks;
+};
+
+char *name_pool_strdup(struct name_pool *pool, const char *name);
+void name_pool_free(struct name_pool *pool);
+
+struct symbol {
+    const char *name;    /* NULL for an empty slot */
+    uint32_t hash;
+    int32_t value;
+};
+
+struct symbol_table {
+    struct symbol *symbols;
+    size_t nr_slots;     /* Power of 2, at least twice nr_symbols */
+    size_t nr_symbols;
+    struct name_pool names;
+};
+
+struct symbol_table *symbol_table_create(void);
+void symbol_table_destroy(struct symbol_table *table);
+
+/* Define @name as @value. A symbol defined again takes the new value */
+void symbol_define(struct symbol_table *table, const char *name, int32_t value);
+
+/* Returns 1 and the value of @name in @value if it is defined, 0 otherwise */
+int symbol_find(const struct symbol_table *table, const char *name, int32_t *value);
+
+#endif
@@ -0,0 +1,271 @@
+/**********************************************************************
+ * tokenizer.c
+ *
+ * The SIMD and scalar tokenizers. The vector loads are aligned, so a load
+ * never crosses into the page after the one the line ends in even when it
+ * reads past the '\0'. Build with -DTOKENIZER_SCALAR to use the scalar
+ * loop on x86 too.
+ **********************************************************************/
+#include <stdint.h>
+
+#if !defined(TOKENIZER_SCALAR) && (defined(__AVX2__) || defined(__SSE2__))
+#include <immintrin.h>
+#endif
+
+#include "tokenizer.h"
+
+/* The vector loads may read the bytes around the line, which is fine */
+#if defined(__GNUC__)
+#define __whole_blocks __attribute__((no_sanitize_address))
+#else
+#define __whole_blocks
+#endif
+
+struct scan {
+    token_fn fn;
+    void *data;
+    char *start;          /* Of the token being scanned */
+    int nr_tokens;
+    uint32_t in_token;    /* Whether the last byte scanned is in a token */
+};
+
+/* Terminate the token being scanned at @end and hand it out. Returns nonzero to stop */
+static inline int __emit(struct scan *scan, char *end)
+{
+    *end = '\0';
+    scan->nr_tokens++;
+    return scan->fn(scan->start, scan->data);
+}
+
+/* Lowercase the @uppers of the block at @block one by one */
+static inline void __fold_bytes(char *block, uint32_t uppers)
+{
+    for (; uppers; uppers &= uppers - 1) block[__builtin_ctz(uppers)] |= 0x20;
+}
+
+/*
+ * Hand out the tokens that end in the @width bytes at @block, which may
+ * have started in an earlier block. @separators has a bit set for each
+ * byte that is not in a token, and @end for each byte that ends the line.
+ * The bytes of @uppers are lowercased up to each token before it is handed
+ * out, so none after a token that stops @scan is. Returns nonzero once the
+ * line is over or @scan is stopped.
+ */
+static inline int __scan_block(struct scan *scan, char *block, int width,
+        uint32_t separators, uint32_t end, uint32_t uppers)
+{
+    const uint32_t all = width == 32 ? 0xffffffffu : (1u << width) - 1;
+    uint32_t in_tokens, starts, ends;
+
+    /* Nothing from the end of the line on is in a token */
+    if (end) separators |= all & ~((end & -end) - 1);
+
+    in_tokens = ~separators & all;
+    starts = in_tokens & ~(in_tokens << 1 | scan->in_token);
+    ends = separators & (in_tokens << 1 | scan->in_token);
+
+    for (uint32_t events = starts | ends; events; events &= events - 1) {
+        int i = __builtin_ctz(events);
+
+        if (ends >> i & 1) {
+            const uint32_t before_end = (1u << i) - 1;
+
+            __fold_bytes(block, uppers & before_end);
+            uppers &= ~before_end;
+            if (__emit(scan, block + i)) return 1;
+        } else {
+            scan->start = block + i;
+        }
+    }
+    __fold_bytes(block, uppers);
+
+    if (end) {
+        block[__builtin_ctz(end)] = '\0';
+        return 1;
+    }
+    scan->in_token = in_tokens >> (width - 1);
+    return 0;
+}
+
+/*
+ * The first slash of each "//" among @slashes. The pair may straddle the
+ * block, and the byte after it is read only when the line is known to go
+ * on past the block, which @nul tells.
+ */
+static inline uint32_t __slash_pairs(uint32_t slashes, uint32_t nul, const char *block, int width)
+{
+    uint32_t pairs = slashes & slashes >> 1;
+
+    if (!nul && (slashes >> (width - 1) & 1) && block[width] == '/') {
+        pairs |= 1u << (width - 1);
+    }
+    return pairs;
+}
+
+/* The bytes of a block of @width that are in the line, after @before and up to @end */
+static inline uint32_t __line_bytes(int width, uint32_t before, uint32_t end)
+{
+    const uint32_t all = width == 32 ? 0xffffffffu : (1u << width) - 1;
+
+    return (end ? (end & -end) - 1 : all) & ~before;
+}
+
+#if !defined(TOKENIZER_SCALAR) && defined(__AVX2__)
+__whole_blocks
+static void __tokenize_avx2(const struct tokenizer *tokenizer, char *line, struct scan *scan)
+{
+    char *block = (char *)((uintptr_t)line & ~(uintptr_t)31);
+    uint32_t before = (1u << (line - block)) - 1;    /* Not part of @line */
+
+    for (;; block += 32, before = 0) {
+        const __m256i bytes = _mm256_load_si256((const __m256i *)block);
+        uint32_t separators = before, nul, end, uppers = 0;
+
+        for (int i = 0; i < tokenizer->nr_separators; i++) {
+            const __m256i c = _mm256_set1_epi8(tokenizer->separators[i]);
+            separators |= (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, c));
+        }
+
+        nul = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_setzero_si256()));
+        nul &= ~before;
+        end = nul;
+        if (tokenizer->flags & TOKENIZER_HASH_COMMENTS) {
+            end |= (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('#')));
+        }
+        if (tokenizer->flags & TOKENIZER_SLASH_COMMENTS) {
+            uint32_t slashes = _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('/')));
+            end |= __slash_pairs(slashes, nul, block, 32);
+        }
+        end &= ~before;
+
+        /* A block that is all inside a token is stored whole, as no token ends in it */
+        if (tokenizer->flags & TOKENIZER_FOLD_CASE) {
+            const __m256i upper = _mm256_and_si256(
+                    _mm256_cmpgt_epi8(bytes, _mm256_set1_epi8('A' - 1)),
+                    _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), bytes));
+
+            uppers = (uint32_t)_mm256_movemask_epi8(upper) & __line_bytes(32, before, end);
+            if (uppers && !(separators | end)) {
+                _mm256_store_si256((__m256i *)block,
+                        _mm256_or_si256(bytes, _mm256_and_si256(upper, _mm256_set1_epi8(0x20))));
+                uppers = 0;
+            }
+        }
+
+        if (__scan_block(scan, block, 32, separators, end, uppers)) return;
+    }
+}
+#elif !defined(TOKENIZER_SCALAR) && defined(__SSE2__)
+__whole_blocks
+static void __tokenize_sse2(const struct tokenizer *tokenizer, char *line, struct scan *scan)
+{
+    char *block = (char *)((uintptr_t)line & ~(uintptr_t)15);
+    uint32_t before = (1u << (line - block)) - 1;    /* Not part of @line */
+
+    for (;; block += 16, before = 0) {
+        const __m128i bytes = _mm_load_si128((const __m128i *)block);
+        uint32_t separators = before, nul, end, uppers = 0;
+
+        for (int i = 0; i < tokenizer->nr_separators; i++) {
+            const __m128i c = _mm_set1_epi8(tokenizer->separators[i]);
+            separators |= _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, c));
+        }
+
+        nul = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_setzero_si128())) & ~before;
+        end = nul;
+        if (tokenizer->flags & TOKENIZER_HASH_COMMENTS) {
+            end |= _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('#')));
+        }
+        if (tokenizer->flags & TOKENIZER_SLASH_COMMENTS) {
+            uint32_t slashes = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('/')));
+            end |= __slash_pairs(slashes, nul, block, 16);
+        }
+        end &= ~before;
+
+        /* A block that is all inside a token is stored whole, as no token ends in it */
+        if (tokenizer->flags & TOKENIZER_FOLD_CASE) {
+            const __m128i upper = _mm_and_si128(
+                    _mm_cmpgt_epi8(bytes, _mm_set1_epi8('A' - 1)),
+                    _mm_cmplt_epi8(bytes, _mm_set1_epi8('Z' + 1)));
+
+            uppers = _mm_movemask_epi8(upper) & __line_bytes(16, before, end);
+            if (uppers && !(separators | end)) {
+                _mm_store_si128((__m128i *)block,
+                        _mm_or_si128(bytes, _mm_and_si128(upper, _mm_set1_epi8(0x20))));
+                uppers = 0;
+            }
+        }
+
+        if (__scan_block(scan, block, 16, separators, end, uppers)) return;
+    }
+}
+#else
+static void __tokenize_scalar(const struct tokenizer *tokenizer, char *line, struct scan *scan)
+{
+    const char fold = tokenizer->flags & TOKENIZER_FOLD_CASE ? 0x20 : 0;
+
+    for (char *p = line; ; p++) {
+        *p |= fold & -((unsigned char)(*p - 'A') < 26);
+
+        if (*p == '\0' ||
+                ((tokenizer->flags & TOKENIZER_HASH_COMMENTS) && *p == '#') ||
+                ((tokenizer->flags & TOKENIZER_SLASH_COMMENTS) && p[0] == '/' && p[1] == '/')) {
+            if (scan->in_token) __emit(scan, p);
+            *p = '\0';
+            return;
+        }
+
+        if (tokenizer_separates(tokenizer, *p)) {
+            if (scan->in_token && __emit(scan, p)) return;
+            scan->in_token = 0;
+        } else if (!scan->in_token) {
+            scan->start = p;
+            scan->in_token = 1;
+        }
+    }
+}
+#endif
+
+int tokenize_each(const struct tokenizer *tokenizer, char *line, token_fn fn, void *data)
+{
+    struct scan scan = {
+        .fn = fn,
+        .data = data,
+    };
+
+#if !defined(TOKENIZER_SCALAR) && defined(__AVX2__)
+    __tokenize_avx2(tokenizer, line, &scan);
+#elif !defined(TOKENIZER_SCALAR) && defined(__SSE2__)
+    __tokenize_sse2(tokenizer, line, &scan);
+#else
+    __tokenize_scalar(tokenizer, line, &scan);
+#endif
+    return scan.nr_tokens;
+}
+
+struct token_array {
+    char **tokens;
+    int max_tokens;
+    int nr_tokens;
+};
+
+static int __store_token(char *token, void *data)
+{
+    struct token_array *array = data;
+
+    array->tokens[array->nr_tokens++] = token;
+    return array->nr_tokens == array->max_tokens;
+}
+
+int tokenize(const struct tokenizer *tokenizer, char *line, char *tokens[], int max_tokens)
+{
+    struct token_array array = {
+        .tokens = tokens,
+        .max_tokens = max_tokens,
+    };
+
+    if (max_tokens <= 0) return 0;
+
+    tokenize_each(tokenizer, line, __store_token, &array);
+    return array.nr_tokens;
+}
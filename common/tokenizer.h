@@ -0,0 +1,88 @@
+/**********************************************************************
+ * tokenizer.h
+ *
+ * Split a command or a line of assembly into tokens in place. The line is
+ * classified 32 (AVX2) or 16 (SSE2) bytes at a time with compare masks,
+ * and the starts and ends of the tokens are found in the masks with bit
+ * scans. A scalar loop does the same where neither is available. Each
+ * token is terminated by writing '\0' over the separator after it.
+ *
+ *   static const struct tokenizer tokenizer =
+ *       TOKENIZER(TOKENIZER_WHITESPACE, TOKENIZER_HASH_COMMENTS);
+ *
+ *   nr_tokens = tokenize(&tokenizer, line, tokens, MAX_NR_TOKENS);
+ *
+ * tokenize_each() hands the tokens to a callback instead, for lines with
+ * more tokens than any array would hold.
+ **********************************************************************/
+#ifndef __TOKENIZER_H__
+#define __TOKENIZER_H__
+
+#define TOKENIZER_WHITESPACE    " \t\n\v\f\r"
+
+enum tokenizer_flags {
+    TOKENIZER_HASH_COMMENTS = 0x1,    /* '#' to the end of the line */
+    TOKENIZER_SLASH_COMMENTS = 0x2,   /* "//" to the end of the line */
+    TOKENIZER_FOLD_CASE = 0x4,        /* 'A'-'Z' into 'a'-'z' in the same scan */
+};
+
+struct tokenizer {
+    const char *separators;
+    int nr_separators;
+    int flags;
+};
+
+#define TOKENIZER(separators, flags) { separators, sizeof(separators) - 1, flags }
+
+/* Whether @c separates tokens. '\0' is not a separator but ends the line */
+static inline int tokenizer_separates(const struct tokenizer *tokenizer, char c)
+{
+    for (int i = 0; i < tokenizer->nr_separators; i++) {
+        if (tokenizer->separators[i] == c) return 1;
+    }
+    return 0;
+}
+
+/* @c in lowercase if it is an ASCII letter, without a branch */
+static inline char tokenizer_fold(char c)
+{
+    return c | ((unsigned char)(c - 'A') < 26) << 5;
+}
+
+/*
+ * Called with each token, '\0'-terminated, in the order they are in the
+ * line. Returning nonzero stops the scan.
+ */
+typedef int (*token_fn)(char *token, void *data);
+
+/**********************************************************************
+ * tokenize_each
+ *
+ * DESCRIPTION
+ *   Hand each token of @line to @fn with @data. Tokens are runs of bytes
+ *   that are not separators, up to the end of @line or the start of a
+ *   comment. The comment is cut off by writing '\0' over it. Nothing but
+ *   the line is written, so lines of any length with any number of tokens
+ *   are tokenized in constant memory. With TOKENIZER_FOLD_CASE each token
+ *   is lowercased before it is handed to @fn, and so is the line up to the
+ *   comment. Once @fn stops the scan, the rest of the line is left alone,
+ *   not lowercased.
+ *
+ * RETURN VALUE
+ *   The number of tokens handed to @fn
+ **********************************************************************/
+int tokenize_each(const struct tokenizer *tokenizer, char *line, token_fn fn, void *data);
+
+/**********************************************************************
+ * tokenize
+ *
+ * DESCRIPTION
+ *   Put the first @max_tokens tokens of @line into @tokens[], as
+ *   tokenize_each() finds them. Tokens after them are left alone.
+ *
+ * RETURN VALUE
+ *   The number of tokens put into @tokens[]
+ **********************************************************************/
+int tokenize(const struct tokenizer *tokenizer, char *line, char *tokens[], int max_tokens);
+
+#endif